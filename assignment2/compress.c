@@ -0,0 +1,180 @@
+/*
+ *  compress.c - block codecs of packed bulk frames, see compress.h
+ */
+
+#include  <string.h>
+#include  <stdint.h>
+#ifdef HAVE_ZLIB
+#include  <zlib.h>
+#endif
+#include  "compress.h"
+
+#define LZ_HASH_BITS 13
+#define LZ_MAX_OFF (1 << 13)       /* farthest back reference */
+#define LZ_MAX_LIT 32              /* longest literal run */
+#define LZ_MAX_REF (2 + 7 + 255)   /* longest back reference */
+
+/* copy the literals from lit up to end as runs of at most LZ_MAX_LIT */
+static int lz_literals(unsigned char **op, unsigned char *oend, const unsigned char *lit, const unsigned char *end)
+{
+    int n;
+
+    while (lit < end)
+    {
+        n = (end - lit > LZ_MAX_LIT) ? LZ_MAX_LIT : end - lit;
+        if (*op + 1 + n > oend)
+            return -1;
+        *(*op)++ = n - 1;
+        memcpy(*op, lit, n);
+        *op += n;
+        lit += n;
+    }
+    return 0;
+}
+
+/* a control byte below 32 starts a run of that many + 1 literals, any */
+/* other one a back reference: length - 2 in the top 3 bits (7 means an */
+/* extra length byte follows) and the offset - 1 in 13 bits */
+static int lz_pack(const unsigned char *in, int len, unsigned char *out, int outsize)
+{
+    static const unsigned char *tab[1 << LZ_HASH_BITS];
+    const unsigned char *ip = in, *end = in + len, *lit = in, *ref;
+    unsigned char *op = out, *oend = out + outsize;
+    uint32_t h;
+    int off, n, max;
+
+    memset(tab, 0, sizeof(tab));
+    while (end - ip > 2)
+    {
+        h = ((uint32_t)ip[0] << 16 | ip[1] << 8 | ip[2]) * 2654435761u >> (32 - LZ_HASH_BITS);
+        ref = tab[h];
+        tab[h] = ip;
+        if (ref == NULL || ip - ref > LZ_MAX_OFF || ref[0] != ip[0] || ref[1] != ip[1] || ref[2] != ip[2])
+        {
+            ip++;
+            continue;
+        }
+        max = (end - ip > LZ_MAX_REF) ? LZ_MAX_REF : end - ip;
+        for (n = 3; n < max && ref[n] == ip[n]; n++)
+            ;
+        if (lz_literals(&op, oend, lit, ip) < 0 || op + 3 > oend)
+            return -1;
+        off = ip - ref - 1;
+        if (n - 2 < 7)
+        {
+            *op++ = (n - 2) << 5 | off >> 8;
+        }
+        else
+        {
+            *op++ = 7 << 5 | off >> 8;
+            *op++ = n - 2 - 7;
+        }
+        *op++ = off & 0xff;
+        ip += n;
+        lit = ip;
+    }
+    if (lz_literals(&op, oend, lit, end) < 0)
+        return -1;
+    return op - out;
+}
+
+static int lz_unpack(const unsigned char *in, int len, unsigned char *out, int outsize)
+{
+    const unsigned char *ip = in, *end = in + len;
+    unsigned char *op = out, *oend = out + outsize, *ref;
+    int c, n;
+
+    while (ip < end)
+    {
+        c = *ip++;
+        if (c < LZ_MAX_LIT)
+        {
+            n = c + 1;
+            if (end - ip < n || oend - op < n)
+                return -1;
+            memcpy(op, ip, n);
+            ip += n;
+            op += n;
+            continue;
+        }
+        n = (c >> 5) + 2;
+        if (n == 9 && ip < end)
+            n += *ip++;
+        if (ip >= end)
+            return -1;
+        ref = op - ((c & 0x1f) << 8 | *ip++) - 1;
+        if (ref < out || oend - op < n)
+            return -1;
+        /* the reference may overlap what it produces */
+        while (n-- > 0)
+            *op++ = *ref++;
+    }
+    return op - out;
+}
+
+int comp_codecs(void)
+{
+#ifdef HAVE_ZLIB
+    return 1 << COMP_ZLIB | 1 << COMP_LZ;
+#else
+    return 1 << COMP_LZ;
+#endif
+}
+
+int comp_choose(int peer)
+{
+    int common = peer & comp_codecs();
+
+    if (common & 1 << COMP_ZLIB)
+        return COMP_ZLIB;
+    if (common & 1 << COMP_LZ)
+        return COMP_LZ;
+    return COMP_RAW;
+}
+
+int comp_pack(int codec, char *in, int len, char *out, int outsize)
+{
+#ifdef HAVE_ZLIB
+    uLongf zlen;
+#endif
+    int n = -1;
+
+    /* a block that does not shrink is sent raw */
+    if (outsize >= len)
+        outsize = len - 1;
+    if (outsize <= 0)
+        return -1;
+    if (codec == COMP_LZ)
+    {
+        n = lz_pack((unsigned char *)in, len, (unsigned char *)out, outsize);
+    }
+#ifdef HAVE_ZLIB
+    else if (codec == COMP_ZLIB)
+    {
+        zlen = outsize;
+        if (compress2((Bytef *)out, &zlen, (Bytef *)in, len, Z_BEST_SPEED) == Z_OK)
+            n = zlen;
+    }
+#endif
+    return n;
+}
+
+int comp_unpack(int codec, char *in, int len, char *out, int outsize)
+{
+#ifdef HAVE_ZLIB
+    uLongf zlen;
+#endif
+
+    if (codec == COMP_LZ)
+        return lz_unpack((unsigned char *)in, len, (unsigned char *)out, outsize);
+#ifdef HAVE_ZLIB
+    if (codec == COMP_ZLIB)
+    {
+        zlen = outsize;
+        if (uncompress((Bytef *)out, &zlen, (Bytef *)in, len) != Z_OK)
+            return -1;
+        return zlen;
+    }
+#endif
+    return -1;
+}
@@ -0,0 +1,42 @@
+/*
+ *  compress.h - block codecs of packed bulk frames
+ *              (see sendpackedfile() in stream.h)
+ *              zlib when the build finds it (HAVE_ZLIB), and a small
+ *              built-in LZ codec that is always there, so two peers can
+ *              agree on one whatever is installed.
+ */
+
+#define COMP_RAW 0                 /* block stored as it is */
+#define COMP_ZLIB 1                /* zlib, fastest level */
+#define COMP_LZ 2                  /* built-in LZ77, LZF format */
+#define COMP_CHUNK (1024*256)      /* most bytes packed as one block */
+
+/*
+ * purpose:  tell which codecs this build has.
+ * post:     1) return value = bit (1 << codec) set for every codec
+ */
+int comp_codecs(void);
+
+/*
+ * purpose:  pick the codec to use with a peer that has the codecs of the
+ *           bit mask "peer".
+ * post:     1) return value = the codec, COMP_RAW if there is none in common
+ */
+int comp_choose(int peer);
+
+/*
+ * purpose:  pack the "len" bytes of "in" with "codec" into "out".
+ * pre:      1) len <= COMP_CHUNK
+ * post:     1) return value > 0  : packed length, less than len
+ *                           = -1 : the block would not get smaller, or
+ *                                  codec is not in this build
+ */
+int comp_pack(int codec, char *in, int len, char *out, int outsize);
+
+/*
+ * purpose:  unpack the "len" bytes of "in" packed with "codec" into "out".
+ * post:     1) return value >= 0 : unpacked length
+ *                           = -1 : corrupt block, too large for outsize,
+ *                                  or codec is not in this build
+ */
+int comp_unpack(int codec, char *in, int len, char *out, int outsize);
@@ -0,0 +1,176 @@
+/*
+ *  crc32c.c  - CRC-32C (Castagnoli) checksums, see crc32c.h
+ *              the crc32 instruction of SSE4.2 where the processor has
+ *              it, eight table lookups per 8 bytes otherwise; the choice
+ *              and the tables are made on first use
+ */
+
+#include  <unistd.h>
+#include  <string.h>
+#include  <stdint.h>
+#include  <sys/types.h>
+#include  "crc32c.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include  <nmmintrin.h>            /* _mm_crc32_u8(), _mm_crc32_u64() */
+#define CRC32C_SSE42
+#endif
+
+#define CRC32C_POLY 0x82f63b78     /* reflected Castagnoli polynomial */
+#define CRC_BUF_SIZE (1024*256)    /* bytes read per pread() */
+#define CRC_LANE 8192              /* bytes of each of the three lanes */
+                                   /* the crc32 instruction works on at once */
+
+static uint32_t table[8][256];
+static uint32_t lane[4][256];      /* moves a crc past CRC_LANE zeros */
+static uint32_t (*crc32c_fn)(uint32_t, const unsigned char *, size_t);
+
+/* slicing by 8: table[k][b] is the crc of byte b followed by k zeros */
+static uint32_t crc32c_sw(uint32_t crc, const unsigned char *p, size_t len)
+{
+    uint64_t w;
+
+    while (len > 0 && ((uintptr_t) p & 7) != 0) {
+        crc = table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+        len--;
+    }
+    while (len >= 8) {
+        memcpy(&w, p, 8);
+        w ^= crc;                  /* little endian, see crc32c_init() */
+        crc = table[7][w & 0xff] ^ table[6][(w >> 8) & 0xff] ^
+              table[5][(w >> 16) & 0xff] ^ table[4][(w >> 24) & 0xff] ^
+              table[3][(w >> 32) & 0xff] ^ table[2][(w >> 40) & 0xff] ^
+              table[1][(w >> 48) & 0xff] ^ table[0][w >> 56];
+        p += 8;
+        len -= 8;
+    }
+    while (len-- > 0)
+        crc = table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return (crc);
+}
+
+/* byte at a time, for processors that are not little endian */
+static uint32_t crc32c_bytes(uint32_t crc, const unsigned char *p, size_t len)
+{
+    while (len-- > 0)
+        crc = table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return (crc);
+}
+
+#ifdef CRC32C_SSE42
+/* a times b modulo the polynomial, both reflected as the crc is */
+static uint32_t gf2_mul(uint32_t a, uint32_t b)
+{
+    uint32_t m = 1U << 31, p = 0;
+
+    for (; m != 0; m >>= 1) {
+        if (a & m)
+            p ^= b;
+        b = (b & 1) ? (b >> 1) ^ CRC32C_POLY : b >> 1;
+    }
+    return (p);
+}
+
+/* the crc of a followed by CRC_LANE more bytes b is lane_shift(crc of a) */
+/* xor the crc of b started from 0 */
+static uint32_t lane_shift(uint32_t crc)
+{
+    return (lane[0][crc & 0xff] ^ lane[1][(crc >> 8) & 0xff] ^
+            lane[2][(crc >> 16) & 0xff] ^ lane[3][crc >> 24]);
+}
+
+/* the crc32 instruction, compiled for SSE4.2 only here so the rest of */
+/* the program still runs on any x86-64. It takes 3 cycles but a new one */
+/* can start every cycle, so large buffers are done as three lanes at */
+/* once whose crcs are joined at the end. The lanes only pay if they */
+/* stay in registers, so this loop is optimised whatever the build is */
+__attribute__((target("sse4.2"), optimize("O2")))
+static uint32_t crc32c_hw(uint32_t crc, const unsigned char *p, size_t len)
+{
+    uint64_t c = crc, c1, c2;
+    const unsigned char *end;
+
+    while (len > 0 && ((uintptr_t) p & 7) != 0) {
+        c = _mm_crc32_u8((uint32_t) c, *p++);
+        len--;
+    }
+    /* p is 8 byte aligned from here on */
+    while (len >= 3 * CRC_LANE) {
+        c1 = c2 = 0;
+        for (end = p + CRC_LANE; p < end; p += 8) {
+            c = _mm_crc32_u64(c, *(const uint64_t *) p);
+            c1 = _mm_crc32_u64(c1, *(const uint64_t *) (p + CRC_LANE));
+            c2 = _mm_crc32_u64(c2, *(const uint64_t *) (p + 2 * CRC_LANE));
+        }
+        c = lane_shift(lane_shift((uint32_t) c) ^ (uint32_t) c1) ^ (uint32_t) c2;
+        p += 2 * CRC_LANE;
+        len -= 3 * CRC_LANE;
+    }
+    while (len >= 8) {
+        c = _mm_crc32_u64(c, *(const uint64_t *) p);
+        p += 8;
+        len -= 8;
+    }
+    while (len-- > 0)
+        c = _mm_crc32_u8((uint32_t) c, *p++);
+    return ((uint32_t) c);
+}
+#endif
+
+static void crc32c_init()
+{
+    uint32_t crc, one = 1;
+    int i, j;
+
+    for (i = 0; i < 256; i++) {
+        crc = i;
+        for (j = 0; j < 8; j++)
+            crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        table[0][i] = crc;
+    }
+    for (i = 0; i < 256; i++)
+        for (j = 1; j < 8; j++)
+            table[j][i] = table[0][table[j - 1][i] & 0xff] ^ (table[j - 1][i] >> 8);
+    crc32c_fn = (*(unsigned char *) &one == 1) ? crc32c_sw : crc32c_bytes;
+#ifdef CRC32C_SSE42
+    /* x^(8 * CRC_LANE), x^8 squared until the power is big enough */
+    crc = 1U << 23;
+    for (i = 1; i < CRC_LANE; i <<= 1)
+        crc = gf2_mul(crc, crc);
+    for (i = 0; i < 256; i++)
+        for (j = 0; j < 4; j++)
+            lane[j][i] = gf2_mul(crc, (uint32_t) i << (8 * j));
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2"))
+        crc32c_fn = crc32c_hw;
+#endif
+}
+
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len)
+{
+    if (crc32c_fn == NULL)
+        crc32c_init();
+    return (~crc32c_fn(~crc, buf, len));
+}
+
+int crc32c_range(int fd, off_t offset, off_t len, uint32_t *crc)
+{
+    static char buf[CRC_BUF_SIZE];
+    int nr;
+
+    while (len > 0) {
+        nr = pread(fd, buf, len < CRC_BUF_SIZE ? len : CRC_BUF_SIZE, offset);
+        if (nr <= 0)
+            return (-1);
+        *crc = crc32c(*crc, buf, nr);
+        offset += nr;
+        len -= nr;
+    }
+    return (0);
+}
+
+int crc32c_file(int fd, off_t offset, off_t len, uint32_t *crc)
+{
+    *crc = 0;
+    return (crc32c_range(fd, offset, len, crc));
+}
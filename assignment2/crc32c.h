@@ -0,0 +1,32 @@
+/*
+ *  crc32c.h  - CRC-32C (Castagnoli) checksums of buffers and files
+ *              used to check the partial file of a resumed transfer and
+ *              the data of every transfer
+ */
+
+#include <stdint.h>                /* uint32_t */
+#include <sys/types.h>             /* off_t, size_t */
+
+/*
+ * purpose:  extend the checksum "crc" over "len" bytes of "buf".
+ *           A checksum starts at 0, crc32c(crc32c(0, a, n), b, m) is the
+ *           checksum of a followed by b.
+ * post:     1) return value = the new checksum
+ */
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len);
+
+/*
+ * purpose:  extend the checksum "*crc" over "len" bytes of file "fd"
+ *           starting at "offset", without moving the file offset.
+ * post:     1) return value = 0  : *crc holds the new checksum
+ *                           = -1 : read error or the file is shorter
+ */
+int crc32c_range(int fd, off_t offset, off_t len, uint32_t *crc);
+
+/*
+ * purpose:  checksum "len" bytes of file "fd" starting at "offset",
+ *           without moving the file offset.
+ * post:     1) return value = 0  : *crc holds the checksum
+ *                           = -1 : read error or the file is shorter
+ */
+int crc32c_file(int fd, off_t offset, off_t len, uint32_t *crc);
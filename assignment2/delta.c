@@ -0,0 +1,351 @@
+/*
+ *  delta.c   - delta uploads of the version 2 protocol
+ *              signatures, rolling match and rebuild, see delta.h
+ */
+
+#include  <unistd.h>
+#include  <stdlib.h>
+#include  <string.h>
+#include  <stdint.h>
+#include  <sys/types.h>
+#include  <sys/mman.h>
+#include  <netinet/in.h>           /* htonl(), ntohl() */
+#include  "stream.h"
+#include  "netprotocol.h"
+#include  "crc32c.h"
+#include  "delta.h"
+
+#define DELTA_CHAR_OFFSET 31       /* added to every byte of the weak sum */
+
+/* the weak checksum of rsync: s1 is the sum of the bytes, s2 the sum of */
+/* the running s1, so a window moved by one byte is updated in O(1) */
+static uint32_t delta_weak(const unsigned char *p, int len, uint32_t *s1, uint32_t *s2)
+{
+    uint32_t a = 0, b = 0;
+    int i;
+
+    for (i = 0; i < len; i++)
+    {
+        a += p[i] + DELTA_CHAR_OFFSET;
+        b += a;
+    }
+    *s1 = a;
+    *s2 = b;
+    return (a & 0xffff) | (b << 16);
+}
+
+/* 64-bit FNV-1a, checked only when the weak checksum matches */
+static uint64_t delta_strong(const unsigned char *p, int len)
+{
+    uint64_t h = 14695981039346656037ULL;
+    int i;
+
+    for (i = 0; i < len; i++)
+    {
+        h ^= p[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+int delta_block(off_t size)
+{
+    int block = DELTA_MIN_BLOCK;
+
+    while (block < DELTA_MAX_BLOCK && (off_t)block * block < size)
+        block *= 2;
+    return block;
+}
+
+int delta_sigs(int sd, int fd, off_t size, int block, int blksize)
+{
+    unsigned char *data;
+    char *out;
+    uint32_t s1, s2, w[3];
+    uint64_t strong;
+    off_t off;
+    int n = 0, per = blksize / DELTA_SIG_SIZE * DELTA_SIG_SIZE, ret = 0;
+
+    if ((data = malloc(block)) == NULL || (out = malloc(per)) == NULL)
+    {
+        free(data);
+        return -1;
+    }
+    for (off = 0; ret == 0 && off + block <= size; off += block)
+    {
+        if (pread(fd, data, block, off) != block)
+        {
+            ret = -1;
+            break;
+        }
+        w[0] = htonl(delta_weak(data, block, &s1, &s2));
+        strong = delta_strong(data, block);
+        w[1] = htonl((uint32_t)(strong >> 32));
+        w[2] = htonl((uint32_t)strong);
+        memcpy(out + n, w, DELTA_SIG_SIZE);
+        n += DELTA_SIG_SIZE;
+        if (n == per)
+        {
+            if (writebulk(sd, out, n) != n)
+                ret = -1;
+            n = 0;
+        }
+    }
+    if (ret == 0 && ((n > 0 && writebulk(sd, out, n) != n) || writebulk(sd, NULL, 0) != 0 || stream_flush(sd) < 0))
+        ret = -1;
+    free(data);
+    free(out);
+    return ret;
+}
+
+/* send the pending reference of clen bytes at *coff of the old copy, then */
+/* the literals of the new file from lit up to end */
+static int delta_flush(int sd, char op, const unsigned char *lit, const unsigned char *end, off_t coff, off_t *clen,
+                       int blksize, struct delta_stats *ds)
+{
+    struct v2_msg m;
+    int n;
+
+    m.op = op;
+    m.status = V2_OK;
+    m.id = 0;
+    m.data = NULL;
+    m.len = 0;
+    if (*clen > 0)
+    {
+        m.flags = 0;
+        m.size = *clen;
+        m.offset = coff;
+        if (v2_send(sd, &m) < 0)
+            return -1;
+        ds->copied += *clen;
+        *clen = 0;
+    }
+    /* each run of literals is one message and one bulk frame */
+    for (; lit < end; lit += n)
+    {
+        n = (end - lit > blksize) ? blksize : end - lit;
+        m.flags = V2_F_DATA;
+        m.size = n;
+        m.offset = 0;
+        if (v2_send(sd, &m) < 0 || writebulk(sd, (char *)lit, n) != n)
+            return -1;
+        ds->literal += n;
+    }
+    return 0;
+}
+
+/* look up the signature of the window at p, the one right after the */
+/* pending reference first so runs of blocks stay one reference */
+static long delta_find(const unsigned char *p, int block, uint32_t w, long next_block, uint32_t *weak,
+                       uint64_t *strong, long nsigs, long *head, long *next, long mask)
+{
+    uint64_t h = 0;
+    int have = 0;
+    long i;
+
+    if (next_block >= 0 && next_block < nsigs && weak[next_block] == w)
+    {
+        h = delta_strong(p, block);
+        have = 1;
+        if (strong[next_block] == h)
+            return next_block;
+    }
+    for (i = head[w & mask]; i >= 0; i = next[i])
+    {
+        if (weak[i] != w)
+            continue;
+        if (!have)
+        {
+            h = delta_strong(p, block);
+            have = 1;
+        }
+        if (strong[i] == h)
+            return i;
+    }
+    return -1;
+}
+
+int delta_send(int sd, char op, int fd, off_t size, off_t oldsize, int block, int whole, int blksize,
+               struct delta_stats *ds)
+{
+    unsigned char *p = NULL, *sigbuf = NULL;
+    uint32_t *weak = NULL, s1 = 0, s2 = 0, w[3], x, y;
+    uint64_t *strong = NULL;
+    long *head = NULL, *next = NULL, nsigs, mask = 0, i, match;
+    off_t pos = 0, ls = 0, coff = 0, clen = 0, got = 0, nr;
+    struct v2_msg m;
+    int ret = -1;
+
+    memset(ds, 0, sizeof(struct delta_stats));
+    if (block < DELTA_MIN_BLOCK || block > DELTA_MAX_BLOCK || oldsize < 0)
+        return -1;
+    nsigs = oldsize / block;
+    if ((sigbuf = malloc(nsigs * DELTA_SIG_SIZE + 1)) == NULL)
+        return -1;
+    while ((nr = readbulk(sd, (char *)sigbuf + got, nsigs * DELTA_SIG_SIZE - got)) > 0)
+        got += nr;
+    if (nr < 0 || got != nsigs * DELTA_SIG_SIZE)
+        goto out;
+    if (size > 0 && (p = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+    {
+        p = NULL;
+        goto out;
+    }
+    if (p != NULL)
+        madvise(p, size, MADV_SEQUENTIAL);
+    if (whole || size < block)
+        nsigs = 0;
+    /* chained hash table of the weak checksums, at least twice the size */
+    if (nsigs > 0)
+    {
+        for (mask = 1; mask < 2 * nsigs; mask <<= 1)
+            ;
+        if ((weak = malloc(nsigs * sizeof(uint32_t))) == NULL || (strong = malloc(nsigs * sizeof(uint64_t))) == NULL ||
+            (head = malloc(mask * sizeof(long))) == NULL || (next = malloc(nsigs * sizeof(long))) == NULL)
+            goto out;
+        mask--;
+        memset(head, 0xff, (mask + 1) * sizeof(long));
+        for (i = nsigs - 1; i >= 0; i--)
+        {
+            memcpy(w, sigbuf + i * DELTA_SIG_SIZE, DELTA_SIG_SIZE);
+            weak[i] = ntohl(w[0]);
+            strong[i] = ((uint64_t)ntohl(w[1]) << 32) | ntohl(w[2]);
+            next[i] = head[weak[i] & mask];
+            head[weak[i] & mask] = i;
+        }
+        delta_weak(p, block, &s1, &s2);
+    }
+    while (nsigs > 0 && pos + block <= size)
+    {
+        match = delta_find(p + pos, block, (s1 & 0xffff) | (s2 << 16), clen > 0 ? (coff + clen) / block : -1,
+                           weak, strong, nsigs, head, next, mask);
+        if (match >= 0)
+        {
+            /* a block the server has, the literals before it go first */
+            if (ls < pos && delta_flush(sd, op, p + ls, p + pos, coff, &clen, blksize, ds) < 0)
+                goto out;
+            if (clen == 0 || coff + clen != (off_t)match * block)
+            {
+                if (delta_flush(sd, op, p, p, coff, &clen, blksize, ds) < 0)
+                    goto out;
+                coff = (off_t)match * block;
+            }
+            clen += block;
+            pos += block;
+            ls = pos;
+            if (pos + block <= size)
+                delta_weak(p + pos, block, &s1, &s2);
+            continue;
+        }
+        if (pos - ls >= blksize)
+        {
+            if (delta_flush(sd, op, p + ls, p + pos, coff, &clen, blksize, ds) < 0)
+                goto out;
+            ls = pos;
+        }
+        /* slide the window by one byte */
+        if (pos + block < size)
+        {
+            x = p[pos] + DELTA_CHAR_OFFSET;
+            y = p[pos + block] + DELTA_CHAR_OFFSET;
+            s1 += y - x;
+            s2 += s1 - block * x;
+        }
+        pos++;
+    }
+    if (delta_flush(sd, op, p + ls, p + size, coff, &clen, blksize, ds) < 0)
+        goto out;
+    ds->size = size;
+    ds->crc = (p != NULL) ? crc32c(0, p, size) : 0;
+    m.op = op;
+    m.status = V2_OK;
+    m.flags = V2_F_END;
+    m.size = size;
+    m.offset = ds->crc;
+    m.id = 0;
+    m.data = NULL;
+    m.len = 0;
+    if (v2_send(sd, &m) < 0 || stream_flush(sd) < 0)
+        goto out;
+    ret = 0;
+out:
+    if (p != NULL)
+        munmap(p, size);
+    free(sigbuf);
+    free(weak);
+    free(strong);
+    free(head);
+    free(next);
+    return ret;
+}
+
+/* copy len bytes of old at from to fd at to through buf */
+static int delta_copy(int old, off_t from, int fd, off_t to, off_t len, char *buf, int bufsize)
+{
+    ssize_t n;
+
+    while (len > 0)
+    {
+        n = (len > bufsize) ? bufsize : len;
+        if ((n = pread(old, buf, n, from)) <= 0 || pwrite(fd, buf, n, to) != n)
+            return -1;
+        from += n;
+        to += n;
+        len -= n;
+    }
+    return 0;
+}
+
+int delta_recv(int sd, char op, int old, off_t oldsize, int fd, int blksize, struct delta_stats *ds)
+{
+    char buf[MAX_BLOCK_SIZE], *data;
+    struct v2_msg m;
+    off_t out = 0;
+    int ret = 0;
+
+    memset(ds, 0, sizeof(struct delta_stats));
+    if ((data = malloc(blksize)) == NULL)
+        return -1;
+    if (fd < 0)
+        ret = -2;
+    while (1)
+    {
+        if (v2_recv(sd, &m, buf) < 0 || m.op != op)
+        {
+            ret = -1;
+            break;
+        }
+        if (m.flags & V2_F_END)
+        {
+            ds->size = m.size;
+            ds->crc = (uint32_t)m.offset;
+            if (ret == 0 && m.size != out)
+                ret = -2;
+            break;
+        }
+        if (m.flags & V2_F_DATA)
+        {
+            if (m.size <= 0 || m.size > blksize || readbulk(sd, data, blksize) != m.size)
+            {
+                ret = -1;
+                break;
+            }
+            if (ret == 0 && pwrite(fd, data, m.size, out) != m.size)
+                ret = -2;
+            ds->literal += m.size;
+        }
+        else
+        {
+            /* a reference must lie inside the old copy */
+            if (m.size < 0 || m.offset < 0 || m.offset + m.size > oldsize)
+                ret = (ret == 0) ? -2 : ret;
+            else if (ret == 0 && delta_copy(old, m.offset, fd, out, m.size, data, blksize) < 0)
+                ret = -2;
+            ds->copied += m.size;
+        }
+        out += m.size;
+    }
+    free(data);
+    return ret;
+}
@@ -0,0 +1,68 @@
+/*
+ *  delta.h   - delta uploads of the version 2 protocol
+ *              (see DELTA_CODE in netprotocol.h)
+ *              The server splits its copy of a file into blocks and sends
+ *              a signature of each, a rolling weak checksum and a strong
+ *              hash. The client slides a window over its new file, sends
+ *              a reference for every block the server already has and
+ *              the bytes in between as literal data, and the server
+ *              builds the new file from its old copy and the delta.
+ */
+
+#include <stdint.h>                /* uint32_t */
+#include <sys/types.h>             /* off_t */
+
+#define DELTA_MIN_BLOCK (1024*2)   /* smallest and largest block of the */
+#define DELTA_MAX_BLOCK (1024*128) /* signatures */
+#define DELTA_SIG_SIZE 12          /* weak checksum then strong hash */
+
+struct delta_stats
+{
+    off_t size;                    /* size of the new file */
+    off_t literal;                 /* bytes sent / received as literals */
+    off_t copied;                  /* bytes taken from the old copy */
+    uint32_t crc;                  /* CRC-32C of the new file */
+};
+
+/*
+ * purpose:  pick the block length of the signatures of a file of "size"
+ *           bytes, about its square root so a large file has neither
+ *           too many signatures nor too coarse blocks.
+ * post:     1) return value = the block length
+ */
+int delta_block(off_t size);
+
+/*
+ * purpose:  send the signatures of every whole "block" of the "size" bytes
+ *           of file "fd" to "sd" as bulk frames of at most "blksize" bytes
+ *           followed by the empty frame.
+ * post:     1) return value = 0  : the signatures are sent
+ *                           = -1 : read or write error
+ */
+int delta_sigs(int sd, int fd, off_t size, int block, int blksize);
+
+/*
+ * purpose:  read the signatures of an old copy of "oldsize" bytes cut in
+ *           "block" byte blocks from "sd", then send the delta of the
+ *           "size" bytes of file "fd" against it as "op" messages and the
+ *           end message. With "whole" set the signatures are read but
+ *           not used, the whole file goes as literals.
+ * post:     1) return value = 0  : the delta is sent, ds tells how
+ *                           = -1 : read, write or protocol error
+ */
+int delta_send(int sd, char op, int fd, off_t size, off_t oldsize, int block, int whole, int blksize,
+               struct delta_stats *ds);
+
+/*
+ * purpose:  receive a delta of "op" messages from "sd" up to its end
+ *           message and build the new file in "fd" from it and the old
+ *           copy "old" of "oldsize" bytes. With "fd" -1 the delta is only
+ *           drained.
+ * post:     1) return value = 0  : the new file is in fd, ds->crc is the
+ *                                  CRC-32C the client computed, to be
+ *                                  checked against fd
+ *                           = -1 : read or protocol error
+ *                           = -2 : the delta was read but the file could
+ *                                  not be built
+ */
+int delta_recv(int sd, char op, int old, off_t oldsize, int fd, int blksize, struct delta_stats *ds);
@@ -0,0 +1,186 @@
+/*
+ *  listing.c - directory listings of the version 2 protocol
+ *              entries packed back to back, see listing.h
+ */
+
+#include  <string.h>
+#include  <stdint.h>
+#include  <fcntl.h>
+#include  <dirent.h>
+#include  <sys/types.h>
+#include  <sys/stat.h>
+#include  <netinet/in.h>           /* htonl(), ntohl(), htons(), ntohs() */
+#include  "listing.h"
+
+/* 64-bit values go high word first, as in the v2 header */
+static void list_put64(char *buf, long long v)
+{
+    uint32_t w[2];
+
+    w[0] = htonl((uint32_t)((unsigned long long)v >> 32));
+    w[1] = htonl((uint32_t)v);
+    memcpy(buf, w, 8);
+}
+
+static long long list_get64(char *buf)
+{
+    uint32_t w[2];
+
+    memcpy(w, buf, 8);
+    return (long long)(((unsigned long long)ntohl(w[0]) << 32) | ntohl(w[1]));
+}
+
+/* pack the entry "name" of "st" into buf, returns its length */
+static int list_pack(char *buf, long long cursor, struct stat *st, char *name)
+{
+    uint32_t mode = htonl(st->st_mode);
+    uint16_t len = strlen(name);
+    int n = len;
+
+    list_put64(buf, cursor);
+    list_put64(buf + 8, S_ISDIR(st->st_mode) ? 0 : st->st_size);
+    list_put64(buf + 16, st->st_mtime);
+    memcpy(buf + 24, &mode, 4);
+    len = htons(len);
+    memcpy(buf + 28, &len, 2);
+    memcpy(buf + LIST_REC_HDR, name, n);
+    return (LIST_REC_HDR + n);
+}
+
+/* make ls->rec the next entry, or set ls->done */
+static void list_read(struct listing *ls)
+{
+    struct list_entry e;
+    struct dirent *de;
+    struct stat st;
+    int pos;
+
+    if (ls->rec != NULL || ls->done)
+        return;
+    if (ls->dp == NULL)
+    {
+        pos = ls->pos;
+        if (list_next(ls->packed, ls->packedlen, &pos, &e) <= 0)
+        {
+            ls->done = 1;
+            return;
+        }
+        ls->rec = ls->packed + ls->pos;
+        ls->reclen = pos - ls->pos;
+        return;
+    }
+    while ((de = readdir(ls->dp)) != NULL)
+    {
+        /* hidden files are skipped, entries gone since are too */
+        if (de->d_name[0] == '.' || fstatat(dirfd(ls->dp), de->d_name, &st, AT_SYMLINK_NOFOLLOW) < 0)
+            continue;
+        ls->reclen = list_pack(ls->pend, telldir(ls->dp), &st, de->d_name);
+        ls->rec = ls->pend;
+        return;
+    }
+    ls->done = 1;
+}
+
+static void list_start(struct listing *ls, long long page)
+{
+    ls->rec = NULL;
+    ls->cursor = 0;
+    ls->left = (page > 0) ? page : -1;
+    ls->count = 0;
+    ls->done = 0;
+}
+
+int list_open(struct listing *ls, long long cursor, long long page)
+{
+    if ((ls->dp = opendir(".")) == NULL)
+        return (-1);
+    ls->packed = NULL;
+    list_start(ls, page);
+    if (cursor != 0)
+    {
+        seekdir(ls->dp, cursor);
+        ls->cursor = cursor;
+    }
+    return (0);
+}
+
+int list_packed(struct listing *ls, char *packed, int len, long long cursor, long long page)
+{
+    struct list_entry e;
+    int pos = 0;
+
+    ls->dp = NULL;
+    ls->packed = packed;
+    ls->packedlen = len;
+    ls->pos = 0;
+    list_start(ls, page);
+    if (cursor == 0)
+        return (0);
+    /* the entry the cursor belongs to, the listing goes on after it */
+    while (list_next(packed, len, &pos, &e) > 0)
+    {
+        if (e.cursor == cursor)
+        {
+            ls->pos = pos;
+            ls->cursor = cursor;
+            return (0);
+        }
+    }
+    return (-1);
+}
+
+int list_fill(struct listing *ls, char *buf, int size)
+{
+    int n = 0;
+
+    while (ls->left != 0)
+    {
+        list_read(ls);
+        if (ls->done || n + ls->reclen > size)
+            break;
+        memcpy(buf + n, ls->rec, ls->reclen);
+        n += ls->reclen;
+        ls->cursor = list_get64(ls->rec);
+        if (ls->dp == NULL)
+            ls->pos += ls->reclen;
+        ls->rec = NULL;
+        ls->count++;
+        if (ls->left > 0)
+            ls->left--;
+    }
+    /* a full page tells whether there is more behind it */
+    if (ls->left == 0)
+        list_read(ls);
+    return (n);
+}
+
+void list_close(struct listing *ls)
+{
+    if (ls->dp != NULL)
+        closedir(ls->dp);
+    ls->dp = NULL;
+}
+
+int list_next(char *buf, int len, int *pos, struct list_entry *e)
+{
+    uint32_t mode;
+    uint16_t namelen;
+
+    if (*pos >= len)
+        return (0);
+    if (len - *pos < LIST_REC_HDR)
+        return (-1);
+    buf += *pos;
+    memcpy(&mode, buf + 24, 4);
+    memcpy(&namelen, buf + 28, 2);
+    e->namelen = ntohs(namelen);
+    if (e->namelen > len - *pos - LIST_REC_HDR)
+        return (-1);
+    e->cursor = list_get64(buf);
+    e->size = list_get64(buf + 8);
+    e->mtime = list_get64(buf + 16);
+    e->mode = ntohl(mode);
+    e->name = buf + LIST_REC_HDR;
+    *pos += LIST_REC_HDR + e->namelen;
+    return (1);
+}
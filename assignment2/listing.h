@@ -0,0 +1,80 @@
+/*
+ *  listing.h - directory listings of the version 2 protocol
+ *              (see LIST_CODE in netprotocol.h)
+ *              The server reads the directory one entry at a time and packs
+ *              the entries into frames, the client unpacks them a frame at
+ *              a time, so neither side holds more than a frame of a listing
+ *              however many entries the directory has.
+ */
+
+#include  <dirent.h>
+#include  <limits.h>                /* NAME_MAX */
+
+#define LIST_REC_HDR 30            /* cursor, size, mtime, mode and the */
+                                   /* name length, ahead of the name */
+#define LIST_REC_MAX (LIST_REC_HDR + NAME_MAX)
+
+struct list_entry
+{
+    long long cursor;              /* resumes the listing after the entry */
+    long long size;
+    long long mtime;               /* seconds */
+    unsigned int mode;             /* st_mode, type and permission bits */
+    char *name;                    /* not null terminated */
+    int namelen;
+};
+
+struct listing
+{
+    DIR *dp;                       /* directory read, NULL for a listing */
+                                   /* that is packed already */
+    char *packed;                  /* see list_packed() */
+    int packedlen, pos;
+    char pend[LIST_REC_MAX];       /* next entry of the directory */
+    char *rec;                     /* next entry, NULL if not read yet */
+    int reclen;
+    long long cursor;              /* of the last entry taken */
+    long long left;                /* entries still wanted, -1 for all */
+    long long count;               /* entries taken */
+    int done;                      /* no entries left */
+};
+
+/*
+ * purpose:  start listing the current directory after the entry of
+ *           "cursor" (0 for the first entry), at most "page" entries
+ *           (0 for all). Names starting with a dot are left out.
+ * post:     1) return value = 0  : ls is ready for list_fill()
+ *                           = -1 : the directory cannot be read
+ */
+int list_open(struct listing *ls, long long cursor, long long page);
+
+/*
+ * purpose:  list the "len" bytes of entries packed by list_fill() from
+ *           "packed", the whole listing of a directory, in the same way.
+ * post:     1) return value = 0  : ls is ready for list_fill()
+ *                           = -1 : no entry of the listing has "cursor"
+ */
+int list_packed(struct listing *ls, char *packed, int len, long long cursor, long long page);
+
+/*
+ * purpose:  pack as many of the next entries as fit into the "size"
+ *           bytes of "buf" (at least LIST_REC_MAX).
+ * post:     1) return value = bytes packed, 0 once the listing is over
+ *           2) ls->done is set when the directory has no entries left,
+ *              ls->cursor resumes the listing otherwise
+ */
+int list_fill(struct listing *ls, char *buf, int size);
+
+/*
+ * purpose:  end a listing started by list_open() or list_packed().
+ */
+void list_close(struct listing *ls);
+
+/*
+ * purpose:  unpack the entry at "*pos" of the "len" bytes of "buf" into
+ *           "e" and move *pos past it. e->name points into buf.
+ * post:     1) return value = 1  : e holds the entry
+ *                           = 0  : no entries left in buf
+ *                           = -1 : buf is not a list of entries
+ */
+int list_next(char *buf, int len, int *pos, struct list_entry *e);
@@ -0,0 +1,351 @@
+/*
+ *  mux.c     - multiplexed sessions of the version 2 protocol
+ *              frame queue, frame reader and flow controlled data frames
+ *              shared by the client and the server, see mux.h
+ */
+
+#include  <unistd.h>
+#include  <stdlib.h>
+#include  <string.h>
+#include  <errno.h>
+#include  <stdint.h>
+#include  <poll.h>
+#include  <sys/types.h>
+#include  <sys/socket.h> /* send(), recv(), MSG_DONTWAIT */
+#include  <netinet/in.h> /* htonl(), ntohl() */
+#include  "stream.h"
+#include  "netprotocol.h"
+#include  "crc32c.h"
+#include  "mux.h"
+
+/* room for a complete frame behind a partial one */
+#define MUX_IN_SIZE (2 * (4 + V2_HDR_SIZE + MUX_CHUNK))
+
+/* make room for nbytes more output, returns 0 or -1 */
+static int mux_reserve(struct mux *mx, int nbytes)
+{
+    char *p;
+
+    if (mx->outlen + nbytes <= mx->outcap)
+        return 0;
+    /* reclaim the bytes already written before growing */
+    if (mx->outpos > 0)
+    {
+        memmove(mx->out, mx->out + mx->outpos, mx->outlen - mx->outpos);
+        mx->outlen -= mx->outpos;
+        mx->outpos = 0;
+    }
+    if (mx->outlen + nbytes <= mx->outcap)
+        return 0;
+    if ((p = realloc(mx->out, mx->outlen + nbytes + MUX_CHUNK)) == NULL)
+        return -1;
+    mx->out = p;
+    mx->outcap = mx->outlen + nbytes + MUX_CHUNK;
+    return 0;
+}
+
+/* write as much queued output as the socket takes, -1 on error */
+static int mux_write(struct mux *mx)
+{
+    int nw;
+
+    while (mx->outpos < mx->outlen)
+    {
+        nw = send(mx->sd, mx->out + mx->outpos, mx->outlen - mx->outpos, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (nw < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0;
+            return -1;
+        }
+        mx->outpos += nw;
+    }
+    mx->outpos = mx->outlen = 0;
+    return 0;
+}
+
+int mux_open(struct mux *mx, int sd)
+{
+    memset(mx, 0, sizeof(struct mux));
+    mx->sd = sd;
+    if (stream_flush(sd) < 0)
+        return -1;
+    if ((mx->in = malloc(MUX_IN_SIZE)) == NULL)
+        return -1;
+    return 0;
+}
+
+int mux_close(struct mux *mx)
+{
+    struct pollfd pfd;
+    int i, ret = 0;
+
+    pfd.fd = mx->sd;
+    pfd.events = POLLOUT;
+    while (mx->outpos < mx->outlen)
+    {
+        if ((poll(&pfd, 1, -1) < 0 && errno != EINTR) || mux_write(mx) < 0)
+        {
+            ret = -1;
+            break;
+        }
+    }
+    for (i = 0; i < MUX_MAX_STREAMS; i++)
+    {
+        if (mx->st[i].id != 0)
+            mux_end(mx, &mx->st[i]);
+    }
+    free(mx->in);
+    free(mx->out);
+    mx->in = mx->out = NULL;
+    return ret;
+}
+
+struct mux_stream *mux_add(struct mux *mx, unsigned int id, char op, int fd, off_t size, int sending)
+{
+    struct mux_stream *st;
+    int i;
+
+    for (i = 0; i < MUX_MAX_STREAMS; i++)
+    {
+        st = &mx->st[i];
+        if (st->id != 0)
+            continue;
+        st->id = id;
+        st->op = op;
+        st->status = V2_OK;
+        st->fd = fd;
+        st->sending = sending;
+        st->size = size;
+        st->done = 0;
+        st->credit = MUX_WINDOW;
+        st->unacked = 0;
+        st->crc = 0;
+        return st;
+    }
+    return NULL;
+}
+
+struct mux_stream *mux_find(struct mux *mx, unsigned int id)
+{
+    int i;
+
+    for (i = 0; id != 0 && i < MUX_MAX_STREAMS; i++)
+    {
+        if (mx->st[i].id == id)
+            return &mx->st[i];
+    }
+    return NULL;
+}
+
+void mux_end(struct mux *mx, struct mux_stream *st)
+{
+    if (st->fd >= 0)
+        close(st->fd);
+    memset(st, 0, sizeof(struct mux_stream));
+    st->fd = -1;
+}
+
+int mux_queue(struct mux *mx, struct v2_msg *m)
+{
+    uint32_t len = htonl(V2_HDR_SIZE + m->len);
+
+    if (mux_reserve(mx, 4 + V2_HDR_SIZE + m->len) < 0)
+        return -1;
+    memcpy(mx->out + mx->outlen, &len, 4);
+    mx->outlen += 4 + v2_pack(mx->out + mx->outlen + 4, m);
+    return 0;
+}
+
+/* queue the next data frame of st, or the end of its data */
+static void mux_chunk(struct mux *mx, struct mux_stream *st)
+{
+    struct v2_msg m;
+    uint32_t len;
+    char *frame;
+    off_t left;
+    int nr;
+
+    m.op = st->op;
+    m.status = V2_OK;
+    m.flags = V2_F_DATA;
+    m.size = 0;
+    m.offset = st->done;
+    m.id = st->id;
+    m.data = NULL;
+    m.len = 0;
+    left = st->size - st->done;
+    if (left > st->credit)
+        left = st->credit;
+    if (left > MUX_CHUNK)
+        left = MUX_CHUNK;
+    nr = 0;
+    if (left > 0 && mux_reserve(mx, 4 + V2_HDR_SIZE + left) == 0)
+    {
+        /* the payload is read straight into the output queue */
+        frame = mx->out + mx->outlen;
+        v2_pack(frame + 4, &m);
+        if ((nr = pread(st->fd, frame + 4 + V2_HDR_SIZE, left, st->done)) > 0)
+        {
+            len = htonl(V2_HDR_SIZE + nr);
+            memcpy(frame, &len, 4);
+            mx->outlen += 4 + V2_HDR_SIZE + nr;
+            st->crc = crc32c(st->crc, frame + 4 + V2_HDR_SIZE, nr);
+            st->done += nr;
+            st->credit -= nr;
+            mx->bytes += nr;
+            return;
+        }
+        if (nr < 0)
+            st->status = V2_ERROR;
+    }
+    else if (left > 0)
+    {
+        st->status = V2_ERROR;
+    }
+    /* all sent, or the file shrank or failed: the trailer tells how much */
+    /* and carries the sum of what was sent */
+    m.status = st->status;
+    m.flags = V2_F_DATA | V2_F_END | V2_F_CHECK;
+    m.size = st->done;
+    m.offset = st->crc;
+    mux_queue(mx, &m);
+    st->sending = 0;
+    if (st->op == GET_CODE1)
+    {
+        if (mx->sent != NULL)
+            mx->sent(mx, st);
+        mux_end(mx, st);
+    }
+}
+
+/* queue data frames of the sending streams in turn */
+static void mux_pump(struct mux *mx)
+{
+    struct mux_stream *st;
+    int idle = 0;
+
+    while (mx->outlen - mx->outpos < MUX_OUT_HIGH && idle < MUX_MAX_STREAMS)
+    {
+        st = &mx->st[mx->next];
+        mx->next = (mx->next + 1) % MUX_MAX_STREAMS;
+        if (st->id == 0 || !st->sending || (st->credit <= 0 && st->done < st->size))
+        {
+            idle++;
+            continue;
+        }
+        idle = 0;
+        mux_chunk(mx, st);
+    }
+}
+
+struct mux_stream *mux_data(struct mux *mx, struct v2_msg *m)
+{
+    struct mux_stream *st;
+    struct v2_msg credit;
+
+    if ((st = mux_find(mx, m->id)) == NULL)
+        return NULL;
+    if (m->flags & V2_F_CREDIT)
+    {
+        st->credit += m->size;
+        return NULL;
+    }
+    if (st->sending)
+        return NULL;
+    if (m->flags & V2_F_END)
+    {
+        if (m->status != V2_OK || m->size > st->done)
+            st->status = V2_ERROR;
+        else if ((m->flags & V2_F_CHECK) && m->size == st->done && (uint32_t)m->offset != st->crc)
+            st->status = (st->status == V2_OK) ? V2_MISMATCH : st->status;
+        else if (m->size < st->done && st->fd >= 0 && ftruncate(st->fd, m->size) < 0)
+            st->status = V2_ERROR;
+        return st;
+    }
+    /* data outside the announced size fails the file, nothing is written */
+    if (st->status == V2_OK && (m->offset < 0 || m->offset + m->len > st->size))
+        st->status = V2_ERROR;
+    /* a failed file still takes its data to stay in step with the peer */
+    if (st->status == V2_OK && st->fd >= 0 && m->len > 0 &&
+        pwrite(st->fd, m->data, m->len, m->offset) != m->len)
+    {
+        close(st->fd);
+        st->fd = -1;
+        st->status = V2_ERROR;
+    }
+    st->crc = crc32c(st->crc, m->data, m->len);
+    st->done += m->len;
+    st->unacked += m->len;
+    mx->bytes += m->len;
+    if (st->unacked >= MUX_WINDOW / 2)
+    {
+        credit.op = st->op;
+        credit.status = V2_OK;
+        credit.flags = V2_F_CREDIT;
+        credit.size = st->unacked;
+        credit.offset = 0;
+        credit.id = st->id;
+        credit.data = NULL;
+        credit.len = 0;
+        mux_queue(mx, &credit);
+        st->unacked = 0;
+    }
+    return NULL;
+}
+
+int mux_next(struct mux *mx, struct v2_msg *m)
+{
+    uint32_t len;
+
+    if (mx->inlen - mx->inpos >= 4)
+    {
+        memcpy(&len, mx->in + mx->inpos, 4);
+        len = ntohl(len);
+        if (len < V2_HDR_SIZE || len > V2_HDR_SIZE + MUX_CHUNK)
+            return -1;
+        if (mx->inlen - mx->inpos >= 4 + (int)len)
+        {
+            if (v2_parse(mx->in + mx->inpos + 4, len, m) < 0)
+                return -1;
+            mx->inpos += 4 + len;
+            return 1;
+        }
+    }
+    /* keep the partial frame at the start of the buffer */
+    memmove(mx->in, mx->in + mx->inpos, mx->inlen - mx->inpos);
+    mx->inlen -= mx->inpos;
+    mx->inpos = 0;
+    return 0;
+}
+
+int mux_io(struct mux *mx)
+{
+    struct pollfd pfd;
+    int nr;
+
+    mux_pump(mx);
+    pfd.fd = mx->sd;
+    pfd.events = 0;
+    if (mx->inlen < MUX_IN_SIZE)
+        pfd.events |= POLLIN;
+    if (mx->outpos < mx->outlen)
+        pfd.events |= POLLOUT;
+    if (poll(&pfd, 1, -1) < 0)
+        return (errno == EINTR) ? 0 : -1;
+    if ((pfd.revents & POLLOUT) && mux_write(mx) < 0)
+        return -1;
+    if (pfd.revents & (POLLIN | POLLHUP | POLLERR))
+    {
+        nr = recv(mx->sd, mx->in + mx->inlen, MUX_IN_SIZE - mx->inlen, MSG_DONTWAIT);
+        if (nr == 0)
+            return -1;
+        if (nr < 0 && errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK)
+            return -1;
+        if (nr > 0)
+            mx->inlen += nr;
+    }
+    return 0;
+}
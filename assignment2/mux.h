@@ -0,0 +1,129 @@
+/*
+ *  mux.h     - multiplexed sessions of the version 2 protocol
+ *              (see the end of netprotocol.h)
+ *              Shared by the client and the server: an output queue that
+ *              never blocks, a frame reader, and the data frames of the
+ *              transfers in flight sent in turn under flow control.
+ */
+
+#include <sys/types.h>             /* off_t */
+#include <stdint.h>                /* uint32_t */
+
+#define MUX_CHUNK (1024*64)        /* largest payload of a data frame */
+#define MUX_WINDOW (1024*1024)     /* credit of a transfer before the */
+                                   /* receiver grants more */
+#define MUX_MAX_STREAMS 32         /* transfers in flight on one connection */
+#define MUX_OUT_HIGH (MUX_CHUNK*4) /* stop producing data frames above */
+                                   /* this many queued bytes */
+#define MUX_NAME_MAX 1024          /* longest file name of a stream */
+
+struct v2_msg;
+
+struct mux_stream
+{
+    unsigned int id;               /* request id, 0 if the slot is free */
+    char op;                       /* GET_CODE1 or PUT_CODE1 */
+    char status;                   /* V2_OK until a read or write fails */
+    int fd;                        /* file sent or received, -1 drains */
+    int sending;                   /* data goes out from this side */
+    off_t size;                    /* bytes to send / announced size */
+    off_t done;                    /* bytes sent / received so far */
+    off_t credit;                  /* bytes the peer still takes */
+    off_t unacked;                 /* bytes received, not yet credited */
+    uint32_t crc;                  /* CRC-32C of the data sent / received */
+    char name[MUX_NAME_MAX];       /* file name, kept for the caller */
+};
+
+struct mux
+{
+    int sd;
+    char *in;                      /* partial input frames */
+    int inpos, inlen;
+    char *out;                     /* queued output frames */
+    int outpos, outlen, outcap;
+    int next;                      /* stream sending the next data frame */
+    long long bytes;               /* file data sent and received */
+    void (*sent)(struct mux *mx, struct mux_stream *st);
+                                   /* told of a GET stream whose data is */
+                                   /* all sent, before it ends, or NULL */
+    struct mux_stream st[MUX_MAX_STREAMS];
+};
+
+/*
+ * purpose:  start a mux session on the connection "sd". Frames buffered
+ *           by the stream layer are flushed first.
+ * post:     1) return value = 0  : session ready
+ *                           = -1 : out of memory or write error
+ */
+int mux_open(struct mux *mx, int sd);
+
+/*
+ * purpose:  write out the queued frames, waiting if need be, close the
+ *           files of the streams still open and free the buffers.
+ * post:     1) return value = 0  : every frame is sent
+ *                           = -1 : write error
+ */
+int mux_close(struct mux *mx);
+
+/*
+ * purpose:  take a free slot for the transfer "id" of file "fd". A sending
+ *           stream sends "size" bytes of fd from offset 0 under MUX_WINDOW
+ *           bytes of credit, a receiving one stores what arrives in fd.
+ * post:     1) return value = the stream, NULL if every slot is taken
+ */
+struct mux_stream *mux_add(struct mux *mx, unsigned int id, char op, int fd, off_t size, int sending);
+
+/*
+ * purpose:  find the stream of request "id".
+ * post:     1) return value = the stream, NULL if id is not in flight
+ */
+struct mux_stream *mux_find(struct mux *mx, unsigned int id);
+
+/*
+ * purpose:  close the file of "st" and free its slot.
+ */
+void mux_end(struct mux *mx, struct mux_stream *st);
+
+/*
+ * purpose:  queue "m" as one frame.
+ * pre:      1) m->len <= MUX_CHUNK
+ * post:     1) return value = 0  : frame queued
+ *                           = -1 : out of memory
+ */
+int mux_queue(struct mux *mx, struct v2_msg *m);
+
+/*
+ * purpose:  handle a V2_F_DATA or V2_F_CREDIT frame "m". Data is written
+ *           at its offset and credited back every MUX_WINDOW / 2 bytes; a
+ *           write error closes the file and sets the status to V2_ERROR
+ *           but the data is still taken. Data outside the announced size
+ *           sets V2_ERROR too and is taken without being written. A sum
+ *           in the end frame that differs from the sum of the data
+ *           received sets V2_MISMATCH. The file is cut at the trailer
+ *           size when the data ends. Unknown ids are ignored.
+ * post:     1) return value = the stream whose data just ended, which the
+ *                             caller answers and ends, or NULL
+ */
+struct mux_stream *mux_data(struct mux *mx, struct v2_msg *m);
+
+/*
+ * purpose:  take the next complete frame out of the input buffer.
+ *           m->data points into the buffer until the next mux_next()
+ *           or mux_io().
+ * post:     1) return value = 1  : m holds a frame
+ *                           = 0  : no complete frame, call mux_io()
+ *                           = -1 : protocol error
+ */
+int mux_next(struct mux *mx, struct v2_msg *m);
+
+/*
+ * purpose:  queue data frames of the sending streams in turn, each one
+ *           up to its credit, then wait until the connection can be
+ *           read or written, write what it takes and read what arrived.
+ *           The end frame of a stream carries the CRC-32C of its data.
+ *           A GET stream is ended once its data is sent, after mx->sent
+ *           is called, a PUT stream stays until the reply comes.
+ * post:     1) return value = 0  : progress made
+ *                           = -1 : connection closed or broken
+ */
+int mux_io(struct mux *mx);
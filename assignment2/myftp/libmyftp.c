@@ -0,0 +1,1196 @@
+/**
+ * file:        libmyftp.c
+ * Author:      Seow Wei Cheng (33753618) and Jin Min Seok (33884206)
+ * Date:        17/10/2026 (version 1)
+ * Purpose:     Commands of the ftp client over the version 2 protocol, built
+ *              into libmyftp.a, see libmyftp.h. The commands only talk to the
+ *              server and the local files, the programs print what came of them.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h> /* struct sockaddr_in, htons, htonl */
+#include <netdb.h>      /* struct hostent, gethostbyname() */
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/wait.h>
+#include <fnmatch.h> /* fnmatch() */
+#include <limits.h>  /* PATH_MAX */
+#include "../stream.h" /* MAX_BLOCK_SIZE, readn(), writen() */
+#include "../netprotocol.h"
+#include "../mux.h"
+#include "../crc32c.h"
+#include "../tree.h"
+#include "../compress.h"
+#include "../delta.h"
+#include "../listing.h"
+#include "libmyftp.h"
+
+int bulk_size = DEF_BULK_SIZE;
+int comp_codec = COMP_RAW;
+int verify_data = 0;
+//address of the server, connections of a parallel get go there too
+static struct sockaddr_in ser_addr;
+
+char *cli_strerror(int rc)
+{
+    switch (rc)
+    {
+    case CLI_OK: return "Done.";
+    case CLI_E_IO: return "Connection to server broken.";
+    case CLI_E_PROTO: return "Invalid reply from server.";
+    case CLI_E_NOT_FOUND: return "Error:file is not found on server.";
+    case CLI_E_CLASH: return "File already exist on server";
+    case CLI_E_SERVER: return "Server failed the command.";
+    case CLI_E_UNSUPPORTED: return "Server does not have the command.";
+    case CLI_E_DAMAGED: return "Data damaged on the way, checksum does not match.";
+    case CLI_E_LOCAL: return "Local file cannot be read or written.";
+    case CLI_E_CONNECT: return "Failed to connect to server.";
+    case CLI_E_HOST: return "Host not found.";
+    case CLI_E_NOMEM: return "Out of memory.";
+    default: return "Unknown error.";
+    }
+}
+
+//outcome of a reply of the V2_ status
+static int cli_outcome(char status)
+{
+    switch (status)
+    {
+    case V2_OK: return CLI_OK;
+    case V2_NOT_FOUND: return CLI_E_NOT_FOUND;
+    case V2_CLASH: return CLI_E_CLASH;
+    case V2_UNSUPPORTED: return CLI_E_UNSUPPORTED;
+    case V2_MISMATCH: return CLI_E_DAMAGED;
+    default: return CLI_E_SERVER;
+    }
+}
+
+//connect a new TCP socket to the server, returns it or -1
+static int cli_connect()
+{
+    int sd;
+
+    if ((sd = socket(PF_INET, SOCK_STREAM, 0)) < 0)
+    {
+        return -1;
+    }
+    if (connect(sd, (struct sockaddr *)&ser_addr, sizeof(ser_addr)) < 0)
+    {
+        close(sd);
+        return -1;
+    }
+    return sd;
+}
+
+int cli_open(char *host, unsigned short port)
+{
+    struct hostent *hp;
+    int sd;
+
+    /* get host address, & build a server socket address */
+    bzero((char *)&ser_addr, sizeof(ser_addr));
+    ser_addr.sin_family = AF_INET;
+    ser_addr.sin_port = htons(port);
+    if ((hp = gethostbyname(host)) == NULL)
+    {
+        return CLI_E_HOST;
+    }
+    ser_addr.sin_addr.s_addr = *(u_long *)hp->h_addr;
+
+    /* create TCP socket & connect socket to server address */
+    if ((sd = cli_connect()) < 0)
+    {
+        return CLI_E_CONNECT;
+    }
+    //requests and replies go through the stream buffers
+    stream_open(sd);
+    stream_readback(sd, verify_data);
+    //file data moves in large frames from now on
+    bulk_size = DEF_BULK_SIZE;
+    comp_codec = COMP_RAW;
+    cli_blk(sd, DEF_BULK_SIZE);
+    return sd;
+}
+
+void cli_close(int sd)
+{
+    stream_close(sd);
+    close(sd);
+}
+
+//send a v2 request and read its reply into buf (MAX_BLOCK_SIZE bytes)
+static int cli_request(int sd, struct v2_msg *req, struct v2_msg *rep, char *buf)
+{
+    if (v2_send(sd, req) < 0 || v2_recv(sd, rep, buf) < 0)
+    {
+        return CLI_E_IO;
+    }
+    if (rep->op != req->op)
+    {
+        return CLI_E_PROTO;
+    }
+    return CLI_OK;
+}
+
+//fill in a request for op with name as its payload, a transfer asks for
+//the sum of its data while verify_data is on
+static void cli_msg(struct v2_msg *m, char op, char *name)
+{
+    m->op = op;
+    m->status = V2_OK;
+    m->flags = 0;
+    if (verify_data && (op == GET_CODE1 || op == PUT_CODE1 || op == RANGE_CODE ||
+                        op == TREE_GET_CODE || op == TREE_PUT_CODE))
+    {
+        m->flags = V2_F_SUM;
+    }
+    m->size = 0;
+    m->offset = 0;
+    m->id = 0;
+    m->data = name;
+    m->len = (name == NULL) ? 0 : strlen(name);
+}
+
+int cli_cd(int sd, char *path)
+{
+    char buf[MAX_BLOCK_SIZE];
+    struct v2_msg req, rep;
+    int rc;
+
+    cli_msg(&req, CD_CODE, path);
+    if ((rc = cli_request(sd, &req, &rep, buf)) < 0)
+    {
+        return rc;
+    }
+    return cli_outcome(rep.status);
+}
+
+int cli_blk(int sd, int size)
+{
+    char buf[MAX_BLOCK_SIZE];
+    struct v2_msg req, rep;
+    int rc;
+
+    cli_msg(&req, BLK_CODE, NULL);
+    req.size = size;
+    if ((rc = cli_request(sd, &req, &rep, buf)) < 0)
+    {
+        return rc;
+    }
+    if (rep.status != V2_OK)
+    {
+        return cli_outcome(rep.status);
+    }
+    bulk_size = rep.size;
+    return CLI_OK;
+}
+
+void cli_verify(int sd, int on)
+{
+    verify_data = on;
+    stream_readback(sd, on);
+}
+
+int cli_comp(int sd, int on)
+{
+    char buf[MAX_BLOCK_SIZE];
+    struct v2_msg req, rep;
+    int rc;
+
+    cli_msg(&req, COMP_CODE, NULL);
+    req.size = on ? comp_codecs() : 0;
+    if ((rc = cli_request(sd, &req, &rep, buf)) < 0)
+    {
+        return rc;
+    }
+    if (rep.status != V2_OK || rep.size < COMP_RAW || rep.size > COMP_LZ)
+    {
+        comp_codec = COMP_RAW;
+        return (rep.status == V2_OK) ? CLI_E_PROTO : cli_outcome(rep.status);
+    }
+    comp_codec = rep.size;
+    return CLI_OK;
+}
+
+int cli_sum(int sd, char *filename, long long *size, uint32_t *crc)
+{
+    char buf[MAX_BLOCK_SIZE];
+    struct v2_msg req, rep;
+    int rc;
+
+    cli_msg(&req, SUM_CODE, filename);
+    if ((rc = cli_request(sd, &req, &rep, buf)) < 0)
+    {
+        return rc;
+    }
+    if (rep.status != V2_OK)
+    {
+        return cli_outcome(rep.status);
+    }
+    *size = rep.size;
+    *crc = (uint32_t)rep.offset;
+    return CLI_OK;
+}
+
+int cli_stat(int sd, cli_text_fn fn, void *arg)
+{
+    char buf[MAX_BLOCK_SIZE];
+    struct v2_msg req, rep;
+    int rc;
+
+    cli_msg(&req, STAT_CODE, NULL);
+    if ((rc = cli_request(sd, &req, &rep, buf)) < 0)
+    {
+        return rc;
+    }
+    if (rep.status != V2_OK)
+    {
+        return cli_outcome(rep.status);
+    }
+    //the text comes in frames that may cut a line in two
+    while (1)
+    {
+        if (v2_recv(sd, &rep, buf) < 0)
+        {
+            return CLI_E_IO;
+        }
+        if (rep.op != STAT_CODE)
+        {
+            return CLI_E_PROTO;
+        }
+        if (rep.flags & V2_F_END)
+        {
+            return CLI_OK;
+        }
+        fn(rep.data, rep.len, arg);
+    }
+}
+
+int cli_pwd(int sd, char *path, int size)
+{
+    char buf[MAX_BLOCK_SIZE];
+    struct v2_msg req, rep;
+    int rc;
+
+    cli_msg(&req, PWD_CODE, NULL);
+    if ((rc = cli_request(sd, &req, &rep, buf)) < 0)
+    {
+        return rc;
+    }
+    if (rep.status != V2_OK)
+    {
+        return cli_outcome(rep.status);
+    }
+    if (rep.len >= size)
+    {
+        return CLI_E_NOMEM;
+    }
+    memcpy(path, rep.data, rep.len);
+    path[rep.len] = '\0';
+    return CLI_OK;
+}
+
+int cli_names(int sd, char *names, int size)
+{
+    char buf[MAX_BLOCK_SIZE];
+    struct v2_msg req, rep;
+    int rc;
+
+    cli_msg(&req, DIR_CODE, NULL);
+    if ((rc = cli_request(sd, &req, &rep, buf)) < 0)
+    {
+        return rc;
+    }
+    if (rep.status != V2_OK)
+    {
+        return cli_outcome(rep.status);
+    }
+    if (rep.len > size)
+    {
+        rep.len = size;
+    }
+    memcpy(names, rep.data, rep.len);
+    return rep.len;
+}
+
+int cli_dir(int sd, long long count, long long cursor, cli_entry_fn fn, void *arg, long long *total, long long *next)
+{
+    char buf[MAX_BLOCK_SIZE];
+    struct v2_msg req, rep;
+    struct list_entry e;
+    int pos, ret, rc;
+
+    cli_msg(&req, LIST_CODE, NULL);
+    req.size = count;
+    req.offset = cursor;
+    if ((rc = cli_request(sd, &req, &rep, buf)) < 0)
+    {
+        return rc;
+    }
+    if (rep.status != V2_OK)
+    {
+        return cli_outcome(rep.status);
+    }
+    //entries go to fn a frame at a time as they come
+    while (1)
+    {
+        if (v2_recv(sd, &rep, buf) < 0)
+        {
+            return CLI_E_IO;
+        }
+        if (rep.op != LIST_CODE)
+        {
+            return CLI_E_PROTO;
+        }
+        if (rep.flags & V2_F_END)
+        {
+            break;
+        }
+        pos = 0;
+        while ((ret = list_next(rep.data, rep.len, &pos, &e)) > 0)
+        {
+            fn(&e, arg);
+        }
+        if (ret < 0)
+        {
+            return CLI_E_PROTO;
+        }
+    }
+    *total = rep.size;
+    *next = rep.offset;
+    return CLI_OK;
+}
+
+int cli_get(int sd, char *filename, int resume, struct cli_xfer *x)
+{
+    char buf[MAX_BLOCK_SIZE];
+    struct v2_msg req, rep, trailer;
+    struct stat fst;
+    uint32_t crc;
+    off_t nr;
+    int fd, rc;
+
+    memset(x, 0, sizeof(*x));
+    cli_msg(&req, GET_CODE1, filename);
+    fd = -1;
+    //resume after the bytes already here, if they are a prefix of the file
+    if (resume && (fd = open(filename, O_RDWR)) >= 0 && fstat(fd, &fst) == 0 && fst.st_size > 0)
+    {
+        if (crc32c_file(fd, 0, fst.st_size, &crc) < 0)
+        {
+            close(fd);
+            return CLI_E_LOCAL;
+        }
+        req.offset = fst.st_size;
+        req.flags |= V2_F_CHECK;
+        req.size = crc;
+    }
+    //the server packs the data if it agreed on a codec
+    if (comp_codec != COMP_RAW)
+    {
+        req.flags |= V2_F_PACKED;
+    }
+    if ((rc = cli_request(sd, &req, &rep, buf)) < 0)
+    {
+        if (fd != -1)
+            close(fd);
+        return rc;
+    }
+    if (rep.status == V2_MISMATCH)
+    {
+        //never extend a partial file that is not a prefix
+        close(fd);
+        rc = cli_get(sd, filename, 0, x);
+        x->notes |= CLI_X_RESTARTED;
+        return rc;
+    }
+    if (rep.status != V2_OK)
+    {
+        if (fd != -1)
+            close(fd);
+        return cli_outcome(rep.status);
+    }
+    x->size = rep.size;
+    x->offset = req.offset;
+    if (req.offset == 0)
+    {
+        //create file, a failed open still drains the data
+        if (fd != -1)
+            close(fd);
+        fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0666);
+    }
+    //read the bulk frames straight into the file, then the trailer
+    if (rep.flags & V2_F_PACKED)
+        nr = recvpackedfile(sd, fd, req.offset, bulk_size);
+    else
+        nr = recvbulkfile(sd, fd, req.offset, bulk_size);
+    if (nr == -1 || v2_recv(sd, &trailer, buf) < 0 || trailer.op != GET_CODE1)
+    {
+        if (fd != -1)
+            close(fd);
+        return CLI_E_IO;
+    }
+    //a frame too large was passed over, what came of the file is dropped
+    if (nr == -3)
+    {
+        rc = (fd == -1 || ftruncate(fd, req.offset) == 0) ? CLI_E_PROTO : CLI_E_LOCAL;
+        if (fd != -1)
+            close(fd);
+        return rc;
+    }
+    if (nr == -2 || fd == -1)
+    {
+        if (fd != -1)
+            close(fd);
+        return CLI_E_LOCAL;
+    }
+    //bytes that did not land as they left are dropped, get -c can go on
+    //from the part that was there before
+    if (v2_check(sd, &trailer, nr, &crc) < 0)
+    {
+        rc = (ftruncate(fd, req.offset) < 0) ? CLI_E_LOCAL : CLI_E_DAMAGED;
+        close(fd);
+        return rc;
+    }
+    //the file shrank on the server, cut off the padding
+    if (trailer.size < nr && ftruncate(fd, req.offset + trailer.size) < 0)
+    {
+        close(fd);
+        return CLI_E_LOCAL;
+    }
+    close(fd);
+    x->bytes = trailer.size;
+    if (req.offset + trailer.size != rep.size)
+    {
+        x->notes |= CLI_X_CHANGED;
+    }
+    return CLI_OK;
+}
+
+int cli_put(int sd, char *filename, int resume, struct cli_xfer *x)
+{
+    char buf[MAX_BLOCK_SIZE];
+    struct v2_msg req, rep;
+    struct stat fst;
+    off_t nr, start = 0;
+    int fd, rc;
+
+    memset(x, 0, sizeof(*x));
+    if ((fd = open(filename, O_RDONLY)) < 0 || fstat(fd, &fst) < 0)
+    {
+        if (fd >= 0)
+            close(fd);
+        return CLI_E_LOCAL;
+    }
+    x->size = fst.st_size;
+    cli_msg(&req, PUT_CODE1, filename);
+    req.size = fst.st_size;
+    if (comp_codec != COMP_RAW)
+    {
+        req.flags |= V2_F_PACKED;
+    }
+    //a resumed upload first asks the server how much it already holds
+    if (resume)
+    {
+        req.flags |= V2_F_RESUME;
+        if ((rc = cli_request(sd, &req, &rep, buf)) < 0)
+        {
+            close(fd);
+            return rc;
+        }
+        if (rep.status != V2_OK || rep.offset < 0 || rep.offset > fst.st_size)
+        {
+            close(fd);
+            return (rep.status == V2_OK) ? CLI_E_PROTO : cli_outcome(rep.status);
+        }
+        start = rep.offset;
+        x->offset = start;
+    }
+    //otherwise the file follows the request without waiting for the server
+    if (!resume && v2_send(sd, &req) < 0)
+        nr = -1;
+    else if (req.flags & V2_F_PACKED)
+        nr = sendpackedfile(sd, fd, start, fst.st_size - start, bulk_size, comp_codec);
+    else
+        nr = sendbulkfile(sd, fd, start, fst.st_size - start, bulk_size);
+    close(fd);
+    if (nr < 0 || v2_trailer(sd, PUT_CODE1, nr) < 0 || v2_recv(sd, &rep, buf) < 0)
+    {
+        return CLI_E_IO;
+    }
+    if (rep.op != PUT_CODE1)
+    {
+        return CLI_E_PROTO;
+    }
+    if (rep.status != V2_OK)
+    {
+        return cli_outcome(rep.status);
+    }
+    x->bytes = nr;
+    if (start + nr < fst.st_size)
+    {
+        x->notes |= CLI_X_CHANGED;
+    }
+    return CLI_OK;
+}
+
+int cli_delta(int sd, char *filename, struct cli_xfer *x)
+{
+    char buf[MAX_BLOCK_SIZE];
+    struct delta_stats ds;
+    struct v2_msg req, rep;
+    struct stat fst;
+    int fd, rc, whole = 0;
+
+    memset(x, 0, sizeof(*x));
+    if ((fd = open(filename, O_RDONLY)) < 0 || fstat(fd, &fst) < 0)
+    {
+        if (fd >= 0)
+            close(fd);
+        return CLI_E_LOCAL;
+    }
+    //a second round sends every byte if the rebuilt file did not match
+    while (1)
+    {
+        cli_msg(&req, DELTA_CODE, filename);
+        req.size = fst.st_size;
+        if ((rc = cli_request(sd, &req, &rep, buf)) < 0)
+        {
+            close(fd);
+            return rc;
+        }
+        if (rep.status == V2_NOT_FOUND || rep.status == V2_UNSUPPORTED)
+        {
+            close(fd);
+            rc = cli_put(sd, filename, 0, x);
+            x->notes |= (rep.status == V2_NOT_FOUND) ? CLI_X_NO_COPY : CLI_X_NO_DELTA;
+            return rc;
+        }
+        if (rep.status != V2_OK)
+        {
+            close(fd);
+            return cli_outcome(rep.status);
+        }
+        if (delta_send(sd, DELTA_CODE, fd, fst.st_size, rep.size, rep.offset, whole, bulk_size, &ds) < 0 ||
+            v2_recv(sd, &rep, buf) < 0)
+        {
+            close(fd);
+            return CLI_E_IO;
+        }
+        if (rep.op != DELTA_CODE)
+        {
+            close(fd);
+            return CLI_E_PROTO;
+        }
+        if (rep.status != V2_MISMATCH || whole)
+            break;
+        x->notes |= CLI_X_RESENT;
+        whole = 1;
+    }
+    close(fd);
+    if (rep.status != V2_OK)
+    {
+        return cli_outcome(rep.status);
+    }
+    x->size = fst.st_size;
+    x->bytes = ds.literal;
+    x->saved = ds.copied;
+    return CLI_OK;
+}
+
+//a transfer of cli_mux() is over, tell fn how it went
+static void cli_mux_done(struct mux *mx, struct mux_stream *st, char *name, cli_file_fn fn, void *arg, int rc,
+                         int *first, int *nfiles, long long *nbytes)
+{
+    struct cli_xfer x;
+
+    memset(&x, 0, sizeof(x));
+    x.size = st->size;
+    if (rc == CLI_OK)
+    {
+        x.bytes = st->done;
+        (*nfiles)++;
+        *nbytes += st->done;
+    }
+    else if (*first == CLI_OK)
+    {
+        *first = rc;
+    }
+    fn(name, rc, &x, arg);
+    mux_end(mx, st);
+}
+
+int cli_mux(int sd, char op, char **names, int n, cli_file_fn fn, void *arg, int *nfiles, long long *nbytes)
+{
+    char buf[MAX_BLOCK_SIZE];
+    struct v2_msg req, rep, m;
+    struct mux mx;
+    struct mux_stream *st;
+    struct stat fst;
+    struct cli_xfer x;
+    int next = 0, active = 0, leaving = 0, ended = 0, nr = 0, fd, rc, first = CLI_OK;
+
+    *nfiles = 0;
+    *nbytes = 0;
+    cli_msg(&req, MUX_CODE, NULL);
+    if ((rc = cli_request(sd, &req, &rep, buf)) < 0)
+    {
+        return rc;
+    }
+    if (rep.status != V2_OK)
+    {
+        return CLI_E_UNSUPPORTED; //the files go one by one
+    }
+    if (mux_open(&mx, sd) < 0)
+    {
+        return CLI_E_NOMEM;
+    }
+    while (!ended)
+    {
+        while ((nr = mux_next(&mx, &m)) > 0)
+        {
+            if (m.flags & (V2_F_DATA | V2_F_CREDIT))
+            {
+                if ((st = mux_data(&mx, &m)) != NULL)
+                {
+                    rc = (st->status == V2_OK) ? CLI_OK : (st->fd < 0 ? CLI_E_LOCAL : cli_outcome(st->status));
+                    //bytes that did not land as they left are dropped
+                    if (st->status == V2_MISMATCH && ftruncate(st->fd, 0) < 0)
+                        rc = CLI_E_LOCAL;
+                    cli_mux_done(&mx, st, names[st->id - 1], fn, arg, rc, &first, nfiles, nbytes);
+                    active--;
+                }
+                continue;
+            }
+            if (m.op == MUX_CODE)
+            {
+                ended = 1;
+                break;
+            }
+            if ((st = mux_find(&mx, m.id)) == NULL)
+            {
+                continue;
+            }
+            if (m.op == GET_CODE1 && m.status == V2_OK)
+            {
+                st->size = m.size;
+                if ((st->fd = open(names[m.id - 1], O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0)
+                    st->status = V2_ERROR; //the data is still drained
+                continue;
+            }
+            //a GET refused or a PUT answered, a PUT still sending stops here
+            st->status = m.status;
+            st->done = m.size;
+            cli_mux_done(&mx, st, names[m.id - 1], fn, arg, cli_outcome(m.status), &first, nfiles, nbytes);
+            active--;
+        }
+        if (ended)
+        {
+            break;
+        }
+        //every request goes out as soon as a stream is free
+        while (next < n && active < MUX_MAX_STREAMS)
+        {
+            cli_msg(&m, op, names[next]);
+            m.id = next + 1;
+            if (op == PUT_CODE1)
+            {
+                if ((fd = open(names[next], O_RDONLY)) < 0 || fstat(fd, &fst) < 0)
+                {
+                    if (fd >= 0)
+                        close(fd);
+                    memset(&x, 0, sizeof(x));
+                    fn(names[next], CLI_E_LOCAL, &x, arg);
+                    if (first == CLI_OK)
+                        first = CLI_E_LOCAL;
+                    next++;
+                    continue;
+                }
+                m.size = fst.st_size;
+                mux_queue(&mx, &m);
+                mux_add(&mx, m.id, PUT_CODE1, fd, fst.st_size, 1);
+            }
+            else
+            {
+                //the file is created once the server has it
+                mux_queue(&mx, &m);
+                mux_add(&mx, m.id, GET_CODE1, -1, 0, 0);
+            }
+            next++;
+            active++;
+        }
+        if (next == n && active == 0 && !leaving)
+        {
+            cli_msg(&m, MUX_CODE, NULL);
+            m.id = n + 1;
+            mux_queue(&mx, &m);
+            leaving = 1;
+        }
+        if (nr < 0 || mux_io(&mx) < 0)
+        {
+            first = CLI_E_IO;
+            break;
+        }
+    }
+    mux_close(&mx);
+    return first;
+}
+
+int cli_mxfer(int sd, char op, char **names, int n, cli_file_fn fn, void *arg, int *nfiles, long long *nbytes)
+{
+    struct cli_xfer x;
+    int i, rc, first = CLI_OK;
+
+    if ((rc = cli_mux(sd, op, names, n, fn, arg, nfiles, nbytes)) != CLI_E_UNSUPPORTED)
+    {
+        return rc;
+    }
+    //a server without mux sessions takes the files one by one
+    for (i = 0; i < n; i++)
+    {
+        rc = (op == GET_CODE1) ? cli_get(sd, names[i], 0, &x) : cli_put(sd, names[i], 0, &x);
+        x.notes |= CLI_X_ONE_BY_ONE;
+        fn(names[i], rc, &x, arg);
+        if (rc == CLI_OK)
+        {
+            (*nfiles)++;
+            *nbytes += x.bytes;
+        }
+        else if (first == CLI_OK)
+        {
+            first = rc;
+        }
+    }
+    return first;
+}
+
+//add a copy of name to the growing list names of n names unless it is
+//there already, returns 0 or -1
+static int cli_addname(char ***names, int *n, char *name, int len)
+{
+    char **p;
+    int i;
+
+    //a file matched by several patterns moves once
+    for (i = 0; i < *n; i++)
+    {
+        if (strncmp((*names)[i], name, len) == 0 && (*names)[i][len] == '\0')
+            return 0;
+    }
+    if ((*n & (*n - 1)) == 0)
+    {
+        //grow by doubling whenever n is a power of two
+        if ((p = realloc(*names, (*n == 0 ? 1 : *n * 2) * sizeof(char *))) == NULL)
+            return -1;
+        *names = p;
+    }
+    if (((*names)[*n] = strndup(name, len)) == NULL)
+        return -1;
+    (*n)++;
+    return 0;
+}
+
+int cli_match(int sd, char *pattern, char ***names, int *n)
+{
+    char buf[MAX_BLOCK_SIZE];
+    struct v2_msg req, rep;
+    char *p, *end;
+    int got = 0, rc;
+
+    //the names come a reply at a time until all matches are in
+    do
+    {
+        cli_msg(&req, MATCH_CODE, pattern);
+        req.offset = got;
+        if ((rc = cli_request(sd, &req, &rep, buf)) < 0)
+        {
+            return rc;
+        }
+        if (rep.status != V2_OK)
+        {
+            return cli_outcome(rep.status);
+        }
+        for (p = rep.data; p < rep.data + rep.len; p = end + 1)
+        {
+            if ((end = memchr(p, '\n', rep.data + rep.len - p)) == NULL)
+                break;
+            if (cli_addname(names, n, p, end - p) < 0)
+            {
+                return CLI_E_NOMEM;
+            }
+            got++;
+        }
+    } while (got < rep.size && rep.len > 0);
+    return CLI_OK;
+}
+
+int cli_lmatch(char *pattern, char ***names, int *n)
+{
+    struct dirent **list;
+    struct stat fst;
+    int i, count, ret = CLI_OK;
+
+    if ((count = scandir(".", &list, NULL, alphasort)) < 0)
+    {
+        return CLI_E_LOCAL;
+    }
+    for (i = 0; i < count; i++)
+    {
+        if (ret == CLI_OK && fnmatch(pattern, list[i]->d_name, FNM_PERIOD) == 0 && stat(list[i]->d_name, &fst) == 0 &&
+            S_ISREG(fst.st_mode) && cli_addname(names, n, list[i]->d_name, strlen(list[i]->d_name)) < 0)
+        {
+            ret = CLI_E_NOMEM;
+        }
+        free(list[i]);
+    }
+    free(list);
+    return ret;
+}
+
+//ask for count bytes of filename from offset and store them in place in fd
+//fsize, if not NULL, gets the size of the whole file
+//returns the number of bytes received, or a CLI_E_ code
+static off_t cli_range(int sd, char *filename, int fd, off_t offset, off_t count, off_t *fsize)
+{
+    char buf[MAX_BLOCK_SIZE];
+    struct v2_msg req, rep, trailer;
+    uint32_t crc;
+    off_t nr;
+    int rc;
+
+    cli_msg(&req, RANGE_CODE, filename);
+    req.offset = offset;
+    req.size = count;
+    if ((rc = cli_request(sd, &req, &rep, buf)) < 0)
+    {
+        return rc;
+    }
+    if (rep.status != V2_OK)
+    {
+        return cli_outcome(rep.status);
+    }
+    if (fsize != NULL)
+    {
+        *fsize = rep.size;
+    }
+    nr = recvbulkfile(sd, fd, offset, bulk_size);
+    if (nr == -1 || v2_recv(sd, &trailer, buf) < 0 || trailer.op != RANGE_CODE)
+    {
+        return CLI_E_IO;
+    }
+    if (nr == -3)
+    {
+        return CLI_E_PROTO;
+    }
+    if (nr == -2)
+    {
+        return CLI_E_LOCAL;
+    }
+    if (v2_check(sd, &trailer, nr, &crc) < 0)
+    {
+        return CLI_E_DAMAGED;
+    }
+    return trailer.size;
+}
+
+//fetch one slice over a connection of its own, returns 0 or -1
+static int cli_slice(char *serverpath, char *filename, int fd, off_t offset, off_t count)
+{
+    char buf[MAX_BLOCK_SIZE];
+    struct v2_msg req, rep;
+    off_t nr = -1;
+    int sd;
+
+    if ((sd = cli_connect()) < 0)
+    {
+        return -1;
+    }
+    stream_open(sd);
+    stream_readback(sd, verify_data);
+    cli_blk(sd, bulk_size);
+    //new connections start in the directory the server was started in
+    cli_msg(&req, CD_CODE, serverpath);
+    if (cli_request(sd, &req, &rep, buf) == CLI_OK && rep.status == V2_OK)
+    {
+        nr = cli_range(sd, filename, fd, offset, count, NULL);
+    }
+    cli_close(sd);
+    return (nr == count) ? 0 : -1;
+}
+
+//length of the slice that starts at start
+static off_t cli_slice_len(off_t fsize, off_t start, off_t slice)
+{
+    return (fsize - start < slice) ? fsize - start : slice;
+}
+
+int cli_pget(int sd, char *filename, int nconn, struct cli_xfer *x)
+{
+    char serverpath[MAX_BLOCK_SIZE];
+    pid_t pids[PGET_MAX_CONNS];
+    off_t starts[PGET_MAX_CONNS];
+    off_t fsize, slice, start, nr;
+    int fd, i, status, rc, nslices = 0;
+
+    memset(x, 0, sizeof(*x));
+    if (nconn > PGET_MAX_CONNS)
+    {
+        nconn = PGET_MAX_CONNS;
+    }
+    if ((rc = cli_pwd(sd, serverpath, sizeof(serverpath))) < 0)
+    {
+        return rc;
+    }
+    //an empty range only asks for the size
+    if ((nr = cli_range(sd, filename, -1, 0, 0, &fsize)) < 0)
+    {
+        return nr;
+    }
+    x->size = fsize;
+    if ((fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0666)) < 0 || ftruncate(fd, fsize) < 0)
+    {
+        if (fd >= 0)
+            close(fd);
+        return CLI_E_LOCAL;
+    }
+    //slices are at least one bulk frame, small files use fewer connections
+    slice = (fsize + nconn - 1) / nconn;
+    if (slice < bulk_size)
+    {
+        slice = bulk_size;
+    }
+    //every slice but the first is fetched by a child over its own connection
+    fflush(stdout);
+    for (start = slice; start < fsize; start += slice)
+    {
+        starts[nslices] = start;
+        if ((pids[nslices] = fork()) == 0)
+        {
+            exit(cli_slice(serverpath, filename, fd, start, cli_slice_len(fsize, start, slice)) < 0);
+        }
+        nslices++;
+    }
+    rc = CLI_OK;
+    if ((nr = cli_range(sd, filename, fd, 0, cli_slice_len(fsize, 0, slice), NULL)) != cli_slice_len(fsize, 0, slice))
+    {
+        rc = (nr < 0) ? nr : CLI_E_IO;
+    }
+    for (i = 0; i < nslices; i++)
+    {
+        start = starts[i];
+        if (pids[i] > 0 && waitpid(pids[i], &status, 0) == pids[i] && WIFEXITED(status) && WEXITSTATUS(status) == 0)
+        {
+            continue;
+        }
+        //a slice whose child failed or could not start is fetched here
+        nr = cli_range(sd, filename, fd, start, cli_slice_len(fsize, start, slice), NULL);
+        if (nr != cli_slice_len(fsize, start, slice) && rc == CLI_OK)
+        {
+            rc = (nr < 0) ? nr : CLI_E_IO;
+        }
+    }
+    close(fd);
+    x->conns = nslices + 1;
+    if (rc == CLI_OK)
+    {
+        x->bytes = fsize;
+    }
+    return rc;
+}
+
+//entries of a server directory that cli_rwalk() visits
+struct cli_walk
+{
+    char **names;
+    char *dirs; //1 for a directory, 0 for a regular file
+    int n;
+    int nomem;
+};
+
+//keep the directories and regular files of a listing, arg is a cli_walk
+static void cli_walk_entry(struct list_entry *e, void *arg)
+{
+    struct cli_walk *w = arg;
+    char **names;
+    char *dirs;
+
+    if (w->nomem || !(S_ISDIR(e->mode) || S_ISREG(e->mode)))
+    {
+        return;
+    }
+    //grow by doubling whenever n is a power of two
+    if ((w->n & (w->n - 1)) == 0)
+    {
+        names = realloc(w->names, (w->n == 0 ? 1 : w->n * 2) * sizeof(char *));
+        if (names != NULL)
+            w->names = names;
+        dirs = realloc(w->dirs, w->n == 0 ? 1 : w->n * 2);
+        if (dirs != NULL)
+            w->dirs = dirs;
+        if (names == NULL || dirs == NULL)
+        {
+            w->nomem = 1;
+            return;
+        }
+    }
+    if ((w->names[w->n] = strndup(e->name, e->namelen)) == NULL)
+    {
+        w->nomem = 1;
+        return;
+    }
+    w->dirs[w->n++] = S_ISDIR(e->mode) != 0;
+}
+
+//rget of a server without tree transfers: the server directory dirname
+//goes into the local directory local a file at a time with LIST, CD and
+//GET, then each directory below it in turn. Both sides end up where they
+//started. Returns CLI_OK, or the outcome that broke off the walk
+static int cli_rwalk(int sd, char *dirname, char *local, struct tree_stats *ts)
+{
+    char back[PATH_MAX];
+    struct cli_walk w;
+    struct cli_xfer x;
+    long long total, next;
+    int i, rc;
+
+    memset(&w, 0, sizeof(w));
+    if ((rc = cli_pwd(sd, back, sizeof(back))) != CLI_OK)
+    {
+        return rc;
+    }
+    if ((rc = cli_cd(sd, dirname)) != CLI_OK)
+    {
+        return (rc == CLI_E_SERVER) ? CLI_E_NOT_FOUND : rc;
+    }
+    if ((mkdir(local, 0777) < 0 && errno != EEXIST) || chdir(local) < 0)
+    {
+        ts->failed++;
+        return (cli_cd(sd, back) == CLI_OK) ? CLI_OK : CLI_E_IO;
+    }
+    ts->dirs++;
+    rc = cli_dir(sd, 0, 0, cli_walk_entry, &w, &total, &next);
+    if (rc == CLI_OK && w.nomem)
+    {
+        rc = CLI_E_NOMEM;
+    }
+    for (i = 0; i < w.n; i++)
+    {
+        if (rc == CLI_OK && w.dirs[i])
+        {
+            if ((rc = cli_rwalk(sd, w.names[i], w.names[i], ts)) == CLI_E_NOT_FOUND)
+                ts->failed++;
+        }
+        else if (rc == CLI_OK)
+        {
+            rc = cli_get(sd, w.names[i], 0, &x);
+            if (rc == CLI_OK)
+            {
+                ts->files++;
+                ts->bytes += x.bytes;
+            }
+            else
+            {
+                ts->failed++;
+            }
+        }
+        //an entry that failed does not end the walk, a broken connection does
+        if (rc != CLI_E_IO && rc != CLI_E_PROTO && rc != CLI_E_NOMEM)
+        {
+            rc = CLI_OK;
+        }
+        free(w.names[i]);
+    }
+    free(w.names);
+    free(w.dirs);
+    if (chdir("..") < 0 && rc == CLI_OK)
+    {
+        rc = CLI_E_LOCAL;
+    }
+    if (cli_cd(sd, back) != CLI_OK && rc == CLI_OK)
+    {
+        rc = CLI_E_IO;
+    }
+    return rc;
+}
+
+int cli_rget(int sd, char *dirname, struct tree_stats *ts, int *notes)
+{
+    char buf[MAX_BLOCK_SIZE], local[PATH_MAX];
+    char *p;
+    int len;
+    struct v2_msg req, rep;
+    int rc;
+
+    memset(ts, 0, sizeof(*ts));
+    *notes = 0;
+    cli_msg(&req, TREE_GET_CODE, dirname);
+    if ((rc = cli_request(sd, &req, &rep, buf)) < 0)
+    {
+        return rc;
+    }
+    //the tree is named after the last component of dirname, as tree_root() does
+    if (rep.status == V2_UNSUPPORTED)
+    {
+        *notes = CLI_X_ONE_BY_ONE;
+        snprintf(local, sizeof(local), "%s", dirname);
+        for (len = strlen(local); len > 1 && local[len - 1] == '/'; len--)
+        {
+            local[len - 1] = '\0';
+        }
+        p = (strrchr(local, '/') != NULL) ? strrchr(local, '/') + 1 : local;
+        if (p[0] == '\0' || strcmp(p, ".") == 0 || strcmp(p, "..") == 0)
+        {
+            return CLI_E_LOCAL;
+        }
+        return cli_rwalk(sd, dirname, p, ts);
+    }
+    if (rep.status != V2_OK)
+    {
+        return cli_outcome(rep.status);
+    }
+    //the whole tree follows the reply, merged into what is here
+    if (tree_recv(sd, TREE_GET_CODE, NULL, 0, 0777, bulk_size, ts) < 0)
+    {
+        return CLI_E_IO;
+    }
+    return CLI_OK;
+}
+
+int cli_rput(int sd, char *dirname, struct tree_stats *ts, long long *stored)
+{
+    char buf[MAX_BLOCK_SIZE], root[PATH_MAX];
+    struct v2_msg req, rep;
+    int rc;
+
+    memset(ts, 0, sizeof(*ts));
+    if (tree_root(dirname, root) < 0)
+    {
+        return CLI_E_LOCAL;
+    }
+    //the server says whether the tree may come before it is sent
+    cli_msg(&req, TREE_PUT_CODE, root);
+    if ((rc = cli_request(sd, &req, &rep, buf)) < 0)
+    {
+        return rc;
+    }
+    if (rep.status != V2_OK)
+    {
+        return cli_outcome(rep.status);
+    }
+    if (tree_send(sd, TREE_PUT_CODE, dirname, bulk_size, ts) < 0 || v2_recv(sd, &rep, buf) < 0)
+    {
+        return CLI_E_IO;
+    }
+    if (rep.op != TREE_PUT_CODE)
+    {
+        return CLI_E_PROTO;
+    }
+    *stored = rep.size;
+    return cli_outcome(rep.status);
+}
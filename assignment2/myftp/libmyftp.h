@@ -0,0 +1,126 @@
+/**
+ * file:        libmyftp.h
+ * Author:      Seow Wei Cheng (33753618) and Jin Min Seok (33884206)
+ * Date:        17/10/2026 (version 2)
+ * Purpose:     Commands of the ftp client, built into libmyftp.a and used by
+ *              - myftp.c      the interactive and batch client
+ *              - myftpbench.c the load generator
+ *              Nothing is printed: every command returns CLI_OK or one of the
+ *              CLI_E_ codes below, what it got goes to its arguments or to a
+ *              callback. The connection state (bulk frame size, codec, address
+ *              of the server) belongs to the process, as the streams of stream.c do.
+ */
+#include <stdint.h>    /* uint32_t */
+#include <sys/types.h> /* off_t */
+
+struct list_entry; //listing.h
+struct tree_stats; //tree.h
+
+#define SERV_TCP_PORT 41314
+#define PGET_MAX_CONNS 16 //most connections of a parallel get
+
+//outcomes of the commands, see cli_strerror()
+#define CLI_OK 0
+#define CLI_E_IO -1          //request not written or reply not read
+#define CLI_E_PROTO -2       //reply out of order or invalid
+#define CLI_E_NOT_FOUND -3   //file or directory is not on the server
+#define CLI_E_CLASH -4       //file or directory already exists on the server
+#define CLI_E_SERVER -5      //the server failed the command
+#define CLI_E_UNSUPPORTED -6 //the server does not have the command
+#define CLI_E_DAMAGED -7     //checksum of the data does not match
+#define CLI_E_LOCAL -8       //local file or directory cannot be read or written
+#define CLI_E_CONNECT -9     //no connection to the server
+#define CLI_E_HOST -10       //host name not found
+#define CLI_E_NOMEM -11      //out of memory
+
+//what a transfer did, besides its outcome
+#define CLI_X_RESTARTED 0x01 //a resumed get whose local copy did not match started over
+#define CLI_X_NO_COPY 0x02   //delta upload without a copy on the server, sent whole
+#define CLI_X_NO_DELTA 0x04  //delta upload to a server without delta transfers, sent whole
+#define CLI_X_RESENT 0x08    //delta upload whose rebuilt file did not match, sent again whole
+#define CLI_X_CHANGED 0x10   //the file changed size while it was sent
+#define CLI_X_ONE_BY_ONE 0x20 //a batch or tree the server has no single command for
+                              //(an epoll server), its files moved one by one
+struct cli_xfer
+{
+    off_t size;   //size of the file
+    off_t offset; //where a resumed transfer went on from, 0 if from the start
+    off_t bytes;  //file data moved
+    off_t saved;  //bytes a delta upload did not have to send
+    int conns;    //connections of a parallel get
+    int notes;    //CLI_X_ bits
+};
+
+//called with every entry of a listing
+typedef void (*cli_entry_fn)(struct list_entry *e, void *arg);
+//called with every piece of a text, pieces may cut a line
+typedef void (*cli_text_fn)(char *data, int len, void *arg);
+//called once the transfer of name in a batch is over, rc is its outcome
+//and x->size is 0 if the size of the file never came
+typedef void (*cli_file_fn)(char *name, int rc, struct cli_xfer *x, void *arg);
+
+//bulk frame size agreed with the server
+extern int bulk_size;
+//codec agreed with the server, COMP_RAW while compression is off
+extern int comp_codec;
+//1 if get and put ask for the sum of data the two ends move without a
+//copy, which they read back from the file to sum (see stream_readback())
+extern int verify_data;
+
+//message of a CLI_ outcome
+char *cli_strerror(int rc);
+//connect to port of host, open the stream of the connection and agree on
+//the bulk frame size. Returns the socket, or CLI_E_HOST or CLI_E_CONNECT
+int cli_open(char *host, unsigned short port);
+//close a connection of cli_open()
+void cli_close(int sd);
+//current directory of the server into path (size bytes)
+int cli_pwd(int sd, char *path, int size);
+//list the server directory, count entries from cursor on, 0 for all of them
+//from the start. fn gets every entry, *total the number of them and *next
+//the cursor of the next page, 0 if there is none. A server without LIST
+//is answered CLI_E_UNSUPPORTED, see cli_names()
+int cli_dir(int sd, long long count, long long cursor, cli_entry_fn fn, void *arg, long long *total, long long *next);
+//names of the server directory as one text into names (size bytes)
+//returns its length, or a CLI_E_ code
+int cli_names(int sd, char *names, int size);
+//change the current directory of the server
+int cli_cd(int sd, char *path);
+//download file from server to client, resuming a partial local file if asked
+int cli_get(int sd, char *filename, int resume, struct cli_xfer *x);
+//upload file from client to server, resuming a cut off upload if asked
+int cli_put(int sd, char *filename, int resume, struct cli_xfer *x);
+//upload only the differences of a file to the server's copy of it
+int cli_delta(int sd, char *filename, struct cli_xfer *x);
+//agree on the bulk frame size of the connection, see bulk_size
+int cli_blk(int sd, int size);
+//agree on a codec of the connection, or turn compression off, see comp_codec
+int cli_comp(int sd, int on);
+//turn verify_data on or off for the transfers of sd from now on
+void cli_verify(int sd, int on);
+//size and CRC-32C of a file of the server
+int cli_sum(int sd, char *filename, long long *size, uint32_t *crc);
+//counters of the server as text, fn gets it piece by piece
+int cli_stat(int sd, cli_text_fn fn, void *arg);
+//get or put several files at once in a mux session, fn gets the outcome of
+//each. *nfiles gets the files transferred and *nbytes their bytes.
+//Returns CLI_OK if every file moved, the outcome of the first that did
+//not otherwise, CLI_E_UNSUPPORTED if the server has no mux sessions
+int cli_mux(int sd, char op, char **names, int n, cli_file_fn fn, void *arg, int *nfiles, long long *nbytes);
+//cli_mux(), or one by one if the server has no mux sessions, every file
+//then has CLI_X_ONE_BY_ONE in its notes
+int cli_mxfer(int sd, char op, char **names, int n, cli_file_fn fn, void *arg, int *nfiles, long long *nbytes);
+//add the names of the server / client directory matching a glob pattern
+//to the list names of *n names
+int cli_match(int sd, char *pattern, char ***names, int *n);
+int cli_lmatch(char *pattern, char ***names, int *n);
+//download / upload a directory tree in one stream, ts gets what moved.
+//A tree the server could not store whole is CLI_E_SERVER, *stored then
+//gets the bytes it did store. A server without tree transfers gives
+//its tree to cli_rget() a directory and a file at a time, *notes then
+//gets CLI_X_ONE_BY_ONE; cli_rput() is CLI_E_UNSUPPORTED, as the
+//protocol has no other way to make a directory on the server
+int cli_rget(int sd, char *dirname, struct tree_stats *ts, int *notes);
+int cli_rput(int sd, char *dirname, struct tree_stats *ts, long long *stored);
+//download a file in slices over nconn connections (at most PGET_MAX_CONNS)
+int cli_pget(int sd, char *filename, int nconn, struct cli_xfer *x);
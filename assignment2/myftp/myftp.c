@@ -1,104 +1,134 @@
 /**
  * file:        myftp.c
  * Author:      Seow Wei Cheng (33753618) and Jin Min Seok (33884206)
- * Date:        13/11/2021 (version 2)
+ * Date:        13/11/2021 (version 3)
  * Purpose:     This is the main driver code for the ftp client
- *              usage: myftp [ hostname | IP_address ]
+ *              usage: myftp [-b script] [ hostname | IP_address ]
  *              if no hostname or ip address is provided localhost is assumed
  *              default port is 41314
+ *              With -b the commands are read from script, or from stdin if it is "-",
+ *              and run back to back without prompts. Every command is followed by
+ *              a line with its time, and the first command that fails ends the
+ *              client with exit status 1.
+ *              The commands themselves are in libmyftp.a, this file prints what came of them.
  *              The program can perform the following commands
  *              pwd - to display the current directory of the server that is serving the client;
  *              lpwd - to display the current directory of the client;
  *              dir - to display the file names under the current directory of the server that is serving the client;
+ *              dir count [cursor] - to display count entries of the server directory, from where the last page ended.
  *              ldir - to display the file names under the current directory of the client;
  *              cd directory_pathname - to change the current directory of the server that is serving the client; Must support "." and ".." notations.
  *              lcd directory_pathname - to change the current directory of the client; Must support "." and ".." notations.
  *              get filename - to download the named file from the current directory of the remote server and save it in the current directory of the client;
  *              put filename - to upload the named file from the current directory of the client to the current directory of the remove server.
+ *              get and put take several file names too, the files then move at the same time over one connection.
+ *              get -j N filename - to download the named file in N slices over N connections at the same time.
+ *              get -c filename - to resume the download of the named file where its local partial copy ends.
+ *              put -c filename - to resume an upload of the named file that was cut off, where the server's copy ends.
+ *              put -d filename - to upload only the parts of the named file that differ from the server's copy of it.
+ *              mget pattern - to download every file of the server directory whose name matches the glob pattern.
+ *              mput pattern - to upload every file of the client directory whose name matches the glob pattern.
+ *              rget directory - to download the named directory of the server with everything below it.
+ *              rput directory - to upload the named directory of the client with everything below it.
+ *              blksize [bytes] - to show or change the size of the frames file data is sent in.
+ *              compress [on|off] - to show or change whether get and put compress the file data.
+ *              verify [on|off] - to show or change whether uncompressed get and put data is checksummed too,
+ *              which costs a second read of it on both ends.
+ *              sum filename - to show the checksum of the named file of the server, and whether the local copy matches.
+ *              stat - to show the counters of the server: sessions, commands, bytes moved and latencies.
  *              quit - to terminate the myftp session.
  */
 #include <stdlib.h>
 #include <stdio.h>
 #include <sys/stat.h>
 #include <sys/types.h>
-#include <sys/socket.h>
-#include <netinet/in.h> /* struct sockaddr_in, htons, htonl */
-#include <netdb.h>      /* struct hostent, gethostbyname() */
 #include <string.h>
 #include <unistd.h>
 #include <dirent.h>
 #include <fcntl.h>
-#include "../stream.h" /* MAX_BLOCK_SIZE, readn(), writen() */
+#include <time.h>
+#include "../stream.h" /* MAX_BLOCK_SIZE */
 #include "../token.h"
 #include "../netprotocol.h"
+#include "../crc32c.h"
+#include "../tree.h"
+#include "../compress.h"
+#include "../listing.h"
+#include "libmyftp.h"
+
+//names of the codecs of compress.h
+static char *comp_names[] = {"off", "zlib", "lz"};
+
+//change client current directory, returns 0 or -1
+static int cli_lcd(char *path);
+//list file in client current directory, returns 0 or -1
+static int cli_ldir();
+//run one command line of the user, returns 0 or -1 if it failed
+static int cli_run(int sd, char *line);
 
-#define SERV_TCP_PORT 41314
-//change client current directory
-void cli_lcd(char *);
-//list file in client current directory
-void cli_ldir();
-//get server change directory
-void cli_pwd(int);
-//list file in remote / server current directory
-void cli_dir(int);
-//Upload file from client to server
-void cli_put(int, char *);
-//download file from server to client
-void cli_get(int, char *);
-//change the current directoryof the server
-void cli_cd(int, char *);
 int main(int argc, char *argv[])
 {
-    int sd, nr, tknum, i = 0;
-    char buf[MAX_BLOCK_SIZE], buf2[MAX_BLOCK_SIZE], host[60];
-    char *tokens[MAX_NUM_TOKENS];
-    unsigned short port;
-    struct sockaddr_in ser_addr;
-    struct hostent *hp;
+    int sd, nr, opt, line = 0, batch = 0, ret = 0;
+    char buf[MAX_BLOCK_SIZE], host[60];
+    struct timespec t0, t1;
+    FILE *in = stdin;
+
+    while ((opt = getopt(argc, argv, "b:")) != -1)
+    {
+        if (opt == 'b')
+        {
+            batch = 1;
+            if (strcmp(optarg, "-") != 0 && (in = fopen(optarg, "r")) == NULL)
+            {
+                perror(optarg);
+                exit(1);
+            }
+        }
+        else
+        {
+            printf("Usage: %s [-b script] [ <server host name> ]\n", argv[0]);
+            exit(1);
+        }
+    }
     /* get server host name and port number */
-    if (argc == 1)
+    if (optind == argc)
     { /* assume server running on the local host and on default port */
         strcpy(host, "localhost");
-        port = SERV_TCP_PORT;
     }
-    else if (argc == 2)
+    else if (optind == argc - 1)
     { /* use the given host name */
-        strcpy(host, argv[1]);
-        port = SERV_TCP_PORT;
+        snprintf(host, sizeof(host), "%s", argv[optind]);
     }
     else
     {
-        printf("Usage: %s [ <server host name> [ <server listening port> ] ]\n", argv[0]);
+        printf("Usage: %s [-b script] [ <server host name> ]\n", argv[0]);
         exit(1);
     }
 
-    /* get host address, & build a server socket address */
-    bzero((char *)&ser_addr, sizeof(ser_addr));
-    ser_addr.sin_family = AF_INET;
-    ser_addr.sin_port = htons(port);
-    if ((hp = gethostbyname(host)) == NULL)
-    {
-        printf("host %s not found\n", host);
-        exit(1);
-    }
-    ser_addr.sin_addr.s_addr = *(u_long *)hp->h_addr;
-
-    /* create TCP socket & connect socket to server address */
-    sd = socket(PF_INET, SOCK_STREAM, 0);
-
-    if (connect(sd, (struct sockaddr *)&ser_addr, sizeof(ser_addr)) < 0)
+    if ((sd = cli_open(host, SERV_TCP_PORT)) < 0)
     {
-        perror("client connect");
+        if (sd == CLI_E_HOST)
+            printf("host %s not found\n", host);
+        else
+            perror("client connect");
         exit(1);
     }
     printf("Client has successfully connected to the server.\n");
-    while (++i)
+    while (1)
     {
-        printf(">");
-        //get user input
-        fgets(buf, sizeof(buf), stdin);
+        if (!batch)
+        {
+            printf(">");
+            fflush(stdout);
+        }
+        //get user input, the end of it ends the session
+        if (fgets(buf, sizeof(buf), in) == NULL)
+        {
+            break;
+        }
+        line++;
         nr = strlen(buf);
-        if (buf[nr - 1] == '\n')
+        if (nr > 0 && buf[nr - 1] == '\n')
         {
             buf[nr - 1] = '\0';
             --nr;
@@ -106,646 +136,626 @@ int main(int argc, char *argv[])
         //quit
         if (strcmp(buf, "quit") == 0)
         {
-            printf("\tBye from client\n");
-            exit(0);
+            break;
         }
-        else
+        //scripts may have blank lines and comments
+        if (batch && (strspn(buf, " \t") == nr || buf[strspn(buf, " \t")] == '#'))
         {
-            //set buffer to 0 and copy
-            memset(buf2, 0, MAX_BLOCK_SIZE);
-            memcpy(buf2, buf, MAX_BLOCK_SIZE);
-            //tokenise user input
-            tknum = tokenise(buf2, tokens);
-            if (tknum > 2)
-            {
-                printf("\tInvalid command,please try again\n");
-            }
-            /*
-            This will display client's current working directory
-            */
-            if (strcmp(tokens[0], "lpwd") == 0)
-            {
-                memset(buf, 0, MAX_BLOCK_SIZE);
-                getcwd(buf, MAX_BLOCK_SIZE);
-                printf("\t%s\n", buf);
-            }
-            else if (strcmp(tokens[0], "ldir") == 0)
-            {
-                cli_ldir();
-            }
-            /*
-                This will change the client directory
-                check the token for lcd, if = 0
-                Continue to check if directory exist and then change to 
-                that directory
-                */
-            else if (strcmp(tokens[0], "lcd") == 0)
-            {
-                if (tknum != 2)
-                {
-                    printf("\tInvalid command usage, please use: lcd [path]\n");
-                }
-                else
-                {
-                    cli_lcd(tokens[1]);
-                }
-            }
-            else if (strcmp(tokens[0], "pwd") == 0)
-            {
-                cli_pwd(sd);
-            }
-            else if (strcmp(tokens[0], "dir") == 0)
-            {
-                cli_dir(sd);
-            }
-            else if (strcmp(tokens[0], "put") == 0)
-            {
-                if (tknum != 2)
-                {
-                    printf("\tInvalid command usage, please use: put [filename]\n");
-                }
-                else
-                {
-                    cli_put(sd, tokens[1]);
-                }
-            }
-            else if (strcmp(tokens[0], "get") == 0)
-            {
-                if (tknum != 2)
-                {
-                    printf("\tInvalid command usage, please use: get [filename]\n");
-                }
-                else
-                {
-                    cli_get(sd, tokens[1]);
-                }
-            }
-            else if (strcmp(tokens[0], "cd")==0)
-            {
-                if(tknum != 2)
-                {
-                    printf("\tInvalid command usage, please use: cd [filepath]\n");
-                }
-                else
-                {
-                    cli_cd(sd,tokens[1]);
-                }
-            }
-            else
+            continue;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        ret = cli_run(sd, buf);
+        if (batch)
+        {
+            clock_gettime(CLOCK_MONOTONIC, &t1);
+            printf("[%d] %s: %s in %.3f ms\n", line, buf, ret < 0 ? "failed" : "done",
+                   (t1.tv_sec - t0.tv_sec) * 1e3 + (t1.tv_nsec - t0.tv_nsec) / 1e6);
+            if (ret < 0)
             {
-                printf("\tInvalid command please try again.\n");
+                break;
             }
         }
     }
+    printf("\tBye from client\n");
+    cli_close(sd);
+    exit(batch && ret < 0);
 }
 
-void cli_lcd(char *path)
+//print what a get or put of cli_get() / cli_put() did
+static void cli_show(char op, int rc, struct cli_xfer *x)
 {
-    if (chdir(path) != 0)
+    if (x->notes & CLI_X_RESTARTED)
     {
-        printf("\tInvalid directory specified\n");
+        printf("\tlocal file does not match the file on server, fetching it again.\n");
     }
-    return;
-}
-
-void cli_ldir()
-{
-    //open and create dirent pointer and struct
-    DIR *dp;
-    struct dirent *direntp;
-    //variables for file name storage
-    int filecount = 0;
-    char *filenamearray[MAX_NUM_TOKENS];
-    if ((dp = opendir(".")) == NULL)
+    if (op == GET_CODE1 && (rc == CLI_OK || x->size > 0))
     {
-        printf("\tFailed to open directory\n");
-        return;
+        printf("\tfile size is %lld\n", (long long)x->size);
     }
-    //get filenames
-    while ((direntp = readdir(dp)) != NULL)
+    if (x->offset > 0)
     {
-        if (direntp->d_name[0] == '.')
-        {
-            continue;
-        }
-        filenamearray[filecount] = direntp->d_name;
-        filecount++;
-        if (filecount > MAX_NUM_TOKENS)
-        {
-            printf("\tToo many files to be displayed!\n");
-            break;
-        }
+        printf(op == GET_CODE1 ? "\tresuming at byte %lld\n" : "\tresuming upload at %lld bytes.\n",
+               (long long)x->offset);
     }
-    for (int i = 0; i < filecount; i++)
+    if (rc != CLI_OK)
     {
-        printf("\t%s\n", filenamearray[i]);
-    }
-    return;
-}
-
-void cli_cd(int sd, char * buf)
-{
-    char buf1[MAX_BLOCK_SIZE];
-    char opcode, status;
-    int len, convertedlen;
-    buf1[0] = CD_CODE;
-    //write opcode to server
-    if((writen(sd,&buf1[0],1)) < 0)
-    {
-        printf("\tFailed to write opcode to server.\n");
         return;
     }
-    len = strlen(buf);
-    convertedlen = htons(len);
-    memcpy(&buf1[1],&convertedlen,2);
-    //write file length to server
-    if((writen(sd,&buf1[1],2)) < 0)
+    if (op == GET_CODE1)
     {
-        printf("\tFailed to write file length to server.\n");
-        return;
+        if (x->notes & CLI_X_CHANGED)
+            printf("\tfile changed on server during transfer, %lld bytes received.\n", (long long)x->bytes);
+        printf("\tFile is recieved from server.\n");
     }
-    //write file path to server
-    if((writen(sd,&buf[0],len)) < 0)
+    else if (x->notes & CLI_X_CHANGED)
     {
-        printf("\tFailed to write file path to server.\n");
-        return;
+        printf("\tFile shrank during transfer, %lld bytes sent.\n", (long long)x->bytes);
     }
-    memset(buf1,0,MAX_BLOCK_SIZE);
-    //read opcode
-    if((readn(sd,&buf1[0],MAX_BLOCK_SIZE)) < 0)
+    else
     {
-        printf("\tFailed to read opcode from server.\n");
-        return;
+        printf("\tFile is transfer succesfully.\n");
+    }
+}
+
+//message of a get or put that failed with rc
+static char *cli_xfer_error(char op, int rc)
+{
+    switch (rc)
+    {
+    case CLI_E_LOCAL:
+        return (op == PUT_CODE1) ? "File cannot be open." : "failed to write file";
+    case CLI_E_DAMAGED:
+        return (op == PUT_CODE1) ? "File arrived damaged on server, checksum does not match."
+                                 : "file data damaged on the way, checksum does not match.";
+    case CLI_E_SERVER:
+        return "File failed to transfer succesfully.";
+    default:
+        return cli_strerror(rc);
     }
-    memcpy(&opcode,&buf1[0],1);
-    if(opcode != CD_CODE)
+}
+
+//print the outcome of a get or put, returns 0 or -1
+static int cli_done(char op, int rc, struct cli_xfer *x)
+{
+    cli_show(op, rc, x);
+    if (rc != CLI_OK)
     {
-        printf("\tInvalid op code from server.\n");
-        return;
+        printf("\t%s\n", cli_xfer_error(op, rc));
+        return -1;
     }
-    if((readn(sd,&buf1[1],MAX_BLOCK_SIZE)) < 0)
+    return 0;
+}
+
+//what cli_file_done needs to know about its batch
+struct cli_batch_state
+{
+    char op;
+    int told; //the one by one fallback has been reported
+};
+
+//a file of a batch is over, arg is the cli_batch_state of the batch
+static void cli_file_done(char *name, int rc, struct cli_xfer *x, void *arg)
+{
+    struct cli_batch_state *b = arg;
+    char op = b->op;
+
+    if ((x->notes & CLI_X_ONE_BY_ONE) && !b->told)
     {
-        printf("\tFailed to read status from server.\n");
-        return;
+        printf("\tServer has no mux sessions, the files go one by one.\n");
+        b->told = 1;
     }
-    memcpy(&status,&buf1[1],1);
-    if(status == CD_READY)
+    if (rc != CLI_OK)
     {
-        printf("\tCD to new directory: %s.\n",buf);
+        printf("\t%s: %s\n", name, cli_xfer_error(op, rc));
         return;
     }
-    else if(status == CD_ERROR)
+    if (op == GET_CODE1)
     {
-        printf("\tFailed to CD to new directory.\n");
-        return;
+        printf("\t%s: file size is %lld\n", name, (long long)x->size);
     }
-    return;
-}  
+    printf("\t%s: %lld bytes %s.\n", name, (long long)x->bytes, op == GET_CODE1 ? "received" : "sent");
+}
 
-void cli_pwd(int sd)
+//seconds since t0
+static double cli_secs(struct timespec *t0)
 {
-    //create variable for use
-    char buf[MAX_BLOCK_SIZE];
-    char serverpath[MAX_BLOCK_SIZE];
-    int len;
-    memset(buf, 0, MAX_BLOCK_SIZE);
-    memset(serverpath, 0, MAX_BLOCK_SIZE);
-    //set op code
-    buf[0] = PWD_CODE;
-    //write op code to server
-    if((writen(sd, buf, 1)) < 0)
-    {
-        printf("\tFailed to write opcode to server.\n");
-        return;
+    struct timespec t1;
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    return (t1.tv_sec - t0->tv_sec) + (t1.tv_nsec - t0->tv_nsec) / 1e9;
+}
+
+//move several files at once and print how many made it
+static int cli_batch(int sd, char op, char **names, int n)
+{
+    struct cli_batch_state b = {op, 0};
+    struct timespec t0;
+    long long nbytes = 0;
+    int rc, nfiles = 0;
+    double secs;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    rc = cli_mxfer(sd, op, names, n, cli_file_done, &b, &nfiles, &nbytes);
+    if (rc == CLI_E_IO || rc == CLI_E_NOMEM)
+    {
+        printf("\t%s\n", cli_strerror(rc));
     }
-    //read the op code from the server
-    if((readn(sd, &buf[0], MAX_BLOCK_SIZE)) < 0)
+    secs = cli_secs(&t0);
+    printf("\t%d of %d files transferred, %lld bytes in %.3f seconds, %.2f MB/s\n", nfiles, n, nbytes, secs,
+           secs > 0 ? nbytes / secs / (1024 * 1024) : 0.0);
+    return (rc == CLI_OK) ? 0 : -1;
+}
+
+//print what a tree transfer started at t0 moved
+static void cli_tree_done(struct tree_stats *ts, struct timespec *t0)
+{
+    double secs = cli_secs(t0);
+
+    printf("\t%d directories, %d files, %lld bytes in %.3f seconds, %.2f MB/s\n", ts->dirs, ts->files, ts->bytes, secs,
+           secs > 0 ? ts->bytes / secs / (1024 * 1024) : 0.0);
+    if (ts->failed > 0)
     {
-        printf("\tFailed to read op code\n");
-        return;
+        printf("\t%d entries failed to transfer.\n", ts->failed);
     }
-    //printf("\t%s\n",buf);
-    if (!(buf[0] == PWD_CODE))
+}
+
+static int cli_rtree(int sd, char op, char *dirname)
+{
+    struct tree_stats ts;
+    struct timespec t0;
+    long long stored = -1;
+    int rc, notes = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    rc = (op == TREE_GET_CODE) ? cli_rget(sd, dirname, &ts, &notes) : cli_rput(sd, dirname, &ts, &stored);
+    if (notes & CLI_X_ONE_BY_ONE)
+    {
+        printf("\tServer does not send trees, fetching them a file at a time.\n");
+    }
+    if (rc == CLI_OK || stored >= 0)
+    {
+        cli_tree_done(&ts, &t0);
+        if (rc != CLI_OK)
+            printf("\tsome entries could not be stored on server, %lld bytes stored.\n", stored);
+        return (rc == CLI_OK && ts.failed == 0) ? 0 : -1;
+    }
+    if (rc == CLI_E_NOT_FOUND)
+        printf("\tError:directory is not found on server.\n");
+    else if (rc == CLI_E_CLASH)
+        printf("\tDirectory already exist on server\n");
+    else if (rc == CLI_E_LOCAL)
+        printf("\tDirectory cannot be open.\n");
+    else if (rc == CLI_E_UNSUPPORTED)
+        printf("\tServer does not take directory trees, use rput with a fork or prefork server.\n");
+    else
+        printf("\t%s\n", cli_strerror(rc));
+    return -1;
+}
+
+//print an entry of the server directory
+static void cli_entry(struct list_entry *e, void *arg)
+{
+    char when[32];
+    struct tm tm;
+    time_t mtime;
+
+    //localtime() would look at the time zone again for every entry
+    mtime = e->mtime;
+    strftime(when, sizeof(when), "%b %d %H:%M", localtime_r(&mtime, &tm));
+    printf("\t%c %12lld %s %.*s\n", S_ISDIR(e->mode) ? 'd' : S_ISLNK(e->mode) ? 'l' : S_ISREG(e->mode) ? '-' : '?',
+           e->size, when, e->namelen, e->name);
+}
+
+static int cli_list(int sd, long long count, long long cursor)
+{
+    char names[MAX_BLOCK_SIZE];
+    long long total, next;
+    int rc;
+
+    rc = cli_dir(sd, count, cursor, cli_entry, NULL, &total, &next);
+    //servers without LIST send the names only, in one reply
+    if (rc == CLI_E_UNSUPPORTED && count == 0 && cursor == 0 && (rc = cli_names(sd, names, sizeof(names))) >= 0)
     {
-        printf("\tInvalid PWD op code\n");
-        return;
+        if (rc > 0)
+            printf("\t%.*s\n", rc, names);
+        return 0;
     }
-    readn(sd, &buf[1], sizeof(buf));
-    if (buf[1] == PWD_READY)
+    if (rc != CLI_OK)
     {
-        // read the length of server file path
-        readn(sd, &buf[2], sizeof(buf));
-        //copy 4 bytes of the length
-        memcpy(&len, &buf[2], 4);
-        len = (int)ntohl(len);
-        readn(sd, serverpath, sizeof(buf));
-        printf("\t%s\n", serverpath);
+        printf("\t%s\n", cli_strerror(rc));
+        return -1;
     }
-    else
+    printf("\t%lld entries\n", total);
+    if (next != 0)
     {
-        printf("\tFailed: Status code was '1'\n");
+        printf("\tmore: dir %lld %lld\n", count, next);
     }
-    return;
+    return 0;
 }
 
-void cli_dir(int sd)
+//print a piece of the counters, arg points to whether a line starts here
+static void cli_text(char *data, int len, void *arg)
 {
-    //create variable for use
-    char buf[MAX_BLOCK_SIZE];
-    char ser_files[MAX_BLOCK_SIZE];
-    int len;
-    memset(buf, 0, MAX_BLOCK_SIZE);
-    memset(ser_files, 0, MAX_BLOCK_SIZE);
-    //set op code
-    buf[0] = DIR_CODE;
-    //write op code to server
-    if((writen(sd, buf, 1)) < 0)
-    {
-        printf("\tFailed to write op code to server.\n");
-        return;
+    int *bol = arg;
+    char *line, *end;
+
+    for (line = data; line < data + len; line = end)
+    {
+        if ((end = memchr(line, '\n', data + len - line)) != NULL)
+            end++;
+        else
+            end = data + len;
+        printf("%s%.*s", *bol ? "\t" : "", (int)(end - line), line);
+        *bol = (end[-1] == '\n');
     }
-    //read the op code from the server
-    if((readn(sd, &buf[0], MAX_BLOCK_SIZE)) < 0)
+}
+
+static int cli_counters(int sd)
+{
+    int rc, bol = 1; //at the start of a line
+
+    rc = cli_stat(sd, cli_text, &bol);
+    if (!bol)
     {
-        printf("\tFailed to read op code from server.\n");
-        return;
+        printf("\n");
     }
-    //printf("\t%s\n",buf);
-    if (!(buf[0] == DIR_CODE))
+    if (rc != CLI_OK)
     {
-        printf("\tFailed to read DIR op code\n");
-        return;
+        printf("\t%s\n", rc == CLI_E_UNSUPPORTED ? "Server has no counters." : cli_strerror(rc));
+        return -1;
     }
-    if((readn(sd, &buf[1], MAX_BLOCK_SIZE)) < 0)
+    return 0;
+}
+
+//checksum of a file of the server, and whether the local copy matches
+static int cli_check(int sd, char *filename)
+{
+    struct stat fst;
+    long long size;
+    uint32_t crc, lcrc;
+    int fd, rc;
+
+    if ((rc = cli_sum(sd, filename, &size, &crc)) != CLI_OK)
     {
-        printf("\tFailed to read ack code\n");
-        return;
+        printf("\t%s\n", rc == CLI_E_UNSUPPORTED ? "Server has no checksums." : cli_strerror(rc));
+        return -1;
     }
-    if (buf[1] == DIR_READY)
+    printf("\tserver: crc32c %08x, %lld bytes\n", crc, size);
+    if ((fd = open(filename, O_RDONLY)) < 0)
     {
-        // read the length of server file path
-        if((readn(sd, &buf[2], MAX_BLOCK_SIZE)) < 0)
-        {
-            printf("\tFailed to read length of server file path\n");
-            return;
-        }
-        //copy 4 bytes of the length
-        memcpy(&len, &buf[2], 2);
-        len = (int)ntohs(len);
-        readn(sd, ser_files, sizeof(buf));
-        //ser_files[len] = '\0';
-        printf("\t%s\n", ser_files);
+        return 0;
     }
-    else
+    if (fstat(fd, &fst) == 0 && crc32c_file(fd, 0, fst.st_size, &lcrc) == 0)
     {
-        printf("\tFailed: Status code was '1'\n");
+        printf("\tlocal:  crc32c %08x, %lld bytes, %s\n", lcrc, (long long)fst.st_size,
+               (lcrc == crc && fst.st_size == size) ? "same" : "different");
     }
-    return;
+    close(fd);
+    return 0;
 }
 
-void cli_get(int sd, char *filename)
+static int cli_run(int sd, char *line)
 {
-    char opcode, ackcode;
-    int fsize, nr, nw, file_len, total = 0, fd;
     char buf[MAX_BLOCK_SIZE];
-    memset(buf, 0, MAX_BLOCK_SIZE);
+    char *tokens[MAX_NUM_TOKENS];
+    struct cli_xfer x;
+    int tknum, rc;
 
-    char file_name[MAX_BLOCK_SIZE]; //use for storing filename
-    strcpy(file_name, filename);    //string copy filename
-    buf[0] = GET_CODE1;
-    if (writen(sd, &buf[0], 1) < 0)
+    //tokenise user input
+    snprintf(buf, sizeof(buf), "%s", line);
+    if ((tknum = tokenise(buf, tokens)) < 1)
     {
-        printf("\tFailed to write op code to server.\n");
-        return;
+        printf("\tInvalid command please try again.\n");
+        return -1;
     }
-    memset(buf, 0, MAX_BLOCK_SIZE); //set buffer to 0
-    //get file name length
-    file_len = strlen(file_name);
-    int templen = htons(file_len);
-    //set last index of file_name to null
-    file_name[file_len] = '\0';
-    //write file name length to server
-    memcpy(&buf[0], &templen, 2);
-    if (writen(sd, &buf[0], 2) < 0)
-    {
-        printf("\tFailed to write file length to server.\n");
-        return;
-    }
-    //write file name to server using file length
-    memcpy(&buf[2], &file_name, file_len);
-    if (writen(sd, &buf[2], file_len) < 0)
+    if (tknum > 2 && strcmp(tokens[0], "get") != 0 && strcmp(tokens[0], "put") != 0 &&
+        strcmp(tokens[0], "mget") != 0 && strcmp(tokens[0], "mput") != 0 && strcmp(tokens[0], "dir") != 0)
     {
-        printf("\tFailed to write file name to server.\n");
-        return;
+        printf("\tInvalid command,please try again\n");
+        return -1;
     }
-    //read server response
-    memset(buf, 0, MAX_BLOCK_SIZE);
-    if (readn(sd, &buf[0], MAX_BLOCK_SIZE) < 0)
+    /*
+    This will display client's current working directory
+    */
+    if (strcmp(tokens[0], "lpwd") == 0)
     {
-        printf("\tFailed to read op code from server\n");
-        return;
+        if (getcwd(buf, MAX_BLOCK_SIZE) == NULL)
+            return -1;
+        printf("\t%s\n", buf);
     }
-    memcpy(&opcode, &buf[0], 1);
-    printf("\tOpcode from server is: %c\n", opcode);
-    if (readn(sd, &buf[1], MAX_BLOCK_SIZE) < 0)
+    else if (strcmp(tokens[0], "ldir") == 0)
     {
-        printf("\tFailed to read ack code from server\n");
-        return;
+        return cli_ldir();
     }
-    memcpy(&ackcode, &buf[1], 1);
-    printf("\tAckcode from server is: %c\n", ackcode);
-    if (opcode == GET_CODE1)
+    /*
+        This will change the client directory
+        check the token for lcd, if = 0
+        Continue to check if directory exist and then change to
+        that directory
+        */
+    else if (strcmp(tokens[0], "lcd") == 0)
     {
-        if (ackcode == GET_READY)
+        if (tknum != 2)
         {
-            printf("\tfile is found on server.\n");
-            memset(buf, 0, MAX_BLOCK_SIZE);
-            if (readn(sd, &buf[0], MAX_BLOCK_SIZE) < 0)
-            {
-                printf("\tFailed to read opcode 2 from server.\n");
-                return;
-            }
-            memcpy(&opcode, &buf[0], 1);
-            if (opcode == GET_CODE2)
-            {
-                //check if can read file size from client
-                if (readn(sd, &buf[1], MAX_BLOCK_SIZE) < 0)
-                {
-                    printf("\tfailed to read file size from client\n");
-                    return;
-                }
-                memcpy(&fsize, &buf[1], 4);
-                //convert file size to host byte order
-                fsize = ntohl(fsize);
-                printf("\tfile size is %d\n", fsize);
-                //create file
-                if ((fd = open(filename, O_WRONLY | O_CREAT, 0666)) != -1)
-                {
-                    //set ackcode
-                    ackcode = PUT_DONE;
-                    //set max block of data recieved
-                    char block[MAX_BLOCK_SIZE];
-                    //set block buffer to 0
-                    memset(block, '\0', MAX_BLOCK_SIZE);
-                    //set file seek pointer to start of file
-                    lseek(fd, 0, SEEK_SET);
-                    //if total file size is smaller than max block size
-                    if (fsize < MAX_BLOCK_SIZE)
-                    {
-                        //read from socket stream to data block
-                        nr = readn(sd, block, MAX_BLOCK_SIZE);
-                        //if failed to read set ackcode to '1'
-                        if (nr < 0)
-                        {
-                            printf("failed to read file\n");
-                            ackcode = PUT_FAIL;
-                        }
-                        //write block of data to file using leftover file size
-                        nw = write(fd, block, fsize);
-                        if (nw < 0)
-                        {
-                            printf("failed to write file\n");
-                            ackcode = PUT_FAIL;
-                        }
-                    }
-                    else
-                    {
-                        //if total transfer is less than file size
-                        while (total < fsize)
-                        {
-                            //reset block buffer
-                            memset(block, '\0', MAX_BLOCK_SIZE);
-                            //set file seek pointer to total transfer
-                            lseek(fd, total, SEEK_SET);
-                            //read next block of data
-                            nr = readn(sd, block, MAX_BLOCK_SIZE);
-                            if (nr < 0)
-                            {
-                                printf("failed to read file\n");
-                                ackcode = PUT_FAIL;
-                            }
-                            int leftover = fsize - total;
-                            //if leftover data is less than max block size
-                            if (leftover < MAX_BLOCK_SIZE)
-                            {
-                                //write to fd using the leftover file size
-                                nw = write(fd, block, leftover);
-                                if (nw < 0)
-                                {
-                                    printf("failed to write file\n");
-                                    ackcode = PUT_FAIL;
-                                }
-                            }
-                            else
-                            {
-                                //write to fd using the max block size
-                                nw = write(fd, block, MAX_BLOCK_SIZE);
-                                if (nw < 0)
-                                {
-                                    printf("failed to write file\n");
-                                    ackcode = PUT_FAIL;
-                                }
-                            }
-                            //add to total file count
-                            total += nw;
-                        }
-                    }
-                }
-                printf("\tFile is recieved from server.\n");
-            }
-            else if (ackcode == GET_NOT_FOUND)
-            {
-                printf("\tError:file is not found on server.\n");
-                return;
-            }
-        }
-        else
-        {
-            printf("\tServer send wrong opcode\n");
-            return;
+            printf("\tInvalid command usage, please use: lcd [path]\n");
+            return -1;
         }
+        return cli_lcd(tokens[1]);
     }
-}
-void cli_put(int sd, char *filename)
-{
-
-    //variable used
-    char opcode, ackcode; //storing opcode and ackcode
-    int fsize, nr, file_len, total = 0;
-    char buf[MAX_BLOCK_SIZE]; //to store message from client or server
-
-    memset(buf, 0, MAX_BLOCK_SIZE); //set buffer to zero
-    char file_name[MAX_BLOCK_SIZE]; //use for storing filename
-    strcpy(file_name, filename);    //string copy filename
-
-    FILE *file;                   //create file pointer
-    file = fopen(file_name, "r"); //open client selected file
-    //check if file exist on client
-    if (file != NULL)
-    {
-        //write opcode to server
-        buf[0] = PUT_CODE1;
-        writen(sd, &buf[0], 1);
-        memset(buf, 0, MAX_BLOCK_SIZE); //set buffer to 0
-        //get file name length
-        file_len = strlen(file_name);
-        int templen = htons(file_len);
-        //set last index of file_name to null
-        file_name[file_len] = '\0';
-        //write file name length to server
-        memcpy(&buf[0], &templen, 2);
-        writen(sd, &buf[0], 2);
-        //write file name to server using file length
-        memcpy(&buf[2], &file_name, file_len);
-        writen(sd, &buf[2], file_len);
-
-        //read server response
-        memset(buf, 0, MAX_BLOCK_SIZE);
-        //check if server opcode response received
-        if (readn(sd, &buf[0], MAX_BLOCK_SIZE) < 0)
-        {
-            printf("\tfailed to read opcode from server.\n");
-            return;
-        }
-        else
+    else if (strcmp(tokens[0], "pwd") == 0)
+    {
+        if ((rc = cli_pwd(sd, buf, sizeof(buf))) != CLI_OK)
         {
-            memcpy(&opcode, &buf[0], 1);
-            printf("\topcode from server is: %c\n", opcode);
+            printf("\t%s\n", cli_strerror(rc));
+            return -1;
         }
-        //check if server ackcode response received
-        if (readn(sd, &buf[1], MAX_BLOCK_SIZE) < 0)
+        printf("\t%s\n", buf);
+    }
+    else if (strcmp(tokens[0], "dir") == 0)
+    {
+        if (tknum > 3 || (tknum > 1 && atoll(tokens[1]) <= 0))
         {
-            printf("\tfailed to read ackcode from server.\n");
-            return;
+            printf("\tInvalid command usage, please use: dir [count [cursor]]\n");
+            return -1;
         }
-        else
+        return cli_list(sd, tknum > 1 ? atoll(tokens[1]) : 0, tknum > 2 ? atoll(tokens[2]) : 0);
+    }
+    else if (strcmp(tokens[0], "put") == 0)
+    {
+        if (tknum < 2)
         {
-            memcpy(&ackcode, &buf[1], 1);
-            printf("\topcode from server is: %c\n", ackcode);
+            printf("\tInvalid command usage, please use: put [filename ...]\n");
+            return -1;
         }
-        //if ackcode is 0
-        if (ackcode == PUT_READY)
+        else if (strcmp(tokens[1], "-c") == 0)
         {
-            //write opcode 2 to server
-            memset(buf, 0, MAX_BLOCK_SIZE);
-            opcode = PUT_CODE2;
-            memcpy(&buf[0], &opcode, 1);
-            if (writen(sd, &buf[0], 1) < 0)
+            if (tknum != 3)
             {
-                printf("\tfailed to write opcode 2 to server\n");
-                return;
+                printf("\tInvalid command usage, please use: put -c [filename]\n");
+                return -1;
             }
-            //get file size and send to server
-            struct stat fst;
-            //check if file stat is ok
-            if (stat(file_name, &fst) == -1)
+            return cli_done(PUT_CODE1, cli_put(sd, tokens[2], 1, &x), &x);
+        }
+        else if (strcmp(tokens[1], "-d") == 0)
+        {
+            if (tknum != 3)
             {
-                printf("\t failed to get file stat\n");
-                return;
+                printf("\tInvalid command usage, please use: put -d [filename]\n");
+                return -1;
             }
-            //get file size and convert it to network btye order
-            fsize = (int)fst.st_size;
-            templen = htonl(fsize);
-            memcpy(&buf[1], &templen, 4);
-            //check if file size is send to server
-            if (writen(sd, &buf[1], 4) < 0)
+            rc = cli_delta(sd, tokens[2], &x);
+            if (x.notes & (CLI_X_NO_COPY | CLI_X_NO_DELTA))
             {
-                printf("\tfailed to write file size to server\n");
-                return;
+                printf((x.notes & CLI_X_NO_COPY) ? "\tNo copy on server, sending the whole file.\n"
+                                                 : "\tServer has no delta transfer, sending the whole file.\n");
+                return cli_done(PUT_CODE1, rc, &x);
             }
-            //getting file descriptor
-            int fd = fileno(file);
-            //creating buffer for block of data
-            char block[MAX_BLOCK_SIZE];
-            memset(block, '\0', MAX_BLOCK_SIZE);
-            //set file pointer
-            lseek(fd, 0, SEEK_SET);
-            //check if file size is smaller than data buffer
-            if (fsize < MAX_BLOCK_SIZE)
+            if (x.notes & CLI_X_RESENT)
             {
-                //read and write first block of data
-                nr = read(fd, block, fsize);
-                writen(sd, block, MAX_BLOCK_SIZE);
+                printf("\tRebuilt file does not match, sending the whole file.\n");
             }
-            else
+            if (rc != CLI_OK)
             {
-                //if current sent block of data is smaller than total file size
-                while (total < fsize)
-                {
-                    //reset block buffer
-                    memset(block, '\0', MAX_BLOCK_SIZE);
-                    //set file seek pointer to previous end
-                    lseek(fd, total, SEEK_SET);
-
-                    //read next block of data
-                    //if file size - current total size is larger than max block
-                    if ((fsize - total) > MAX_BLOCK_SIZE)
-                    {
-                        //read next block of data to max block size
-                        nr = read(fd, block, MAX_BLOCK_SIZE);
-                    }
-                    else
-                    {
-                        //read next block of data to leftover size
-                        nr = read(fd, block, (fsize - total));
-                    }
-                    //read block data to server
-                    writen(sd, block, MAX_BLOCK_SIZE);
-                    //add write count to total size
-                    total += nr;
-                }
+                printf("\t%s\n", cli_xfer_error(PUT_CODE1, rc));
+                return -1;
             }
+            printf("\tFile is transfer succesfully, %lld bytes sent, %lld bytes (%.1f%%) saved.\n", (long long)x.bytes,
+                   (long long)x.saved, x.size > 0 ? 100.0 * x.saved / x.size : 0.0);
+        }
+        else if (tknum == 2)
+        {
+            return cli_done(PUT_CODE1, cli_put(sd, tokens[1], 0, &x), &x);
+        }
+        else
+        {
+            return cli_batch(sd, PUT_CODE1, &tokens[1], tknum - 1);
+        }
+    }
+    else if (strcmp(tokens[0], "get") == 0)
+    {
+        if (tknum < 2 || (strcmp(tokens[1], "-j") == 0 && (tknum != 4 || atoi(tokens[2]) <= 0)))
+        {
+            printf("\tInvalid command usage, please use: get [filename ...] or get -j [connections] [filename]\n");
+            return -1;
+        }
+        else if (strcmp(tokens[1], "-j") == 0)
+        {
+            struct timespec t0;
+            double secs;
 
-            //read server response
-            memset(buf, 0, MAX_BLOCK_SIZE);
-            //check if can read opcode from server
-            if (readn(sd, &buf[0], MAX_BLOCK_SIZE) < 0)
+            clock_gettime(CLOCK_MONOTONIC, &t0);
+            rc = cli_pget(sd, tokens[3], atoi(tokens[2]), &x);
+            secs = cli_secs(&t0);
+            if (x.size > 0 || rc == CLI_OK)
+                printf("\tfile size is %lld\n", (long long)x.size);
+            if (rc != CLI_OK)
             {
-                printf("\tError: Not able to read opcode from server 3.\n");
-                return;
+                printf("\t%s\n", rc == CLI_E_NOT_FOUND ? cli_strerror(rc) : "File failed to transfer succesfully.");
+                return -1;
             }
-            memcpy(&opcode, &buf[0], 1);
-            //check if can read ack code from server
-            if (readn(sd, &buf[1], MAX_BLOCK_SIZE) < 0)
+            printf("\t%lld bytes in %.3f seconds over %d connections, %.2f MB/s\n", (long long)x.bytes, secs, x.conns,
+                   secs > 0 ? x.bytes / secs / (1024 * 1024) : 0.0);
+            printf("\tFile is recieved from server.\n");
+        }
+        else if (strcmp(tokens[1], "-c") == 0)
+        {
+            if (tknum != 3)
             {
-                printf("\tError: Not able to read ack code from server 3.\n");
+                printf("\tInvalid command usage, please use: get -c [filename]\n");
+                return -1;
             }
-            memcpy(&ackcode, &buf[1], 1);
-            //check if opcode is correct
-            if (opcode == PUT_CODE2)
+            return cli_done(GET_CODE1, cli_get(sd, tokens[2], 1, &x), &x);
+        }
+        else if (tknum == 2)
+        {
+            return cli_done(GET_CODE1, cli_get(sd, tokens[1], 0, &x), &x);
+        }
+        else
+        {
+            return cli_batch(sd, GET_CODE1, &tokens[1], tknum - 1);
+        }
+    }
+    else if (strcmp(tokens[0], "rget") == 0 || strcmp(tokens[0], "rput") == 0)
+    {
+        if (tknum != 2)
+        {
+            printf("\tInvalid command usage, please use: %s [directory]\n", tokens[0]);
+            return -1;
+        }
+        return cli_rtree(sd, tokens[0][1] == 'g' ? TREE_GET_CODE : TREE_PUT_CODE, tokens[1]);
+    }
+    else if (strcmp(tokens[0], "mget") == 0 || strcmp(tokens[0], "mput") == 0)
+    {
+        char **names = NULL;
+        int nnames = 0, ret = 0;
+
+        if (tknum < 2)
+        {
+            printf("\tInvalid command usage, please use: %s [pattern ...]\n", tokens[0]);
+            return -1;
+        }
+        //every pattern is expanded where its files are
+        for (int j = 1; j < tknum && ret == CLI_OK; j++)
+        {
+            ret = (tokens[0][1] == 'g') ? cli_match(sd, tokens[j], &names, &nnames) : cli_lmatch(tokens[j], &names, &nnames);
+        }
+        if (ret != CLI_OK)
+        {
+            printf("\t%s\n", ret == CLI_E_LOCAL ? "Failed to open directory" : cli_strerror(ret));
+            ret = -1;
+        }
+        else if (nnames == 0)
+            printf("\tNo file matches.\n");
+        else
+            ret = cli_batch(sd, tokens[0][1] == 'g' ? GET_CODE1 : PUT_CODE1, names, nnames);
+        for (int j = 0; j < nnames; j++)
+            free(names[j]);
+        free(names);
+        return ret;
+    }
+    else if (strcmp(tokens[0], "blksize") == 0)
+    {
+        if (tknum == 2 && atoi(tokens[1]) > 0)
+        {
+            if ((rc = cli_blk(sd, atoi(tokens[1]))) != CLI_OK)
             {
-                printf("\tServer opcode recieved.\n");
-                printf("\topcode is: %c\n", opcode);
-                //check if ackcode is 0, which is file transfer done
-                if (ackcode == PUT_DONE)
-                {
-                    printf("\tFile is transfer succesfully.\n");
-                    printf("\tackcode is: %c\n", ackcode);
-                }
-                else if (ackcode == PUT_FAIL)
-                {
-                    printf("\tFile failed to transfer succesfully.\n");
-                    printf("\tackcode is: %c\n", ackcode);
-                }
+                printf("\tServer refused block size %d.\n", atoi(tokens[1]));
+                return -1;
             }
         }
-        //if ackcode returns to be '1'
-        else if (ackcode == PUT_CLASH_ERROR)
+        else if (tknum != 1)
+        {
+            printf("\tInvalid command usage, please use: blksize [bytes]\n");
+            return -1;
+        }
+        printf("\tblock size is %d bytes\n", bulk_size);
+    }
+    else if (strcmp(tokens[0], "compress") == 0)
+    {
+        rc = CLI_OK;
+        if (tknum == 2 && (strcmp(tokens[1], "on") == 0 || strcmp(tokens[1], "off") == 0))
+        {
+            if ((rc = cli_comp(sd, tokens[1][1] == 'n')) != CLI_OK)
+                printf("\tServer does not compress.\n");
+        }
+        else if (tknum != 1)
+        {
+            printf("\tInvalid command usage, please use: compress [on|off]\n");
+            return -1;
+        }
+        printf("\tcompression is %s\n", comp_names[comp_codec]);
+        return (rc == CLI_OK) ? 0 : -1;
+    }
+    else if (strcmp(tokens[0], "verify") == 0)
+    {
+        if (tknum == 2 && (strcmp(tokens[1], "on") == 0 || strcmp(tokens[1], "off") == 0))
+        {
+            cli_verify(sd, tokens[1][1] == 'n');
+        }
+        else if (tknum != 1)
         {
-            printf("\tFile already exist on server\n");
-            return;
+            printf("\tInvalid command usage, please use: verify [on|off]\n");
+            return -1;
         }
-        // else if (ackcode == PUT_CREATE_ERROR)
-        // {
-        //     printf("\tServer failed to crate file\n");
-        //     return;
-        // }
+        printf("\tchecksums of uncompressed data are %s\n", verify_data ? "on" : "off");
+    }
+    else if (strcmp(tokens[0], "sum") == 0)
+    {
+        if (tknum != 2)
+        {
+            printf("\tInvalid command usage, please use: sum [filename]\n");
+            return -1;
+        }
+        return cli_check(sd, tokens[1]);
+    }
+    else if (strcmp(tokens[0], "stat") == 0)
+    {
+        return cli_counters(sd);
+    }
+    else if (strcmp(tokens[0], "cd")==0)
+    {
+        if(tknum != 2)
+        {
+            printf("\tInvalid command usage, please use: cd [filepath]\n");
+            return -1;
+        }
+        if ((rc = cli_cd(sd, tokens[1])) != CLI_OK)
+        {
+            printf("\t%s\n", rc == CLI_E_IO ? cli_strerror(rc) : "Failed to CD to new directory.");
+            return -1;
+        }
+        printf("\tCD to new directory: %s.\n", tokens[1]);
     }
-    //cannot open file
     else
     {
-        printf("\tFile cannot be open.\n");
-        return;
+        printf("\tInvalid command please try again.\n");
+        return -1;
+    }
+    return 0;
+}
+
+static int cli_lcd(char *path)
+{
+    if (chdir(path) != 0)
+    {
+        printf("\tInvalid directory specified\n");
+        return -1;
+    }
+    return 0;
+}
+
+static int cli_ldir()
+{
+    //open and create dirent pointer and struct
+    DIR *dp;
+    struct dirent *direntp;
+    //variables for file name storage
+    int filecount = 0;
+    char *filenamearray[MAX_NUM_TOKENS];
+    if ((dp = opendir(".")) == NULL)
+    {
+        printf("\tFailed to open directory\n");
+        return -1;
+    }
+    //get filenames
+    while ((direntp = readdir(dp)) != NULL)
+    {
+        if (direntp->d_name[0] == '.')
+        {
+            continue;
+        }
+        filenamearray[filecount] = direntp->d_name;
+        filecount++;
+        if (filecount >= MAX_NUM_TOKENS)
+        {
+            printf("\tToo many files to be displayed!\n");
+            break;
+        }
+    }
+    for (int i = 0; i < filecount; i++)
+    {
+        printf("\t%s\n", filenamearray[i]);
     }
-    return;
+    closedir(dp);
+    return 0;
 }
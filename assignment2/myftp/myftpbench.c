@@ -0,0 +1,485 @@
+/**
+ * file:        myftpbench.c
+ * Author:      Seow Wei Cheng (33753618) and Jin Min Seok (33884206)
+ * Date:        17/10/2026 (version 1)
+ * Purpose:     Load generator for the ftp server
+ *              usage: myftpbench [-c sessions] [-t seconds] [-m mix] [-s sizes] [-d dir]
+ *                                [ hostname | IP_address [ port ] ]
+ *              Runs many sessions against the server at once, each issuing
+ *              commands back to back for a while, and reports per command
+ *              the ops/s, MB/s and the p50/p99/p99.9 latency.
+ *              -c sessions running at once (default 50), every session is a
+ *                 process of its own running the commands of libmyftp.a
+ *              -t seconds the load runs for (default 10)
+ *              -m weights of the commands, names out of get, put, dir and pwd
+ *                 (default get=80,dir=10,pwd=10)
+ *              -s weights of the file sizes of get and put, sizes may end in
+ *                 k, m or g (default 64k=70,1m=25,16m=5)
+ *              -d local directory the files are made in, by default a new
+ *                 one under /tmp that is removed at the end
+ *              A file of every size is uploaded first as bench-<bytes>.dat,
+ *              the gets fetch those. Every put leaves a file of its own on
+ *              the server (bench-put-<pid>-<n>.dat).
+ *              Latencies are kept in log-linear histograms, 16 buckets per
+ *              power of two, so a percentile is within about 6% of the
+ *              real value. A session adds its histograms to the shared
+ *              totals once, when it ends.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <limits.h> /* PATH_MAX */
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include "libmyftp.h"
+
+#define BENCH_GET 0
+#define BENCH_PUT 1
+#define BENCH_DIR 2
+#define BENCH_PWD 3
+#define BENCH_OPS 4
+
+#define BENCH_SUB 16                             //buckets per power of two
+#define BENCH_BUCKETS (BENCH_SUB + 40 * BENCH_SUB) //up to 2^44us, about 200 days
+#define BENCH_MAX_SIZES 16                       //file sizes of -s
+
+static char *bench_names[BENCH_OPS] = {"get", "put", "dir", "pwd"};
+
+//numbers of one command
+struct bench_op
+{
+    unsigned long long count;
+    unsigned long long errors;
+    unsigned long long bytes;
+    unsigned long long hist[BENCH_BUCKETS]; //latencies in microseconds
+};
+
+//totals shared by every session
+struct bench
+{
+    int ready;  //sessions connected
+    int failed; //sessions that could not connect
+    struct timespec end;
+    struct bench_op op[BENCH_OPS];
+};
+
+static struct bench *bt;
+//server every session connects to
+static char host[256];
+static unsigned short port = SERV_TCP_PORT;
+static int op_weight[BENCH_OPS];
+static long long sizes[BENCH_MAX_SIZES];
+static int size_weight[BENCH_MAX_SIZES];
+static int nsizes;
+
+//bucket of a latency of us microseconds
+static int bench_bucket(unsigned long long us)
+{
+    int k;
+
+    if (us < BENCH_SUB)
+        return us;
+    k = 63 - __builtin_clzll(us);
+    if (k - 4 >= 40)
+        return BENCH_BUCKETS - 1;
+    return BENCH_SUB + (k - 4) * BENCH_SUB + (int)((us >> (k - 4)) - BENCH_SUB);
+}
+
+//largest latency of bucket b, in microseconds
+static unsigned long long bench_bound(int b)
+{
+    int k;
+
+    if (b < BENCH_SUB)
+        return b;
+    k = (b - BENCH_SUB) / BENCH_SUB;
+    return (((unsigned long long)(BENCH_SUB + (b - BENCH_SUB) % BENCH_SUB + 1)) << k) - 1;
+}
+
+//latency under which the share p of the commands of m finished, in ms
+static double bench_percentile(struct bench_op *m, double p)
+{
+    unsigned long long want, seen = 0;
+    int b;
+
+    want = (unsigned long long)(p * m->count);
+    if (want < 1)
+        want = 1;
+    for (b = 0; b < BENCH_BUCKETS; b++)
+    {
+        seen += m->hist[b];
+        if (seen >= want)
+            return bench_bound(b) / 1000.0;
+    }
+    return 0;
+}
+
+static long long bench_usec(struct timespec *a, struct timespec *b)
+{
+    return (long long)(b->tv_sec - a->tv_sec) * 1000000 + (b->tv_nsec - a->tv_nsec) / 1000;
+}
+
+//number with an optional k, m or g suffix, -1 if it is not one
+static long long bench_size(char *s)
+{
+    char *end;
+    long long n = strtoll(s, &end, 10);
+
+    if (end == s || n < 0)
+        return -1;
+    if (*end == 'k' || *end == 'K')
+        n <<= 10, end++;
+    else if (*end == 'm' || *end == 'M')
+        n <<= 20, end++;
+    else if (*end == 'g' || *end == 'G')
+        n <<= 30, end++;
+    return (*end == '\0') ? n : -1;
+}
+
+//read name=weight pairs separated by commas, returns 0 or -1
+static int bench_mix(char *arg)
+{
+    char *item, *eq;
+    int i;
+
+    memset(op_weight, 0, sizeof(op_weight));
+    for (item = strtok(arg, ","); item != NULL; item = strtok(NULL, ","))
+    {
+        if ((eq = strchr(item, '=')) == NULL)
+            return -1;
+        *eq = '\0';
+        for (i = 0; i < BENCH_OPS && strcmp(item, bench_names[i]) != 0; i++)
+            ;
+        if (i == BENCH_OPS || (op_weight[i] = atoi(eq + 1)) < 0)
+            return -1;
+    }
+    for (i = 0; i < BENCH_OPS && op_weight[i] == 0; i++)
+        ;
+    return (i == BENCH_OPS) ? -1 : 0;
+}
+
+static int bench_sizes(char *arg)
+{
+    char *item, *eq;
+
+    nsizes = 0;
+    for (item = strtok(arg, ","); item != NULL; item = strtok(NULL, ","))
+    {
+        if ((eq = strchr(item, '=')) == NULL || nsizes == BENCH_MAX_SIZES)
+            return -1;
+        *eq = '\0';
+        if ((sizes[nsizes] = bench_size(item)) < 0 || (size_weight[nsizes] = atoi(eq + 1)) <= 0)
+            return -1;
+        nsizes++;
+    }
+    return (nsizes == 0) ? -1 : 0;
+}
+
+//pick an index out of n weights
+static int bench_pick(int *weight, int n, unsigned int *seed)
+{
+    int i, total = 0, r;
+
+    for (i = 0; i < n; i++)
+        total += weight[i];
+    r = rand_r(seed) % total;
+    for (i = 0; r >= weight[i]; i++)
+        r -= weight[i];
+    return i;
+}
+
+static void bench_file(char *name, long long size)
+{
+    sprintf(name, "bench-%lld.dat", size);
+}
+
+//make a local file of size bytes, returns 0 or -1
+static int bench_make(char *name, long long size)
+{
+    char buf[1024 * 64];
+    unsigned int seed = size;
+    long long n;
+    int fd, i, len;
+
+    if ((fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+        return -1;
+    for (n = 0; n < size; n += len)
+    {
+        //data that does not compress, like most files that are moved
+        for (i = 0; i < (int)sizeof(buf); i += sizeof(int))
+            *(int *)(buf + i) = rand_r(&seed);
+        len = (size - n < (long long)sizeof(buf)) ? size - n : (long long)sizeof(buf);
+        if (write(fd, buf, len) != len)
+        {
+            close(fd);
+            return -1;
+        }
+    }
+    close(fd);
+    return 0;
+}
+
+//entries of a listing are only counted by the server
+static void bench_entry(struct list_entry *e, void *arg)
+{
+}
+
+//1 if the server closed the connection
+static int bench_closed(int sd)
+{
+    char c;
+
+    return recv(sd, &c, 1, MSG_PEEK | MSG_DONTWAIT) == 0;
+}
+
+//body of a session: commands until the end time, then the histograms go
+//to the totals
+static void bench_session(int id, int go)
+{
+    struct bench_op op[BENCH_OPS];
+    struct timespec t0, t1;
+    char dir[32], name[64], src[80], path[PATH_MAX];
+    long long total, next;
+    unsigned int seed = getpid() ^ time(NULL);
+    struct cli_xfer x;
+    int sd, i, k, s, rc, nputs = 0;
+
+    sprintf(dir, "w%d", id);
+    if (mkdir(dir, 0755) < 0 || chdir(dir) < 0 || (sd = cli_open(host, port)) < 0)
+    {
+        __atomic_add_fetch(&bt->failed, 1, __ATOMIC_SEQ_CST);
+        rmdir(dir);
+        exit(1);
+    }
+    __atomic_add_fetch(&bt->ready, 1, __ATOMIC_SEQ_CST);
+    //every session starts when the parent closes its end of the pipe
+    read(go, &k, 1);
+    close(go);
+    memset(op, 0, sizeof(op));
+    while (1)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        if (t0.tv_sec > bt->end.tv_sec || (t0.tv_sec == bt->end.tv_sec && t0.tv_nsec >= bt->end.tv_nsec))
+            break;
+        k = bench_pick(op_weight, BENCH_OPS, &seed);
+        s = bench_pick(size_weight, nsizes, &seed);
+        x.bytes = 0;
+        if (k == BENCH_GET)
+        {
+            bench_file(name, sizes[s]);
+            rc = cli_get(sd, name, 0, &x);
+        }
+        else if (k == BENCH_PUT)
+        {
+            //the file goes up under a name of its own, pointing at the source
+            bench_file(src + 3, sizes[s]);
+            memcpy(src, "../", 3);
+            sprintf(name, "bench-put-%d-%d.dat", (int)getpid(), nputs++);
+            rc = (symlink(src, name) == 0) ? cli_put(sd, name, 0, &x) : CLI_E_LOCAL;
+            unlink(name);
+        }
+        else if (k == BENCH_DIR)
+        {
+            rc = cli_dir(sd, 0, 0, bench_entry, NULL, &total, &next);
+        }
+        else
+        {
+            rc = cli_pwd(sd, path, sizeof(path));
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        op[k].count++;
+        op[k].hist[bench_bucket(bench_usec(&t0, &t1))]++;
+        if (rc != CLI_OK)
+        {
+            op[k].errors++;
+            if (bench_closed(sd))
+                break;
+        }
+        else
+        {
+            op[k].bytes += x.bytes;
+        }
+    }
+    cli_close(sd);
+    for (i = 0; i < nsizes; i++)
+    {
+        bench_file(name, sizes[i]);
+        unlink(name);
+    }
+    chdir("..");
+    rmdir(dir);
+    for (k = 0; k < BENCH_OPS; k++)
+    {
+        __atomic_add_fetch(&bt->op[k].count, op[k].count, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&bt->op[k].errors, op[k].errors, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&bt->op[k].bytes, op[k].bytes, __ATOMIC_RELAXED);
+        for (i = 0; i < BENCH_BUCKETS; i++)
+        {
+            if (op[k].hist[i] > 0)
+                __atomic_add_fetch(&bt->op[k].hist[i], op[k].hist[i], __ATOMIC_RELAXED);
+        }
+    }
+    exit(0);
+}
+
+//line of the report for m, named name, over secs seconds
+static void bench_line(char *name, struct bench_op *m, double secs)
+{
+    printf("%-6s %10llu %10.1f %10.2f %9.3f %9.3f %9.3f %8llu\n", name, m->count, m->count / secs,
+           m->bytes / secs / (1024 * 1024), bench_percentile(m, 0.50), bench_percentile(m, 0.99),
+           bench_percentile(m, 0.999), m->errors);
+}
+
+int main(int argc, char *argv[])
+{
+    char mix[] = "get=80,dir=10,pwd=10";
+    char sizemix[] = "64k=70,1m=25,16m=5";
+    char name[64], scratch[PATH_MAX];
+    char *dir = NULL;
+    int go[2];
+    int opt, i, k, sd, nsessions = 50, seconds = 10, started = 0;
+    struct cli_xfer x;
+    struct timespec t0, t1;
+    struct bench_op all;
+    double secs;
+
+    bench_mix(mix);
+    bench_sizes(sizemix);
+    while ((opt = getopt(argc, argv, "c:t:m:s:d:")) != -1)
+    {
+        if (opt == 'c' && (nsessions = atoi(optarg)) > 0)
+            continue;
+        if (opt == 't' && (seconds = atoi(optarg)) > 0)
+            continue;
+        if (opt == 'm' && bench_mix(optarg) == 0)
+            continue;
+        if (opt == 's' && bench_sizes(optarg) == 0)
+            continue;
+        if (opt == 'd')
+        {
+            dir = optarg;
+            continue;
+        }
+        optind = argc + 1; //force the usage message
+        break;
+    }
+    if (argc - optind > 2 || optind > argc)
+    {
+        printf("Usage: %s [-c sessions] [-t seconds] [-m get=N,put=N,dir=N,pwd=N] [-s size=N,...] [-d dir]"
+               " [ <server host name> [ <server listening port> ] ]\n", argv[0]);
+        exit(1);
+    }
+    strcpy(host, "localhost");
+    if (argc - optind >= 1)
+        snprintf(host, sizeof(host), "%s", argv[optind]);
+    if (argc - optind == 2)
+        port = atoi(argv[optind + 1]);
+
+    //the files of every size, here and on the server
+    if (dir == NULL)
+    {
+        strcpy(scratch, "/tmp/myftpbench.XXXXXX");
+        if (mkdtemp(scratch) == NULL)
+        {
+            perror("mkdtemp");
+            exit(1);
+        }
+    }
+    else
+    {
+        snprintf(scratch, sizeof(scratch), "%s", dir);
+    }
+    if (chdir(scratch) < 0)
+    {
+        perror("chdir");
+        exit(1);
+    }
+    if ((sd = cli_open(host, port)) < 0)
+    {
+        printf("%s\n", sd == CLI_E_HOST ? "host not found" : cli_strerror(sd));
+        exit(1);
+    }
+    for (i = 0; i < nsizes; i++)
+    {
+        bench_file(name, sizes[i]);
+        if (bench_make(name, sizes[i]) < 0)
+        {
+            perror(name);
+            exit(1);
+        }
+        //one left by an earlier run is as good
+        cli_put(sd, name, 0, &x);
+    }
+    cli_close(sd);
+
+    bt = mmap(NULL, sizeof(struct bench), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (bt == MAP_FAILED || pipe(go) < 0)
+    {
+        perror("myftpbench");
+        exit(1);
+    }
+    fflush(stdout);
+    for (i = 0; i < nsessions; i++)
+    {
+        pid_t pid = fork();
+        if (pid < 0)
+        {
+            perror("fork");
+            break;
+        }
+        if (pid == 0)
+        {
+            close(go[1]);
+            bench_session(i, go[0]);
+        }
+        started++;
+    }
+    close(go[0]);
+    //every session connects before the clock starts
+    while (__atomic_load_n(&bt->ready, __ATOMIC_SEQ_CST) + __atomic_load_n(&bt->failed, __ATOMIC_SEQ_CST) < started)
+        usleep(10000);
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    bt->end = t0;
+    bt->end.tv_sec += seconds;
+    close(go[1]);
+    while (wait(NULL) > 0 || errno == EINTR)
+        ;
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    secs = bench_usec(&t0, &t1) / 1e6;
+
+    printf("%d sessions (%d failed to connect), %.2f s\n", bt->ready, bt->failed, secs);
+    printf("%-6s %10s %10s %10s %9s %9s %9s %8s\n", "op", "ops", "ops/s", "MB/s", "p50 ms", "p99 ms", "p99.9 ms",
+           "errors");
+    memset(&all, 0, sizeof(all));
+    for (k = 0; k < BENCH_OPS; k++)
+    {
+        if (bt->op[k].count == 0)
+            continue;
+        bench_line(bench_names[k], &bt->op[k], secs);
+        all.count += bt->op[k].count;
+        all.errors += bt->op[k].errors;
+        all.bytes += bt->op[k].bytes;
+        for (i = 0; i < BENCH_BUCKETS; i++)
+            all.hist[i] += bt->op[k].hist[i];
+    }
+    bench_line("all", &all, secs);
+
+    for (i = 0; i < nsizes; i++)
+    {
+        bench_file(name, sizes[i]);
+        unlink(name);
+    }
+    if (dir == NULL)
+    {
+        chdir("/");
+        rmdir(scratch);
+    }
+    return (bt->failed > 0 || all.errors > 0) ? 1 : 0;
+}
@@ -0,0 +1,255 @@
+/**
+ * file:        dircache.c
+ * Author:      Seow Wei Cheng (33753618) and Jin Min Seok (33884206)
+ * Date:        17/10/2026 (version 1)
+ * Purpose:     DIR listing cache shared by every process of the server.
+ *              The slots live in a shared anonymous mapping made before any
+ *              fork, so the children of the fork engine, the prefork workers
+ *              and the epoll loops all see the listings built by the others.
+ *              A slot is the listing of one directory (device and inode)
+ *              built for one buffer size: the text of DIR, or the packed
+ *              entries of LIST (see listing.h) for DIRCACHE_MAX. The pages
+ *              of a slot are only taken once a listing that long is kept.
+ *              Invalidation: one inotify instance is also made before any
+ *              fork, so its queue is shared too. A process that builds a
+ *              listing adds a watch on the directory first, and every lookup
+ *              first drains the queue and counts each event against the
+ *              slots of its watch. LIST shows sizes and mtimes, so writes
+ *              count as well as names coming and going. A slot is served
+ *              only while its count is the one seen before the directory was
+ *              read, so a change that races with the build is never cached.
+ *              Names starting with a dot are not listed (part files,
+ *              journals) and their events are ignored, so uploads in
+ *              progress do not empty the cache. Neither do writes to the
+ *              log and the access log of the server, which get lines for
+ *              every command: their sizes may lag in a cached listing of
+ *              their directory.
+ *              Readers take no lock: a slot is written between two bumps of
+ *              its sequence number and a copy that saw it move is dropped.
+ */
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/inotify.h>
+#include "../stream.h"
+#include "myftpd.h"
+
+#define DIRCACHE_SLOTS 32                //listings kept
+#define DIRCACHE_WAYS 4                  //slots a directory may take
+//changes to the entries of a directory, or the directory itself going away
+#define DIRCACHE_EVENTS (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_MODIFY | \
+                         IN_ATTRIB | IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF)
+
+struct dircache_slot
+{
+    unsigned int seq;     //odd while the slot is written
+    int busy;             //a process is writing the slot
+    int wd;               //inotify watch of the directory, -1 if none
+    unsigned int changes; //events seen on the watch
+    unsigned int built;   //changes when the listing was read, valid if equal
+    dev_t dev;
+    ino_t ino;
+    int size;             //buffer size the listing was built for
+    int len;              //-1 if the slot holds no listing
+    unsigned long used;   //clock of the last hit, for eviction
+    char data[DIRCACHE_MAX];
+};
+
+struct dircache
+{
+    int draining;         //processes between reading and counting events
+    dev_t logdev;         //directory of the logs of the server
+    ino_t logino;
+    char logname[2][NAME_MAX + 1];
+    unsigned int epoch;   //bumped when the queue overflowed, drops every slot
+    unsigned long clock;
+    struct dircache_slot slot[DIRCACHE_SLOTS];
+};
+
+static struct dircache *dc = NULL;
+static int dc_fd = -1;
+
+int dircache_init(char *log_path, char *alog_path)
+{
+    char logdir[PATH_MAX];
+    struct stat st;
+    char *base;
+    int i;
+
+    dc = mmap(NULL, sizeof(struct dircache), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (dc == MAP_FAILED)
+    {
+        dc = NULL;
+        return -1;
+    }
+    if ((dc_fd = inotify_init1(IN_NONBLOCK)) < 0)
+    {
+        munmap(dc, sizeof(struct dircache));
+        dc = NULL;
+        return -1;
+    }
+    for (i = 0; i < DIRCACHE_SLOTS; i++)
+    {
+        dc->slot[i].wd = -1;
+        dc->slot[i].len = -1;
+    }
+    if ((base = strrchr(alog_path, '/')) != NULL && strlen(base + 1) <= NAME_MAX)
+        strcpy(dc->logname[1], base + 1);
+    snprintf(logdir, sizeof(logdir), "%s", log_path);
+    if ((base = strrchr(logdir, '/')) != NULL && strlen(base + 1) <= NAME_MAX)
+    {
+        strcpy(dc->logname[0], base + 1);
+        *base = '\0';
+        if (stat(logdir[0] == '\0' ? "/" : logdir, &st) == 0)
+        {
+            dc->logdev = st.st_dev;
+            dc->logino = st.st_ino;
+        }
+    }
+    return 0;
+}
+
+//count every queued event against the slots of its watch
+static void dircache_drain(void)
+{
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct inotify_event *ev;
+    int i, nr, pos, log;
+
+    __atomic_add_fetch(&dc->draining, 1, __ATOMIC_SEQ_CST);
+    while ((nr = read(dc_fd, buf, sizeof(buf))) > 0)
+    {
+        for (pos = 0; pos < nr; pos += sizeof(struct inotify_event) + ev->len)
+        {
+            ev = (struct inotify_event *)&buf[pos];
+            if (ev->mask & IN_Q_OVERFLOW)
+            {
+                __atomic_add_fetch(&dc->epoch, 1, __ATOMIC_SEQ_CST);
+                continue;
+            }
+            if (ev->len > 0 && ev->name[0] == '.')
+                continue;
+            log = ev->len > 0 && (ev->mask & ~(IN_MODIFY | IN_CLOSE_WRITE)) == 0 &&
+                  (strcmp(ev->name, dc->logname[0]) == 0 || strcmp(ev->name, dc->logname[1]) == 0);
+            for (i = 0; i < DIRCACHE_SLOTS; i++)
+            {
+                if (__atomic_load_n(&dc->slot[i].wd, __ATOMIC_RELAXED) != ev->wd)
+                    continue;
+                if (log && dc->slot[i].dev == dc->logdev && dc->slot[i].ino == dc->logino)
+                    continue;
+                __atomic_add_fetch(&dc->slot[i].changes, 1, __ATOMIC_SEQ_CST);
+            }
+        }
+    }
+    __atomic_sub_fetch(&dc->draining, 1, __ATOMIC_SEQ_CST);
+}
+
+//first slot a directory may take
+static int dircache_hash(dev_t dev, ino_t ino, int size)
+{
+    unsigned long h = (unsigned long)ino * 2654435761UL ^ (unsigned long)dev ^ (unsigned long)size * 40503UL;
+
+    return (int)(h % DIRCACHE_SLOTS);
+}
+
+int dircache_get(char *files, int size, struct dircache_fill *fill)
+{
+    struct dircache_slot *s;
+    struct stat st;
+    unsigned int seq, epoch;
+    int i, n, len, victim = -1;
+
+    fill->slot = -1;
+    if (dc == NULL || size > DIRCACHE_MAX || stat(".", &st) < 0)
+        return -1;
+    dircache_drain();
+    //another process holds events it has not counted yet, trust no slot
+    if (__atomic_load_n(&dc->draining, __ATOMIC_SEQ_CST) > 0)
+        return -1;
+    epoch = __atomic_load_n(&dc->epoch, __ATOMIC_SEQ_CST);
+    for (n = 0; n < DIRCACHE_WAYS; n++)
+    {
+        i = (dircache_hash(st.st_dev, st.st_ino, size) + n) % DIRCACHE_SLOTS;
+        s = &dc->slot[i];
+        seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+        if ((seq & 1) || s->dev != st.st_dev || s->ino != st.st_ino || s->size != size)
+        {
+            if (victim < 0 || (!(seq & 1) && s->used < dc->slot[victim].used))
+                victim = i;
+            continue;
+        }
+        len = s->len;
+        if (len >= 0 && len <= size && s->built == __atomic_load_n(&s->changes, __ATOMIC_SEQ_CST) &&
+            s->seq == seq && epoch == __atomic_load_n(&dc->epoch, __ATOMIC_SEQ_CST))
+        {
+            memcpy(files, s->data, len);
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&s->seq, __ATOMIC_RELAXED) == seq)
+            {
+                s->used = __atomic_add_fetch(&dc->clock, 1, __ATOMIC_RELAXED);
+                return len;
+            }
+        }
+        victim = i;
+        break;
+    }
+    if (victim < 0)
+        return -1;
+    //claim the slot and watch the directory before it is read
+    s = &dc->slot[victim];
+    n = 0;
+    if (!__atomic_compare_exchange_n(&s->busy, &n, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        return -1;
+    __atomic_add_fetch(&s->seq, 1, __ATOMIC_SEQ_CST);
+    if (s->wd >= 0 && (s->dev != st.st_dev || s->ino != st.st_ino))
+    {
+        //the old directory keeps its watch while another slot uses it
+        for (i = 0; i < DIRCACHE_SLOTS; i++)
+        {
+            if (i != victim && dc->slot[i].wd == s->wd)
+                break;
+        }
+        if (i == DIRCACHE_SLOTS)
+            inotify_rm_watch(dc_fd, s->wd);
+    }
+    s->len = -1;
+    s->dev = st.st_dev;
+    s->ino = st.st_ino;
+    s->size = size;
+    __atomic_store_n(&s->wd, inotify_add_watch(dc_fd, ".", DIRCACHE_EVENTS), __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&s->seq, 1, __ATOMIC_SEQ_CST);
+    if (s->wd < 0)
+    {
+        __atomic_store_n(&s->busy, 0, __ATOMIC_RELEASE);
+        return -1;
+    }
+    fill->slot = victim;
+    fill->changes = __atomic_load_n(&s->changes, __ATOMIC_SEQ_CST);
+    fill->epoch = epoch;
+    return -1;
+}
+
+void dircache_put(struct dircache_fill *fill, char *files, int len)
+{
+    struct dircache_slot *s;
+
+    if (dc == NULL || fill->slot < 0)
+        return;
+    s = &dc->slot[fill->slot];
+    fill->slot = -1;
+    if (len >= 0 && len <= DIRCACHE_MAX && fill->epoch == __atomic_load_n(&dc->epoch, __ATOMIC_SEQ_CST))
+    {
+        __atomic_add_fetch(&s->seq, 1, __ATOMIC_SEQ_CST);
+        memcpy(s->data, files, len);
+        s->len = len;
+        s->built = fill->changes;
+        s->used = __atomic_add_fetch(&dc->clock, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&s->seq, 1, __ATOMIC_SEQ_CST);
+    }
+    __atomic_store_n(&s->busy, 0, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,1448 @@
+/**
+ * file:        evserver.c
+ * Author:      Seow Wei Cheng (33753618) and Jin Min Seok (33884206)
+ * Date:        17/10/2026 (version 3)
+ * Purpose:     Event driven engine for the ftp server, selected with myftpd -m epoll
+ *              Instead of forking a process per client every session is a small
+ *              state machine over the PWD/DIR/CD/GET/PUT op codes of netprotocol.h
+ *              (version 1 frames and version 2 requests alike),
+ *              driven by a non-blocking epoll loop. An idle session only costs its
+ *              session structure, its socket and a descriptor of its current directory.
+ *              The wire format is exactly the one of the forking handlers so
+ *              existing clients cannot tell the two engines apart. The bulk frames
+ *              of a GET are sent with non-blocking sendfile() straight from the file,
+ *              those of a PUT are spliced socket -> pipe -> file.
+ */
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/sendfile.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "../stream.h"
+#include "../netprotocol.h"
+#include "../crc32c.h"
+#include "../listing.h"
+#include "myftpd.h"
+
+#define EV_MAX_EVENTS 64
+#define EV_OUT_HIGH (MAX_BLOCK_SIZE * 8) //stop producing output above this many queued bytes
+
+//session states, one per frame the forking handlers would read next
+#define ST_OPCODE 0    //waiting for an op code
+#define ST_NAMELEN 1   //waiting for the name length of GET, PUT or CD
+#define ST_NAME 2      //waiting for the name of GET, PUT or CD
+#define ST_PUT_CODE2 3 //waiting for the second PUT op code
+#define ST_PUT_SIZE 4  //waiting for the size of the uploaded file
+#define ST_PUT_DATA 5  //receiving the blocks of the uploaded file
+#define ST_GET_DATA 6  //sending the blocks of the requested file
+#define ST_GET_BULK 7  //sending the requested file as bulk frames
+#define ST_PUT_BULK 8  //receiving the uploaded file as bulk frames
+#define ST_BLK_SIZE 9  //waiting for the bulk frame size wanted by the client
+#define ST_PUT_TRAILER 10 //waiting for the trailer of a v2 PUT
+#define ST_LIST_DATA 11   //sending the entries of a LIST
+
+#define EV_PIPE_SIZE (1024 * 1024) //bytes moved by one splice() of a bulk PUT
+
+//sessions sending a file or a listing do not take new frames
+#define SENDING(s) ((s)->state == ST_GET_DATA || (s)->state == ST_GET_BULK || (s)->state == ST_LIST_DATA)
+
+struct session
+{
+    int sd;                       //client socket
+    int dirfd;                    //current directory of this session
+    int state;                    //one of the ST_ states
+    char op;                      //op code being served
+    int namelen;                  //length announced before the name
+    char *name;                   //file name of a PUT in progress
+    int fd;                       //file being sent or received
+    off_t fsize, total;           //transfer progress
+    off_t start;                  //first byte of a ranged GET or resumed PUT
+    off_t committed;              //journaled end of a PUT in progress
+    off_t fend;                   //end of the file data, below fsize if the file shrank
+    uint32_t crc;                 //CRC-32C of the file data of a v2 GET or PUT
+    int crcok;                    //0 once some of it could not be summed
+    int readback;                 //the request has V2_F_SUM, data moved by
+                                  //sendfile() or splice() is read back to be summed
+    int nosplice;                 //splice() failed for this session, PUT data is read instead
+    int nblocks;
+    char ackcode;                 //PUT result
+    int bulk;                     //PUT data follows as bulk frames
+    int v2;                       //GET or PUT was a v2 request
+    char status;                  //v2 status of a PUT in progress
+    int bulk_size;                //bulk frame size agreed with the client
+    int fleft;                    //bytes left in the current bulk frame
+    struct listing *list;         //LIST being sent, NULL if none
+    struct dircache_fill fill;    //cache slot of the listing once it is whole
+    char *kept;                   //entries sent so far, for the cache
+    int keptlen;
+    char in[MAX_BLOCK_SIZE + 2];  //partial input frames
+    int inlen;
+    char *out;                    //queued output frames
+    int outpos, outlen, outcap;
+    int events;                   //epoll events currently registered
+    struct alog alog;             //command being served, for the access log
+};
+
+static int epfd;
+static char *ev_log_path;
+static int evpipe[2] = {-1, -1}; //socket -> file pipe of bulk PUTs, -1 if splice() is not usable
+
+//add nbytes from buf to the output queue as they are
+static int ev_queue(struct session *s, char *buf, int nbytes)
+{
+    char *p;
+
+    if (s->outlen + nbytes > s->outcap)
+    {
+        //reclaim the bytes already written before growing
+        if (s->outpos > 0)
+        {
+            memmove(s->out, s->out + s->outpos, s->outlen - s->outpos);
+            s->outlen -= s->outpos;
+            s->outpos = 0;
+        }
+        if (s->outlen + nbytes > s->outcap)
+        {
+            if ((p = realloc(s->out, s->outlen + nbytes + MAX_BLOCK_SIZE)) == NULL)
+                return -1;
+            s->out = p;
+            s->outcap = s->outlen + nbytes + MAX_BLOCK_SIZE;
+        }
+    }
+    memcpy(s->out + s->outlen, buf, nbytes);
+    s->outlen += nbytes;
+    alog_first();
+    return nbytes;
+}
+
+//add a frame of nbytes from buf to the output queue
+static int ev_send(struct session *s, char *buf, int nbytes)
+{
+    short data_size = htons(nbytes);
+
+    if (ev_queue(s, (char *)&data_size, 2) < 0)
+        return -1;
+    return ev_queue(s, buf, nbytes);
+}
+
+//queue a v2 reply
+static void ev_v2_reply(struct session *s, char op, char status, long long size, char *data, int len)
+{
+    char buf[MAX_BLOCK_SIZE];
+    struct v2_msg rep;
+
+    rep.op = op;
+    rep.status = status;
+    rep.flags = 0;
+    rep.size = size;
+    rep.offset = 0;
+    rep.id = 0;
+    rep.data = data;
+    rep.len = len;
+    alog_reply(status);
+    ev_send(s, buf, v2_pack(buf, &rep));
+}
+
+//queue the trailer of a v2 GET, or the final reply of a v2 PUT, with the
+//checksum of the data when there is one
+static void ev_v2_trailer(struct session *s, char op, long long size)
+{
+    char buf[MAX_BLOCK_SIZE];
+    struct v2_msg rep;
+
+    rep.op = op;
+    rep.status = (op == PUT_CODE1) ? s->status : V2_OK;
+    rep.flags = s->crcok ? V2_F_CHECK : 0;
+    rep.size = size;
+    rep.offset = s->crcok ? s->crc : 0;
+    rep.id = 0;
+    rep.data = NULL;
+    rep.len = 0;
+    alog_reply(rep.status);
+    ev_send(s, buf, v2_pack(buf, &rep));
+}
+
+//write as much queued output as the socket takes, -1 on a broken connection
+static int ev_flush(struct session *s)
+{
+    int nw;
+
+    while (s->outpos < s->outlen)
+    {
+        nw = write(s->sd, s->out + s->outpos, s->outlen - s->outpos);
+        if (nw < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0;
+            return -1;
+        }
+        s->outpos += nw;
+    }
+    //idle sessions do not keep an output buffer
+    s->outpos = s->outlen = 0;
+    if (!SENDING(s))
+    {
+        free(s->out);
+        s->out = NULL;
+        s->outcap = 0;
+    }
+    return 0;
+}
+
+static void ev_pwd(struct session *s)
+{
+    char serverpath[MAX_BLOCK_SIZE];
+    char buf[6];
+    char status;
+    int len, nr;
+
+    log_debug("[pwd] pwd command received.", ev_log_path);
+    if (getcwd(serverpath, sizeof(serverpath)) == NULL)
+    {
+        status = PWD_ERROR;
+        ev_send(s, &status, 1);
+        log_error("[pwd] pwd function error.", ev_log_path);
+        return;
+    }
+    nr = strlen(serverpath);
+    len = htons(nr);
+    buf[0] = PWD_CODE;
+    buf[1] = PWD_READY;
+    bcopy(&len, &buf[2], 4);
+    ev_send(s, &buf[0], 1);
+    ev_send(s, &buf[1], 1);
+    ev_send(s, &buf[2], 4);
+    ev_send(s, serverpath, nr);
+    log_file("[pwd] pwd function ended.", ev_log_path);
+}
+
+static void ev_dir(struct session *s)
+{
+    char files[MAX_BLOCK_SIZE];
+    char buf[6];
+    int len, nr;
+
+    log_debug("[dir] dir command received.", ev_log_path);
+    if ((nr = list_dir(files, sizeof(files), ev_log_path)) < 0)
+    {
+        buf[1] = DIR_ERROR;
+        ev_send(s, &buf[1], 1);
+        return;
+    }
+    alog_bytes(nr);
+    len = htons(nr);
+    buf[0] = DIR_CODE;
+    buf[1] = (nr == 0) ? DIR_ERROR : DIR_READY;
+    bcopy(&len, &buf[2], 4);
+    ev_send(s, &buf[0], 1);
+    ev_send(s, &buf[1], 1);
+    ev_send(s, &buf[2], 4);
+    ev_send(s, files, nr);
+    log_file("[dir] function successfully executed.", ev_log_path);
+}
+
+static void ev_blk(struct session *s, char *buf, int len)
+{
+    char reply[6];
+    int size = 0;
+
+    log_debug("[blk] block size command received.", ev_log_path);
+    s->state = ST_OPCODE;
+    memcpy(&size, buf, len < 4 ? len : 4);
+    size = ntohl(size);
+    reply[0] = BLK_CODE;
+    reply[1] = BLK_READY;
+    if ((size = accept_bulk_size(size)) < 0)
+    {
+        reply[1] = BLK_ERROR;
+        alog_reply(V2_ERROR);
+    }
+    else
+        s->bulk_size = size;
+    size = htonl(s->bulk_size);
+    memcpy(&reply[2], &size, 4);
+    ev_send(s, &reply[0], 1);
+    ev_send(s, &reply[1], 1);
+    ev_send(s, &reply[2], 4);
+}
+
+static void ev_cd(struct session *s, char *path)
+{
+    char buf[2];
+    int dirfd;
+
+    log_debug("[CD] CD command received.", ev_log_path);
+    buf[0] = CD_CODE;
+    buf[1] = CD_ERROR;
+    if (chdir(path) == 0 && (dirfd = open(".", O_RDONLY | O_DIRECTORY)) >= 0)
+    {
+        close(s->dirfd);
+        s->dirfd = dirfd;
+        buf[1] = CD_READY;
+        log_file("[CD] status is ready.", ev_log_path);
+    }
+    else
+    {
+        log_error("[CD] status is error.", ev_log_path);
+    }
+    ev_send(s, &buf[0], 1);
+    ev_send(s, &buf[1], 1);
+}
+
+static void ev_get(struct session *s, char *filename)
+{
+    struct stat fst;
+    char buf[6];
+    int templen;
+
+    log_debug("[get] get command received.", ev_log_path);
+    buf[0] = GET_CODE1;
+    if ((s->fd = open(filename, O_RDONLY)) < 0 || fstat(s->fd, &fst) < 0)
+    {
+        if (s->fd >= 0)
+            close(s->fd);
+        buf[1] = GET_NOT_FOUND;
+        alog_reply(V2_NOT_FOUND);
+        ev_send(s, &buf[0], 1);
+        ev_send(s, &buf[1], 1);
+        log_error("[get] File does not exist on server.", ev_log_path);
+        return;
+    }
+    //the size of a version 1 reply is 32-bit, larger files need a v2 GET
+    if (fst.st_size > INT_MAX)
+    {
+        close(s->fd);
+        buf[1] = GET_NOT_FOUND;
+        alog_reply(V2_NOT_FOUND);
+        ev_send(s, &buf[0], 1);
+        ev_send(s, &buf[1], 1);
+        log_error("[get] File is too large for a version 1 GET.", ev_log_path);
+        return;
+    }
+    buf[1] = GET_READY;
+    buf[2] = GET_CODE2;
+    s->fsize = fst.st_size;
+    templen = htonl((int)s->fsize);
+    ev_send(s, &buf[0], 1);
+    ev_send(s, &buf[1], 1);
+    ev_send(s, &buf[2], 1);
+    ev_send(s, (char *)&templen, 4);
+    s->total = 0;
+    s->start = 0;
+    s->fend = s->fsize;
+    s->v2 = 0;
+    log_debug("[get] File exist on server.", ev_log_path);
+    //bulk frames are sent straight from the file once the replies are out
+    if (s->op == GET_BULK_CODE)
+    {
+        s->fleft = 0;
+        s->state = ST_GET_BULK;
+        return;
+    }
+    //every block is sent padded to MAX_BLOCK_SIZE, an empty file still sends one
+    s->nblocks = (s->fsize == 0) ? 1 : (int)((s->fsize + MAX_BLOCK_SIZE - 1) / MAX_BLOCK_SIZE);
+    s->state = ST_GET_DATA;
+}
+
+//queue the next blocks of a GET until enough output is pending
+static void ev_get_blocks(struct session *s)
+{
+    char block[MAX_BLOCK_SIZE];
+    int nr, leftover;
+
+    while (s->nblocks > 0 && s->outlen - s->outpos < EV_OUT_HIGH)
+    {
+        memset(block, '\0', MAX_BLOCK_SIZE);
+        leftover = s->fsize - s->total;
+        if (leftover > MAX_BLOCK_SIZE)
+            leftover = MAX_BLOCK_SIZE;
+        //a file shrinking under us is padded with zeros
+        if ((nr = pread(s->fd, block, leftover, s->total)) < 0)
+            nr = 0;
+        ev_send(s, block, MAX_BLOCK_SIZE);
+        s->total += leftover;
+        s->nblocks--;
+    }
+    if (s->nblocks == 0)
+    {
+        close(s->fd);
+        s->state = ST_OPCODE;
+        alog_bytes(s->fsize);
+        alog_end();
+        log_file("[get] File is sent to client.", ev_log_path);
+    }
+}
+
+//send the bulk frames of a GET until the socket is full
+//returns -1 on a broken connection
+static int ev_get_bulk(struct session *s)
+{
+    char zeros[MAX_BLOCK_SIZE];
+    uint32_t data_size;
+    off_t off;
+    int nw, len;
+
+    while (s->state == ST_GET_BULK && s->outlen == 0)
+    {
+        if (s->fleft == 0)
+        {
+            //next frame header, the empty frame ends the file
+            len = s->bulk_size;
+            if (s->fsize - s->total < len)
+                len = s->fsize - s->total;
+            data_size = htonl(len);
+            ev_queue(s, (char *)&data_size, 4);
+            s->fleft = len;
+            if (len == 0)
+            {
+                //a v2 GET ends with the trailer and the sum of the data
+                if (s->v2)
+                    ev_v2_trailer(s, s->op, s->fend - s->start);
+                s->v2 = 0;
+                close(s->fd);
+                s->state = ST_OPCODE;
+                alog_bytes(s->fend - s->start);
+                alog_end();
+                log_file("[get] File is sent to client.", ev_log_path);
+            }
+            continue;
+        }
+        off = s->total;
+        nw = sendfile(s->sd, s->fd, &off, s->fleft);
+        if (nw < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0;
+            return -1;
+        }
+        if (nw == 0)
+        {
+            //a file shrinking under us ends after the padded frame
+            if (s->total < s->fend)
+                s->fend = s->total;
+            s->fsize = s->total + s->fleft;
+            len = s->fleft;
+            if (len > MAX_BLOCK_SIZE)
+                len = MAX_BLOCK_SIZE;
+            memset(zeros, 0, len);
+            ev_queue(s, zeros, len);
+            nw = len;
+        }
+        else if (s->v2 && s->crcok && (!s->readback || crc32c_range(s->fd, s->total, nw, &s->crc) < 0))
+        {
+            s->crcok = 0;
+        }
+        s->total += nw;
+        s->fleft -= nw;
+    }
+    return 0;
+}
+
+//add the n bytes of entries just queued to the listing kept for the cache
+static void ev_list_keep(struct session *s, char *data, int n)
+{
+    if (s->fill.slot < 0)
+        return;
+    //pages of the buffer are only taken as the listing grows
+    if (s->kept == NULL)
+        s->kept = malloc(DIRCACHE_MAX);
+    if (s->kept == NULL || s->keptlen + n > DIRCACHE_MAX)
+    {
+        dircache_put(&s->fill, NULL, -1);
+        return;
+    }
+    memcpy(s->kept + s->keptlen, data, n);
+    s->keptlen += n;
+}
+
+//give up the listing of a session, the cache keeps it if it is whole
+static void ev_list_drop(struct session *s, int whole)
+{
+    dircache_put(&s->fill, s->kept, whole ? s->keptlen : -1);
+    free(s->kept);
+    s->kept = NULL;
+    s->keptlen = 0;
+    list_close(s->list);
+    free(s->list);
+    s->list = NULL;
+}
+
+//queue the next frames of a LIST, until enough output is pending while
+//it is ST_LIST_DATA, all of them otherwise
+static void ev_list_frames(struct session *s)
+{
+    char data[MAX_BLOCK_SIZE];
+    char out[MAX_BLOCK_SIZE];
+    struct v2_msg m;
+    int n;
+
+    m.op = LIST_CODE;
+    m.status = V2_OK;
+    m.flags = V2_F_DATA;
+    m.size = 0;
+    m.offset = 0;
+    m.id = 0;
+    m.data = data;
+    while (s->list != NULL && (s->state != ST_LIST_DATA || s->outlen - s->outpos < EV_OUT_HIGH))
+    {
+        if ((n = list_fill(s->list, data, MAX_BLOCK_SIZE - V2_HDR_SIZE)) > 0)
+        {
+            ev_list_keep(s, data, n);
+            alog_bytes(n);
+            m.len = n;
+            ev_send(s, out, v2_pack(out, &m));
+            continue;
+        }
+        m.flags = V2_F_END;
+        m.size = s->list->count;
+        m.offset = s->list->done ? 0 : s->list->cursor;
+        m.len = 0;
+        ev_send(s, out, v2_pack(out, &m));
+        ev_list_drop(s, s->list->done);
+        s->state = ST_OPCODE;
+        alog_end();
+        log_file("[dir] function successfully executed.", ev_log_path);
+    }
+}
+
+static void ev_list(struct session *s, struct v2_msg *req)
+{
+    static char *listbuf = NULL; //listing served from the cache
+    int kept = -1;
+
+    log_debug("[dir] list command received.", ev_log_path);
+    s->fill.slot = -1;
+    if ((s->list = malloc(sizeof(struct listing))) == NULL)
+    {
+        ev_v2_reply(s, LIST_CODE, V2_ERROR, 0, NULL, 0);
+        return;
+    }
+    if (listbuf == NULL)
+        listbuf = malloc(DIRCACHE_MAX);
+    if (listbuf != NULL)
+        kept = dircache_get(listbuf, DIRCACHE_MAX, &s->fill);
+    //a cached listing is queued at once, listbuf is the next session's
+    if (kept >= 0 && list_packed(s->list, listbuf, kept, req->offset, req->size) == 0)
+    {
+        ev_v2_reply(s, LIST_CODE, V2_OK, 0, NULL, 0);
+        ev_list_frames(s);
+        return;
+    }
+    if (list_open(s->list, req->offset, req->size) < 0)
+    {
+        dircache_put(&s->fill, NULL, -1);
+        free(s->list);
+        s->list = NULL;
+        ev_v2_reply(s, LIST_CODE, V2_ERROR, 0, NULL, 0);
+        log_error("Failed to open directory.", ev_log_path);
+        return;
+    }
+    //only a whole listing from the start is worth keeping
+    if (req->offset != 0 || req->size != 0)
+        dircache_put(&s->fill, NULL, -1);
+    ev_v2_reply(s, LIST_CODE, V2_OK, 0, NULL, 0);
+    s->state = ST_LIST_DATA;
+}
+
+//queue the counters of the server, as text in as many frames as it takes
+static void ev_stat(struct session *s)
+{
+    static char *text = NULL;
+    char out[MAX_BLOCK_SIZE];
+    struct v2_msg m;
+    int n, len;
+
+    log_debug("[stat] stat command received.", ev_log_path);
+    if (text == NULL && (text = malloc(METRICS_TEXT_MAX)) == NULL)
+    {
+        ev_v2_reply(s, STAT_CODE, V2_ERROR, 0, NULL, 0);
+        return;
+    }
+    len = metrics_text(text, METRICS_TEXT_MAX);
+    ev_v2_reply(s, STAT_CODE, V2_OK, len, NULL, 0);
+    m.op = STAT_CODE;
+    m.status = V2_OK;
+    m.flags = V2_F_DATA;
+    m.size = 0;
+    m.offset = 0;
+    m.id = 0;
+    for (n = 0; n < len; n += m.len)
+    {
+        m.data = text + n;
+        m.len = (len - n < MAX_BLOCK_SIZE - V2_HDR_SIZE) ? len - n : MAX_BLOCK_SIZE - V2_HDR_SIZE;
+        ev_send(s, out, v2_pack(out, &m));
+    }
+    alog_bytes(len);
+    m.flags = V2_F_END;
+    m.size = len;
+    m.data = NULL;
+    m.len = 0;
+    ev_send(s, out, v2_pack(out, &m));
+    log_file("[stat] function successfully executed.", ev_log_path);
+}
+
+static void ev_put(struct session *s, char *filename)
+{
+    char buf[2];
+
+    log_debug("[put] file name received.", ev_log_path);
+    buf[0] = PUT_CODE1;
+    if (access(filename, R_OK) == 0)
+    {
+        buf[1] = PUT_CLASH_ERROR;
+        alog_reply(V2_CLASH);
+        log_error("[put] put clash error.", ev_log_path);
+    }
+    else
+    {
+        buf[1] = PUT_READY;
+        s->name = strdup(filename);
+        s->state = ST_PUT_CODE2;
+        log_debug("[put] put ready.", ev_log_path);
+    }
+    ev_send(s, &buf[0], 1);
+    ev_send(s, &buf[1], 1);
+}
+
+//answer the client once the whole file of a PUT is received
+static void ev_put_done(struct session *s)
+{
+    char buf[2];
+
+    //the complete part file gets its name
+    if (s->fd >= 0 && s->ackcode == PUT_DONE && (!s->v2 || s->status == V2_OK))
+    {
+        fchdir(s->dirfd);
+        if (journal_finish(s->name, s->fd, s->total) < 0)
+        {
+            log_error("[put] failed to rename part file.", ev_log_path);
+            s->ackcode = PUT_FAIL;
+        }
+    }
+    if (s->fd >= 0)
+        close(s->fd);
+    s->fd = -1;
+    if (s->v2)
+    {
+        if (s->status == V2_OK && s->ackcode != PUT_DONE)
+            s->status = V2_ERROR;
+        ev_v2_trailer(s, PUT_CODE1, s->total);
+        s->v2 = 0;
+    }
+    else
+    {
+        buf[0] = PUT_CODE2;
+        buf[1] = s->ackcode;
+        ev_send(s, &buf[0], 1);
+        ev_send(s, &buf[1], 1);
+    }
+    free(s->name);
+    s->name = NULL;
+    s->state = ST_OPCODE;
+    alog_bytes(s->total - s->start);
+    alog_end();
+    log_file("[put] put command finished.", ev_log_path);
+}
+
+//cut off the padding of a v2 PUT whose file shrank on the client
+static void ev_put_trailer(struct session *s, char *buf, int len)
+{
+    struct v2_msg trailer;
+
+    //the trailer counts from where a resumed upload went on
+    if (v2_parse(buf, len, &trailer) < 0 || trailer.op != PUT_CODE1 || trailer.size < 0)
+        trailer.size = -1;
+    else
+        trailer.size += s->start;
+    //data that did not land as it left never gets the name
+    if (trailer.size != s->total || s->fd < 0 || !(trailer.flags & V2_F_CHECK))
+    {
+        s->crcok = 0;
+    }
+    else if (s->crcok && s->crc != (uint32_t)trailer.offset && s->status == V2_OK)
+    {
+        s->status = V2_MISMATCH;
+        log_error("[put] file data damaged, checksum does not match.", ev_log_path);
+    }
+    if (trailer.size != s->total && s->fd >= 0)
+    {
+        if (trailer.size < 0 || trailer.size > s->total || ftruncate(s->fd, trailer.size) < 0)
+        {
+            s->ackcode = PUT_FAIL;
+            log_error("[put] file size does not match trailer.", ev_log_path);
+        }
+        else
+        {
+            s->total = trailer.size;
+        }
+    }
+    ev_put_done(s);
+}
+
+//journal the progress of a PUT every JOURNAL_STEP bytes, or now if
+//force is set, so a dropped upload can go on
+static void ev_put_commit(struct session *s, int force)
+{
+    if (s->fd < 0 || s->ackcode != PUT_DONE || s->total == s->committed)
+        return;
+    if (!force && s->total - s->committed < JOURNAL_STEP)
+        return;
+    fchdir(s->dirfd);
+    if (journal_commit(s->name, s->fd, s->fsize, s->total) == 0)
+        s->committed = s->total;
+}
+
+//store received PUT data at the current offset of the transfer
+static void ev_put_write(struct session *s, char *block, int len)
+{
+    //a failed open still drains the data to stay in step with the client
+    if (s->fd >= 0 && len > 0)
+    {
+        if (pwrite(s->fd, block, len, s->total) != len)
+        {
+            log_error("[put] failed to write file.", ev_log_path);
+            s->ackcode = PUT_FAIL;
+            close(s->fd);
+            s->fd = -1;
+        }
+        else if (s->v2)
+        {
+            s->crc = crc32c(s->crc, block, len);
+        }
+    }
+    s->total += len;
+    ev_put_commit(s, 0);
+}
+
+//store one received PUT block, answer the client after the last one
+static void ev_put_block(struct session *s, char *block, int len)
+{
+    int leftover = s->fsize - s->total;
+
+    if (leftover > len)
+        leftover = len;
+    if (leftover > 0)
+        ev_put_write(s, block, leftover);
+    if (--s->nblocks > 0)
+        return;
+    ev_put_done(s);
+}
+
+//move bulk frame payload socket -> pipe -> file until the frame ends
+//or the socket is empty, returns -1 on a broken connection
+static int ev_put_splice(struct session *s)
+{
+    char scrap[MAX_BLOCK_SIZE];
+    loff_t off;
+    int nr, nw, left;
+
+    while (s->state == ST_PUT_BULK && s->fd >= 0 && s->fleft > 0)
+    {
+        left = s->fleft;
+        if (left > EV_PIPE_SIZE)
+            left = EV_PIPE_SIZE;
+        nr = splice(s->sd, NULL, evpipe[1], NULL, left, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (nr == 0)
+            return -1;
+        if (nr < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0;
+            if (errno == EINVAL && s->total == s->start)
+            {
+                //not supported by this socket, reads take over for this session
+                s->nosplice = 1;
+                return 0;
+            }
+            return -1;
+        }
+        off = s->total;
+        for (left = nr; left > 0; left -= nw)
+        {
+            nw = splice(evpipe[0], NULL, s->fd, &off, left, SPLICE_F_MOVE);
+            if (nw < 0 && errno == EINTR)
+                nw = 0;
+            else if (nw <= 0)
+                break;
+        }
+        if (left == nr && nw < 0 && (errno == EINVAL || errno == ENOSYS) && s->total == s->start)
+        {
+            //the file takes no splice: write out the pipe, reads take over for this session
+            while (left > 0 && (nw = read(evpipe[0], scrap, left < MAX_BLOCK_SIZE ? left : MAX_BLOCK_SIZE)) > 0)
+            {
+                ev_put_write(s, scrap, nw);
+                s->fleft -= nw;
+                left -= nw;
+            }
+            s->nosplice = 1;
+            if (left > 0)
+            {
+                //a pipe that cannot be emptied is of no use to the next session either
+                close(evpipe[0]);
+                close(evpipe[1]);
+                evpipe[0] = evpipe[1] = -1;
+                return -1;
+            }
+            return 0;
+        }
+        if (left > 0)
+        {
+            //the pipe must be empty for the next session
+            while (left > 0 && (nw = read(evpipe[0], scrap, left < MAX_BLOCK_SIZE ? left : MAX_BLOCK_SIZE)) > 0)
+                left -= nw;
+            log_error("[put] failed to write file.", ev_log_path);
+            s->ackcode = PUT_FAIL;
+            close(s->fd);
+            s->fd = -1;
+        }
+        //the pages just stored are still cached, read back if a sum was asked for
+        else if (s->v2 && s->crcok && (!s->readback || crc32c_range(s->fd, s->total, nr, &s->crc) < 0))
+        {
+            s->crcok = 0;
+        }
+        s->total += nr;
+        s->fleft -= nr;
+        ev_put_commit(s, 0);
+    }
+    return 0;
+}
+
+//serve a v2 request, see netprotocol.h
+static void ev_v2(struct session *s, char *buf, int len)
+{
+    char name[MAX_BLOCK_SIZE + 1];
+    char files[MAX_BLOCK_SIZE];
+    char out[MAX_BLOCK_SIZE];     //replies that carry more than ev_v2_reply()
+    struct v2_msg req;
+    struct stat fst;
+    uint32_t crc;
+    off_t start;
+    int nr, dirfd, count;
+
+    if (v2_parse(buf, len, &req) < 0)
+        return;
+    memcpy(name, req.data, req.len);
+    name[req.len] = '\0';
+    alog_name(name, req.len);
+    s->readback = (req.flags & V2_F_SUM) != 0;
+    switch (req.op)
+    {
+    case PWD_CODE:
+        log_debug("[pwd] pwd command received.", ev_log_path);
+        if (getcwd(files, MAX_BLOCK_SIZE - V2_HDR_SIZE) == NULL)
+            ev_v2_reply(s, PWD_CODE, V2_ERROR, 0, NULL, 0);
+        else
+            ev_v2_reply(s, PWD_CODE, V2_OK, 0, files, strlen(files));
+        break;
+    case DIR_CODE:
+        log_debug("[dir] dir command received.", ev_log_path);
+        if ((nr = list_dir(files, MAX_BLOCK_SIZE - V2_HDR_SIZE, ev_log_path)) < 0)
+            ev_v2_reply(s, DIR_CODE, V2_ERROR, 0, NULL, 0);
+        else
+            ev_v2_reply(s, DIR_CODE, V2_OK, 0, files, nr);
+        alog_bytes(nr);
+        break;
+    case LIST_CODE:
+        ev_list(s, &req);
+        break;
+    case MATCH_CODE:
+        log_debug("[match] match command received.", ev_log_path);
+        if (req.offset < 0 || (nr = match_dir(name, req.offset, files, MAX_BLOCK_SIZE - V2_HDR_SIZE, &count, ev_log_path)) < 0)
+        {
+            ev_v2_reply(s, MATCH_CODE, V2_ERROR, 0, NULL, 0);
+            break;
+        }
+        req.status = V2_OK;
+        req.size = count;
+        req.data = files;
+        req.len = nr;
+        ev_send(s, out, v2_pack(out, &req));
+        break;
+    case SUM_CODE:
+        //the file is read here and now, at several GB/s it holds the
+        //other sessions up for about as long as sending it would
+        log_debug("[sum] sum command received.", ev_log_path);
+        if ((nr = open(name, O_RDONLY)) < 0 || fstat(nr, &fst) < 0 || !S_ISREG(fst.st_mode))
+        {
+            if (nr >= 0)
+                close(nr);
+            ev_v2_reply(s, SUM_CODE, V2_NOT_FOUND, 0, NULL, 0);
+            break;
+        }
+        req.status = (crc32c_file(nr, 0, fst.st_size, &crc) < 0) ? V2_ERROR : V2_OK;
+        close(nr);
+        req.size = fst.st_size;
+        req.offset = (req.status == V2_OK) ? crc : 0;
+        req.len = 0;
+        alog_reply(req.status);
+        ev_send(s, out, v2_pack(out, &req));
+        break;
+    case STAT_CODE:
+        ev_stat(s);
+        break;
+    case CD_CODE:
+        log_debug("[CD] CD command received.", ev_log_path);
+        if (chdir(name) == 0 && (dirfd = open(".", O_RDONLY | O_DIRECTORY)) >= 0)
+        {
+            close(s->dirfd);
+            s->dirfd = dirfd;
+            ev_v2_reply(s, CD_CODE, V2_OK, 0, NULL, 0);
+        }
+        else
+        {
+            ev_v2_reply(s, CD_CODE, V2_ERROR, 0, NULL, 0);
+        }
+        break;
+    case BLK_CODE:
+        if ((nr = accept_bulk_size(req.size)) < 0)
+        {
+            ev_v2_reply(s, BLK_CODE, V2_ERROR, s->bulk_size, NULL, 0);
+            break;
+        }
+        s->bulk_size = nr;
+        ev_v2_reply(s, BLK_CODE, V2_OK, s->bulk_size, NULL, 0);
+        break;
+    case GET_CODE1:
+    case RANGE_CODE:
+        log_debug("[get] get command received.", ev_log_path);
+        if ((s->fd = open(name, O_RDONLY)) < 0 || fstat(s->fd, &fst) < 0 || !S_ISREG(fst.st_mode))
+        {
+            if (s->fd >= 0)
+                close(s->fd);
+            ev_v2_reply(s, req.op, V2_NOT_FOUND, 0, NULL, 0);
+            break;
+        }
+        //a GET is the range from its offset to the end of the file, a
+        //resumed one goes on only if the client has a prefix of the file
+        if (req.op == GET_CODE1)
+        {
+            if (req.offset < 0 || req.offset > fst.st_size ||
+                ((req.flags & V2_F_CHECK) && (crc32c_file(s->fd, 0, req.offset, &crc) < 0 || crc != (uint32_t)req.size)))
+            {
+                close(s->fd);
+                ev_v2_reply(s, GET_CODE1, V2_MISMATCH, fst.st_size, NULL, 0);
+                break;
+            }
+            req.size = fst.st_size - req.offset;
+        }
+        if (req.offset < 0 || req.offset > fst.st_size || req.size < 0)
+        {
+            close(s->fd);
+            ev_v2_reply(s, req.op, V2_ERROR, fst.st_size, NULL, 0);
+            break;
+        }
+        //the bulk frames follow the reply, sendfile() reads the slice in place
+        s->op = req.op;
+        s->start = s->total = req.offset;
+        s->fsize = fst.st_size;
+        if (req.size < s->fsize - s->start)
+            s->fsize = s->start + req.size;
+        s->fend = s->fsize;
+        s->fleft = 0;
+        s->v2 = 1;
+        s->crc = 0;
+        s->crcok = 1;
+        ev_v2_reply(s, req.op, V2_OK, fst.st_size, NULL, 0);
+        s->state = ST_GET_BULK;
+        break;
+    case PUT_CODE1:
+        log_debug("[put] put command received.", ev_log_path);
+        s->status = V2_OK;
+        s->ackcode = PUT_DONE;
+        s->fd = -1;
+        start = 0;
+        if (access(name, R_OK) == 0)
+            s->status = V2_CLASH;
+        else if ((s->fd = journal_open(name, req.size, req.flags & V2_F_RESUME, &start)) < 0)
+            s->status = V2_ERROR;
+        //a resumed upload is told where its data goes on, a refused one ends here
+        if (req.flags & V2_F_RESUME)
+        {
+            req.status = s->status;
+            req.flags = 0;
+            req.size = 0;
+            req.offset = start;
+            req.len = 0;
+            alog_reply(s->status);
+            ev_send(s, out, v2_pack(out, &req));
+            if (s->status != V2_OK)
+                break;
+        }
+        //otherwise the data is already on its way, a refused file is drained
+        free(s->name);
+        s->name = strdup(name);
+        s->fsize = req.size;
+        s->v2 = 1;
+        s->crc = 0;
+        s->crcok = 1;
+        s->start = s->total = s->committed = start;
+        s->fleft = 0;
+        s->state = ST_PUT_BULK;
+        break;
+    default:
+        ev_v2_reply(s, req.op, V2_UNSUPPORTED, 0, NULL, 0);
+        break;
+    }
+}
+
+//advance the state machine of a session by one complete frame
+static void ev_frame(struct session *s, char *buf, int len)
+{
+    char name[MAX_BLOCK_SIZE + 1];
+    unsigned short shortlen;
+    int fsize;
+
+    //every session has its own current directory
+    if (s->state != ST_PUT_DATA && s->state != ST_PUT_TRAILER)
+        fchdir(s->dirfd);
+
+    switch (s->state)
+    {
+    case ST_OPCODE:
+        //unknown op codes are ignored as serve_a_client() does
+        s->op = (len > 0) ? buf[0] : 0;
+        if (s->op == V2_CODE)
+            alog_begin(len > 1 ? buf[1] : 0, 2);
+        else
+            alog_begin(s->op, 1);
+        if (s->op == V2_CODE)
+            ev_v2(s, buf, len);
+        else if (s->op == PWD_CODE)
+            ev_pwd(s);
+        else if (s->op == DIR_CODE)
+            ev_dir(s);
+        else if (s->op == GET_CODE1 || s->op == GET_BULK_CODE || s->op == PUT_CODE1 || s->op == CD_CODE)
+            s->state = ST_NAMELEN;
+        else if (s->op == BLK_CODE)
+            s->state = ST_BLK_SIZE;
+        break;
+    case ST_NAMELEN:
+        shortlen = 0;
+        memcpy(&shortlen, buf, len < 2 ? len : 2);
+        s->namelen = ntohs(shortlen);
+        s->state = ST_NAME;
+        break;
+    case ST_NAME:
+        if (s->namelen > len)
+            s->namelen = len;
+        memcpy(name, buf, s->namelen);
+        name[s->namelen] = '\0';
+        alog_name(name, s->namelen);
+        s->state = ST_OPCODE;
+        if (s->op == CD_CODE)
+            ev_cd(s, name);
+        else if (s->op == GET_CODE1 || s->op == GET_BULK_CODE)
+            ev_get(s, name);
+        else
+            ev_put(s, name);
+        break;
+    case ST_PUT_CODE2:
+        s->bulk = (len > 0 && buf[0] == PUT_BULK_CODE2);
+        s->state = ST_PUT_SIZE;
+        break;
+    case ST_PUT_SIZE:
+        fsize = 0;
+        memcpy(&fsize, buf, len < 4 ? len : 4);
+        s->fsize = (int)ntohl(fsize);
+        s->start = s->total = s->committed = 0;
+        s->nblocks = (s->fsize <= 0) ? 1 : (int)((s->fsize + MAX_BLOCK_SIZE - 1) / MAX_BLOCK_SIZE);
+        s->ackcode = PUT_DONE;
+        if ((s->fd = journal_open(s->name, s->fsize, 0, &s->start)) < 0)
+        {
+            s->ackcode = PUT_FAIL;
+            log_error("[put] put failed.", ev_log_path);
+        }
+        s->state = ST_PUT_DATA;
+        if (s->bulk)
+        {
+            s->fleft = 0;
+            s->state = ST_PUT_BULK;
+        }
+        break;
+    case ST_BLK_SIZE:
+        ev_blk(s, buf, len);
+        break;
+    case ST_PUT_DATA:
+        ev_put_block(s, buf, len);
+        break;
+    case ST_PUT_TRAILER:
+        ev_put_trailer(s, buf, len);
+        break;
+    }
+    //a command that is not sending or receiving data is over
+    if (s->state == ST_OPCODE)
+        alog_end();
+}
+
+//handle every complete frame in the input buffer
+static int ev_process(struct session *s)
+{
+    unsigned short data_size;
+    uint32_t bulk_size;
+    int len, used = 0;
+
+    //frames pipelined behind a GET wait until its blocks are queued
+    while (!SENDING(s) && s->inlen - used > 0)
+    {
+        //PUT data comes in bulk frames
+        if (s->state == ST_PUT_BULK && s->fleft == 0)
+        {
+            if (s->inlen - used < 4)
+                break;
+            memcpy(&bulk_size, s->in + used, 4);
+            used += 4;
+            s->fleft = ntohl(bulk_size);
+            if (s->fleft > MAX_BULK_SIZE || s->fleft < 0)
+                return -1; //protocol error
+            //a frame over the agreed size fails the file, it is drained like the rest
+            if (s->fleft > s->bulk_size && s->fd >= 0)
+            {
+                log_error("[put] frame larger than the block size.", ev_log_path);
+                s->ackcode = PUT_FAIL;
+                close(s->fd);
+                s->fd = -1;
+            }
+            if (s->fleft == 0 && s->v2)
+                s->state = ST_PUT_TRAILER;
+            else if (s->fleft == 0)
+                ev_put_done(s);
+            continue;
+        }
+        if (s->state == ST_PUT_BULK)
+        {
+            len = s->inlen - used;
+            if (len > s->fleft)
+                len = s->fleft;
+            ev_put_write(s, s->in + used, len);
+            s->fleft -= len;
+            used += len;
+            continue;
+        }
+        if (s->inlen - used < 2)
+            break;
+        memcpy(&data_size, s->in + used, 2);
+        len = ntohs(data_size);
+        if (len > MAX_BLOCK_SIZE)
+            return -1; //protocol error
+        if (s->inlen - used < len + 2)
+            break;
+        ev_frame(s, s->in + used + 2, len);
+        used += len + 2;
+    }
+    memmove(s->in, s->in + used, s->inlen - used);
+    s->inlen -= used;
+    return 0;
+}
+
+//read what the client sent, -1 once the session is over
+static int ev_read(struct session *s)
+{
+    int nr;
+
+    while (s->inlen < (int)sizeof(s->in))
+    {
+        //bulk PUT payload goes to the file without passing through the buffer
+        if (s->state == ST_PUT_BULK && s->fleft > 0 && s->inlen == 0 && s->fd >= 0 && evpipe[0] >= 0 && !s->nosplice)
+        {
+            if (ev_put_splice(s) < 0)
+                return -1;
+            if (s->fleft > 0 && s->fd >= 0 && evpipe[0] >= 0 && !s->nosplice)
+                break; //socket is drained
+            continue;
+        }
+        nr = read(s->sd, s->in + s->inlen, sizeof(s->in) - s->inlen);
+        if (nr == 0)
+            return -1;
+        if (nr < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            return -1;
+        }
+        s->inlen += nr;
+        if (ev_process(s) < 0)
+            return -1;
+        //stop reading while the client is not reading our replies
+        if (SENDING(s) || s->outlen - s->outpos >= EV_OUT_HIGH)
+            break;
+    }
+    return 0;
+}
+
+static int ev_write(struct session *s)
+{
+    while (1)
+    {
+        if (s->state == ST_GET_DATA)
+            ev_get_blocks(s);
+        if (s->state == ST_LIST_DATA)
+            ev_list_frames(s);
+        if (ev_flush(s) < 0)
+            return -1;
+        if (s->outlen > 0)
+            return 0; //socket is full
+        if (s->state == ST_GET_BULK)
+        {
+            if (ev_get_bulk(s) < 0)
+                return -1;
+            if (s->state == ST_GET_BULK && s->outlen == 0)
+                return 0; //socket is full
+        }
+        if (SENDING(s))
+            continue;
+        //the GET is done, serve any frames that arrived meanwhile
+        if (ev_process(s) < 0)
+            return -1;
+        if (!SENDING(s) && s->outlen == 0)
+            return 0;
+    }
+}
+
+//register interest in what the session is waiting for
+static void ev_update(struct session *s)
+{
+    struct epoll_event ev;
+    int events = 0;
+
+    if (!SENDING(s) && s->outlen - s->outpos < EV_OUT_HIGH)
+        events |= EPOLLIN;
+    if (s->outlen > 0 || SENDING(s))
+        events |= EPOLLOUT;
+    if (events == s->events)
+        return;
+    ev.events = events;
+    ev.data.ptr = s;
+    epoll_ctl(epfd, EPOLL_CTL_MOD, s->sd, &ev);
+    s->events = events;
+}
+
+static void ev_close(struct session *s)
+{
+    epoll_ctl(epfd, EPOLL_CTL_DEL, s->sd, NULL);
+    close(s->sd);
+    close(s->dirfd);
+    if (s->list != NULL)
+    {
+        ev_list_drop(s, 0);
+    }
+    else if (SENDING(s) || s->state == ST_PUT_DATA || s->state == ST_PUT_BULK || s->state == ST_PUT_TRAILER)
+    {
+        //a dropped upload keeps what is on disk for a resume
+        if (!SENDING(s) && (!s->v2 || s->status == V2_OK))
+            ev_put_commit(s, 1);
+        if (s->fd >= 0)
+            close(s->fd);
+    }
+    metrics_session(-1);
+    //a command cut off by the client failed
+    alog_cur = &s->alog;
+    if (s->alog.op != 0)
+    {
+        alog_fail();
+        alog_end();
+    }
+    alog_cur = NULL;
+    free(s->name);
+    free(s->out);
+    free(s);
+    log_file("Client terminated session.\n", ev_log_path);
+}
+
+//accept every pending client of the listening socket
+static void ev_accept(int sd, int homefd)
+{
+    struct sockaddr_in cli_addr;
+    socklen_t cli_addrlen;
+    struct epoll_event ev;
+    struct session *s;
+    int nsd, on;
+
+    while (1)
+    {
+        cli_addrlen = sizeof(cli_addr);
+        nsd = accept4(sd, (struct sockaddr *)&cli_addr, &cli_addrlen, SOCK_NONBLOCK);
+        if (nsd < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                perror("server:accept");
+            return;
+        }
+        if ((s = calloc(1, sizeof(struct session))) == NULL)
+        {
+            close(nsd);
+            continue;
+        }
+        //output is queued per session, small frames go out at once
+        on = 1;
+        setsockopt(nsd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        s->sd = nsd;
+        s->fd = -1;
+        s->bulk_size = DEF_BULK_SIZE;
+        s->state = ST_OPCODE;
+        s->events = EPOLLIN;
+        alog_session(&s->alog, nsd);
+        //every session starts in the initial directory of the server
+        if ((s->dirfd = dup(homefd)) < 0)
+        {
+            close(nsd);
+            free(s);
+            continue;
+        }
+        ev.events = EPOLLIN;
+        ev.data.ptr = s;
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, nsd, &ev) < 0)
+        {
+            close(s->dirfd);
+            close(nsd);
+            free(s);
+            continue;
+        }
+        metrics_session(1);
+        log_file("Client start session.", ev_log_path);
+    }
+}
+
+//one event loop, returns only on a fatal error
+static void ev_loop(int sd, int exclusive)
+{
+    struct epoll_event ev, events[EV_MAX_EVENTS];
+    struct session *s;
+    int i, n, homefd;
+
+    if ((homefd = open(".", O_RDONLY | O_DIRECTORY)) < 0 || (epfd = epoll_create1(0)) < 0)
+    {
+        perror("server:epoll");
+        return;
+    }
+    if (pipe2(evpipe, O_CLOEXEC) == 0)
+        fcntl(evpipe[1], F_SETPIPE_SZ, EV_PIPE_SIZE); //best effort
+    ev.events = EPOLLIN;
+#ifdef EPOLLEXCLUSIVE
+    //only wake one of the loops sharing the listening socket
+    if (exclusive)
+        ev.events |= EPOLLEXCLUSIVE;
+#endif
+    ev.data.ptr = NULL;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, sd, &ev) < 0)
+    {
+        perror("server:epoll_ctl");
+        return;
+    }
+
+    while (1)
+    {
+        //wake up when the lines held back by the log are due
+        if ((n = epoll_wait(epfd, events, EV_MAX_EVENTS, log_due())) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("server:epoll_wait");
+            return;
+        }
+        log_tick();
+        for (i = 0; i < n; i++)
+        {
+            if ((s = events[i].data.ptr) == NULL)
+            {
+                ev_accept(sd, homefd);
+                continue;
+            }
+            alog_cur = &s->alog;
+            if ((events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && ev_read(s) < 0)
+            {
+                ev_close(s);
+                continue;
+            }
+            if (ev_write(s) < 0)
+            {
+                ev_close(s);
+                continue;
+            }
+            ev_update(s);
+        }
+    }
+}
+
+void ev_serve(int sd, char *log_path, int nloops)
+{
+    struct sigaction act;
+    struct rlimit rl;
+    pid_t pid;
+    int i;
+
+    ev_log_path = log_path;
+
+    //a client closing early must not kill every other session
+    act.sa_handler = SIG_IGN;
+    sigemptyset(&act.sa_mask);
+    act.sa_flags = 0;
+    sigaction(SIGPIPE, &act, NULL);
+
+    //each session holds a socket and a directory descriptor
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max)
+    {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    fcntl(sd, F_SETFL, fcntl(sd, F_GETFL) | O_NONBLOCK);
+    if (nloops == 0)
+        nloops = sysconf(_SC_NPROCESSORS_ONLN);
+    if (nloops <= 1)
+    {
+        ev_loop(sd, 0);
+        return;
+    }
+
+    //the parent reaps its own loops, the zombie handler would steal them
+    act.sa_handler = SIG_DFL;
+    sigaction(SIGCHLD, &act, NULL);
+
+    //one loop process per cpu, all accepting on the same socket
+    for (i = 0; i < nloops; i++)
+    {
+        pid = fork();
+        if (pid < 0)
+        {
+            perror("fork");
+            break;
+        }
+        if (pid == 0)
+        {
+            log_child();
+            ev_loop(sd, 1);
+            exit(1);
+        }
+    }
+    //parent stays until every loop is gone, the metrics process aside
+    while (i > 0)
+    {
+        if ((pid = wait(NULL)) < 0 && errno != EINTR)
+            break;
+        if (pid > 0 && !metrics_proc(pid))
+            i--;
+    }
+}
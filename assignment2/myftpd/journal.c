@@ -0,0 +1,100 @@
+/**
+ * file:        journal.c
+ * Author:      Seow Wei Cheng (33753618) and Jin Min Seok (33884206)
+ * Date:        17/10/2026 (version 1)
+ * Purpose:     Journaled uploads shared by every engine of the server.
+ *              An upload of name is written to .name.part next to it and
+ *              the offset up to which the part file is safely on disk is
+ *              kept in .name.journal. A dropped upload can go on from that
+ *              offset, and only a complete one is renamed to name, so the
+ *              clash check of PUT only ever sees finished files. The dot
+ *              also keeps both files out of the DIR listing.
+ */
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "myftpd.h"
+
+//size and committed offset, fixed width so a commit overwrites in place
+#define JOURNAL_FMT "%020lld %020lld\n"
+#define JOURNAL_LEN 42
+
+//build the path of the hidden sidecar of name with suffix
+static void journal_path(char *path, char *name, char *suffix)
+{
+    char *base = strrchr(name, '/');
+
+    if (base == NULL)
+        snprintf(path, PATH_MAX, ".%s%s", name, suffix);
+    else
+        snprintf(path, PATH_MAX, "%.*s/.%s%s", (int)(base - name), name, base + 1, suffix);
+}
+
+int journal_open(char *name, off_t size, int resume, off_t *offset)
+{
+    char part[PATH_MAX], jpath[PATH_MAX], buf[JOURNAL_LEN + 1];
+    long long jsize, joffset;
+    struct stat fst;
+    int fd, jfd;
+
+    *offset = 0;
+    journal_path(part, name, ".part");
+    journal_path(jpath, name, ".journal");
+    //an upload goes on only with the same size and its data still there
+    if (resume && (jfd = open(jpath, O_RDONLY)) >= 0)
+    {
+        if (pread(jfd, buf, JOURNAL_LEN, 0) == JOURNAL_LEN)
+        {
+            buf[JOURNAL_LEN] = '\0';
+            if (sscanf(buf, "%lld %lld", &jsize, &joffset) == 2 && jsize == size && joffset >= 0 && joffset <= size)
+                *offset = joffset;
+        }
+        close(jfd);
+    }
+    if ((fd = open(part, O_RDWR | O_CREAT, 0666)) < 0)
+        return -1;
+    if (*offset > 0 && (fstat(fd, &fst) < 0 || fst.st_size < *offset))
+        *offset = 0;
+    //no journal means no progress yet, small uploads then never sync
+    if (*offset == 0 && ((unlink(jpath) < 0 && errno != ENOENT) || ftruncate(fd, 0) < 0))
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int journal_commit(char *name, int fd, off_t size, off_t offset)
+{
+    char jpath[PATH_MAX], buf[JOURNAL_LEN + 1];
+    int jfd, ret = 0;
+
+    //the data goes to disk first, the journal never points past it
+    if (fdatasync(fd) < 0)
+        return -1;
+    journal_path(jpath, name, ".journal");
+    if ((jfd = open(jpath, O_WRONLY | O_CREAT, 0666)) < 0)
+        return -1;
+    snprintf(buf, sizeof(buf), JOURNAL_FMT, (long long)size, (long long)offset);
+    if (pwrite(jfd, buf, JOURNAL_LEN, 0) != JOURNAL_LEN || fdatasync(jfd) < 0)
+        ret = -1;
+    close(jfd);
+    return ret;
+}
+
+int journal_finish(char *name, int fd, off_t size)
+{
+    char part[PATH_MAX], jpath[PATH_MAX];
+
+    journal_path(part, name, ".part");
+    journal_path(jpath, name, ".journal");
+    if (ftruncate(fd, size) < 0 || rename(part, name) < 0)
+        return -1;
+    unlink(jpath);
+    return 0;
+}
@@ -0,0 +1,337 @@
+/**
+ * file:        logger.c
+ * Author:      Seow Wei Cheng (33753618) and Jin Min Seok (33884206)
+ * Date:        17/10/2026 (version 2)
+ * Purpose:     Logs of the server. The log file and the access log are
+ *              opened once, before any process is forked, and every process
+ *              collects its lines in buffers of its own. A buffer is written
+ *              with one write() when it fills up, when its oldest line is
+ *              LOG_FLUSH_SECS old, on an error line, at the end of a session
+ *              and at exit. The files are opened with O_APPEND so the writes
+ *              of several processes land whole, one after the other.
+ *              Lines above the level set with -l are dropped before they
+ *              are formatted, lines above LOG_MAX_LEVEL are not even
+ *              compiled in (see log_at() in myftpd.h).
+ *              The access log has one JSON object per line for every command
+ *              served, see alog_end(). The same record feeds the counters of
+ *              metrics.c.
+ */
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "../netprotocol.h"
+#include "myftpd.h"
+
+#define LOG_BUF_SIZE (1024 * 16) //lines a process holds back per file
+#define LOG_FLUSH_SECS 1         //longest a line is held back
+
+//a file and the lines held back for it
+struct log_sink
+{
+    int on;            //0 if the file is not written
+    int fd;
+    char buf[LOG_BUF_SIZE];
+    int len;
+    time_t oldest;     //when the first line of the buffer came
+};
+
+int log_level = LOG_LV_INFO;
+struct alog *alog_cur = NULL;
+
+static struct log_sink log_text;
+static struct log_sink log_access;
+static time_t log_sec = -1;  //second the stamp was made for
+static char log_stamp[64];   //"pid date : " ahead of every line
+static int log_stamplen;
+
+static int log_sink_open(struct log_sink *k, char *path)
+{
+    if ((k->fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644)) < 0)
+        return -1;
+    k->on = 1;
+    return 0;
+}
+
+static void log_sink_flush(struct log_sink *k)
+{
+    int nw, n = 0;
+
+    while (n < k->len)
+    {
+        if ((nw = write(k->fd, k->buf + n, k->len - n)) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            break; //the lines are lost, the server goes on
+        }
+        n += nw;
+    }
+    k->len = 0;
+}
+
+//room for len more bytes in the buffer of k, len is cut to what fits at all
+static int log_sink_room(struct log_sink *k, int len, time_t now)
+{
+    if (k->len + len > LOG_BUF_SIZE)
+        log_sink_flush(k);
+    if (k->len == 0)
+        k->oldest = now;
+    return len > LOG_BUF_SIZE ? LOG_BUF_SIZE : len;
+}
+
+static int log_sink_due(struct log_sink *k, struct timespec *ts)
+{
+    long long ms;
+
+    if (k->len == 0)
+        return -1;
+    ms = (long long)(k->oldest + LOG_FLUSH_SECS - ts->tv_sec) * 1000 - ts->tv_nsec / 1000000;
+    return ms > 0 ? (int)ms : 0;
+}
+
+int log_open(char *log_path, char *alog_path, int level)
+{
+    log_level = level;
+    if (log_sink_open(&log_text, log_path) < 0)
+        return -1;
+    log_sink_open(&log_access, alog_path);
+    atexit(log_flush);
+    return 0;
+}
+
+void log_write(int level, char *message)
+{
+    time_t now = time(NULL);
+    struct tm tm;
+    char timearr[32];
+    int len;
+
+    if (!log_text.on)
+        return;
+    //the stamp only changes once a second
+    if (now != log_sec)
+    {
+        localtime_r(&now, &tm);
+        strftime(timearr, sizeof(timearr), "%b %d %H:%M", &tm);
+        log_stamplen = snprintf(log_stamp, sizeof(log_stamp), "%d %s : ", (int)getpid(), timearr);
+        log_sec = now;
+    }
+    len = log_sink_room(&log_text, log_stamplen + strlen(message) + 1, now) - log_stamplen - 1;
+    memcpy(log_text.buf + log_text.len, log_stamp, log_stamplen);
+    log_text.len += log_stamplen;
+    memcpy(log_text.buf + log_text.len, message, len);
+    log_text.len += len;
+    log_text.buf[log_text.len++] = '\n';
+    if (level == LOG_LV_ERROR || now - log_text.oldest >= LOG_FLUSH_SECS)
+        log_flush();
+}
+
+void log_flush(void)
+{
+    log_sink_flush(&log_text);
+    log_sink_flush(&log_access);
+}
+
+int log_due(void)
+{
+    struct timespec ts;
+    int a, b;
+
+    if (log_text.len == 0 && log_access.len == 0)
+        return -1;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    a = log_sink_due(&log_text, &ts);
+    b = log_sink_due(&log_access, &ts);
+    return (a < 0 || (b >= 0 && b < a)) ? b : a;
+}
+
+void log_tick(void)
+{
+    time_t now = time(NULL);
+
+    if (log_text.len > 0 && now - log_text.oldest >= LOG_FLUSH_SECS)
+        log_sink_flush(&log_text);
+    if (log_access.len > 0 && now - log_access.oldest >= LOG_FLUSH_SECS)
+        log_sink_flush(&log_access);
+}
+
+void log_child(void)
+{
+    //the parent still holds these lines and writes them itself
+    log_text.len = 0;
+    log_access.len = 0;
+    log_sec = -1;
+}
+
+//microseconds since the epoch
+static long long alog_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void alog_session(struct alog *a, int sd)
+{
+    struct sockaddr_in addr;
+    socklen_t addrlen = sizeof(addr);
+
+    memset(a, 0, sizeof(struct alog));
+    if (getpeername(sd, (struct sockaddr *)&addr, &addrlen) == 0 && addr.sin_family == AF_INET)
+    {
+        inet_ntop(AF_INET, &addr.sin_addr, a->client, sizeof(a->client));
+        snprintf(a->client + strlen(a->client), sizeof(a->client) - strlen(a->client), ":%d", ntohs(addr.sin_port));
+    }
+}
+
+void alog_begin(char op, int proto)
+{
+    if (alog_cur == NULL)
+        return;
+    alog_cur->op = op;
+    alog_cur->proto = proto;
+    alog_cur->status = V2_OK;
+    alog_cur->name[0] = '\0';
+    alog_cur->bytes = 0;
+    alog_cur->start = alog_now();
+    alog_cur->first = 0;
+}
+
+void alog_name(char *name, int len)
+{
+    if (alog_cur == NULL)
+        return;
+    if (len >= ALOG_NAME_MAX)
+        len = ALOG_NAME_MAX - 1;
+    memcpy(alog_cur->name, name, len);
+    alog_cur->name[len] = '\0';
+}
+
+void alog_first(void)
+{
+    if (alog_cur != NULL && alog_cur->op != 0 && alog_cur->first == 0)
+        alog_cur->first = alog_now();
+}
+
+void alog_reply(char status)
+{
+    alog_first();
+    if (alog_cur != NULL && status != V2_OK)
+        alog_cur->status = status;
+}
+
+void alog_fail(void)
+{
+    if (alog_cur != NULL && alog_cur->status == V2_OK)
+        alog_cur->status = V2_ERROR;
+}
+
+void alog_bytes(long long bytes)
+{
+    if (alog_cur != NULL && bytes > 0)
+        alog_cur->bytes += bytes;
+}
+
+char *alog_opname(char op)
+{
+    switch (op)
+    {
+    case PUT_CODE1: return "put";
+    case GET_CODE1: return "get";
+    case GET_BULK_CODE: return "get";
+    case PWD_CODE: return "pwd";
+    case DIR_CODE: return "dir";
+    case CD_CODE: return "cd";
+    case BLK_CODE: return "blk";
+    case MUX_CODE: return "mux";
+    case RANGE_CODE: return "range";
+    case MATCH_CODE: return "match";
+    case TREE_GET_CODE: return "tree_get";
+    case TREE_PUT_CODE: return "tree_put";
+    case COMP_CODE: return "comp";
+    case DELTA_CODE: return "delta";
+    case SUM_CODE: return "sum";
+    case LIST_CODE: return "list";
+    case STAT_CODE: return "stat";
+    default: return "unknown";
+    }
+}
+
+char *alog_result(char status)
+{
+    switch (status)
+    {
+    case V2_OK: return "ok";
+    case V2_NOT_FOUND: return "not_found";
+    case V2_CLASH: return "clash";
+    case V2_UNSUPPORTED: return "unsupported";
+    case V2_MISMATCH: return "mismatch";
+    default: return "error";
+    }
+}
+
+//copy s into out as the inside of a JSON string, returns the length
+static int alog_escape(char *out, char *s)
+{
+    int n = 0;
+
+    for (; *s != '\0'; s++)
+    {
+        if (*s == '"' || *s == '\\')
+        {
+            out[n++] = '\\';
+            out[n++] = *s;
+        }
+        else if ((unsigned char)*s < 0x20)
+        {
+            n += sprintf(out + n, "\\u%04x", (unsigned char)*s);
+        }
+        else
+        {
+            out[n++] = *s;
+        }
+    }
+    out[n] = '\0';
+    return n;
+}
+
+void alog_end(void)
+{
+    char name[ALOG_NAME_MAX * 6];
+    char line[ALOG_NAME_MAX * 6 + 256];
+    struct alog *a = alog_cur;
+    long long now;
+    int len;
+
+    if (a == NULL || a->op == 0)
+        return;
+    now = alog_now();
+    metrics_command(a->op, a->status, a->bytes, now - a->start, a->first ? a->first - a->start : -1);
+    if (log_access.on)
+    {
+        alog_escape(name, a->name);
+        len = snprintf(line, sizeof(line),
+                       "{\"client\":\"%s\",\"proto\":%d,\"op\":\"%s\",\"file\":\"%s\",\"bytes\":%lld,"
+                       "\"start\":%lld.%06lld,\"us\":%lld,\"ttfb_us\":%lld,\"result\":\"%s\"}\n",
+                       a->client, a->proto, alog_opname(a->op), name, a->bytes,
+                       a->start / 1000000, a->start % 1000000, now - a->start,
+                       a->first ? a->first - a->start : -1LL, alog_result(a->status));
+        if (len >= (int)sizeof(line))
+            len = sizeof(line) - 1;
+        len = log_sink_room(&log_access, len, now / 1000000);
+        memcpy(log_access.buf + log_access.len, line, len);
+        log_access.len += len;
+        if (now / 1000000 - log_access.oldest >= LOG_FLUSH_SECS)
+            log_sink_flush(&log_access);
+    }
+    a->op = 0;
+}
@@ -0,0 +1,336 @@
+/**
+ * file:        metrics.c
+ * Author:      Seow Wei Cheng (33753618) and Jin Min Seok (33884206)
+ * Date:        17/10/2026 (version 1)
+ * Purpose:     Counters and latency histograms of the server, shared by every
+ *              process of the server. They live in a shared anonymous mapping
+ *              made before any fork, like the DIR cache, so the children of
+ *              the fork engine, the prefork workers and the epoll loops all
+ *              add to the same numbers.
+ *              A command is counted once, when it is over (see alog_end()),
+ *              never per block of a transfer. The transfers of a mux session
+ *              count under GET and PUT like any other, the session itself
+ *              under MUX with no bytes. Every count is a relaxed atomic
+ *              add, no process ever waits for another; a reader may see a
+ *              command in one series before it shows in the next.
+ *              The numbers are written as Prometheus text by metrics_text(),
+ *              served to v2 clients by STAT_CODE and to local tools by a small
+ *              process listening on a Unix socket: every connection gets the
+ *              text and is closed (e.g. nc -U .myftpd.sock).
+ */
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/prctl.h>
+#include "../netprotocol.h"
+#include "myftpd.h"
+
+#define METRICS_BUCKETS 25 //histogram bounds of 1us to 2^24us (16.8s), one more above
+#define METRICS_RESULTS 6  //outcomes, one per V2_ status
+
+//op codes counted, the last slot takes every other op code
+static char metrics_codes[] = {PWD_CODE, DIR_CODE, LIST_CODE, CD_CODE, GET_CODE1, PUT_CODE1, RANGE_CODE,
+                               MATCH_CODE, SUM_CODE, BLK_CODE, COMP_CODE, DELTA_CODE, TREE_GET_CODE,
+                               TREE_PUT_CODE, MUX_CODE, STAT_CODE};
+#define METRICS_OPS (sizeof(metrics_codes) + 1)
+
+//numbers of one op code, a cache line of its own so processes serving
+//different commands do not write to the same line
+struct metrics_op
+{
+    unsigned long long results[METRICS_RESULTS];
+    unsigned long long bytes;
+    unsigned long long us_sum;
+    unsigned long long ttfb_sum;
+    unsigned long long ttfb_count;
+    unsigned long long us[METRICS_BUCKETS + 1];
+    unsigned long long ttfb[METRICS_BUCKETS + 1];
+} __attribute__((aligned(64)));
+
+struct metrics
+{
+    long long active;            //sessions being served
+    unsigned long long sessions; //sessions started
+    time_t started;              //when the server started
+    struct metrics_op op[METRICS_OPS];
+};
+
+static struct metrics *mt = NULL;
+static unsigned char metrics_slot[128]; //slot of every op code
+static pid_t metrics_pid = -1;          //process of the socket
+
+//answer every connection to the listening socket ld with the text
+static void metrics_serve(int ld)
+{
+    struct sigaction act;
+    struct timeval tv = {1, 0};
+    char *text;
+    int cd, len, nw, n;
+
+    //a reader going away must not end the process
+    act.sa_handler = SIG_IGN;
+    sigemptyset(&act.sa_mask);
+    act.sa_flags = 0;
+    sigaction(SIGPIPE, &act, NULL);
+    //nor may it outlive the server
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+    if ((text = malloc(METRICS_TEXT_MAX)) == NULL)
+        exit(1);
+    while (1)
+    {
+        if ((cd = accept(ld, NULL, NULL)) < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            exit(1);
+        }
+        //a reader that does not read is given up on
+        setsockopt(cd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+        len = metrics_text(text, METRICS_TEXT_MAX);
+        for (n = 0; n < len; n += nw)
+        {
+            if ((nw = write(cd, text + n, len - n)) < 0)
+            {
+                if (errno == EINTR)
+                {
+                    nw = 0;
+                    continue;
+                }
+                break;
+            }
+        }
+        close(cd);
+    }
+}
+
+int metrics_init(char *sock_path)
+{
+    struct sockaddr_un addr;
+    unsigned int i;
+    int ld;
+
+    mt = mmap(NULL, sizeof(struct metrics), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (mt == MAP_FAILED)
+    {
+        mt = NULL;
+        return -1;
+    }
+    mt->started = time(NULL);
+    memset(metrics_slot, METRICS_OPS - 1, sizeof(metrics_slot));
+    for (i = 0; i < sizeof(metrics_codes); i++)
+        metrics_slot[(unsigned char)metrics_codes[i]] = i;
+    //a GET with bulk frames is a GET
+    metrics_slot[GET_BULK_CODE] = metrics_slot[GET_CODE1];
+    if (sock_path == NULL || sock_path[0] == '\0')
+        return 0;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(sock_path) >= sizeof(addr.sun_path))
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(addr.sun_path, sock_path);
+    if ((ld = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+        return -1;
+    //the socket of an earlier run is in the way
+    unlink(sock_path);
+    if (bind(ld, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(ld, 16) < 0)
+    {
+        close(ld);
+        return -1;
+    }
+    if ((metrics_pid = fork()) < 0)
+    {
+        close(ld);
+        return -1;
+    }
+    if (metrics_pid == 0)
+    {
+        log_child();
+        metrics_serve(ld);
+    }
+    close(ld);
+    return 0;
+}
+
+int metrics_proc(pid_t pid)
+{
+    return pid > 0 && pid == metrics_pid;
+}
+
+void metrics_session(int delta)
+{
+    if (mt == NULL)
+        return;
+    __atomic_add_fetch(&mt->active, delta, __ATOMIC_RELAXED);
+    if (delta > 0)
+        __atomic_add_fetch(&mt->sessions, 1, __ATOMIC_RELAXED);
+}
+
+//histogram bucket of us microseconds: the first bound 2^k that is not below it
+static int metrics_bucket(long long us)
+{
+    int k;
+
+    if (us <= 1)
+        return 0;
+    k = 64 - __builtin_clzll((unsigned long long)(us - 1));
+    return k > METRICS_BUCKETS ? METRICS_BUCKETS : k;
+}
+
+void metrics_command(char op, char status, long long bytes, long long us, long long ttfb)
+{
+    struct metrics_op *m;
+    int r;
+
+    if (mt == NULL)
+        return;
+    m = &mt->op[metrics_slot[(unsigned char)op & 127]];
+    r = status - V2_OK;
+    if (r < 0 || r >= METRICS_RESULTS)
+        r = V2_ERROR - V2_OK;
+    if (us < 0)
+        us = 0;
+    __atomic_add_fetch(&m->results[r], 1, __ATOMIC_RELAXED);
+    if (bytes > 0)
+        __atomic_add_fetch(&m->bytes, bytes, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&m->us_sum, us, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&m->us[metrics_bucket(us)], 1, __ATOMIC_RELAXED);
+    if (ttfb >= 0)
+    {
+        __atomic_add_fetch(&m->ttfb_sum, ttfb, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&m->ttfb_count, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&m->ttfb[metrics_bucket(ttfb)], 1, __ATOMIC_RELAXED);
+    }
+}
+
+//text being built, cut at its size
+struct metrics_out
+{
+    char *buf;
+    int size;
+    int len;
+};
+
+static void metrics_put(struct metrics_out *o, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+static void metrics_put(struct metrics_out *o, const char *fmt, ...)
+{
+    va_list ap;
+    int n;
+
+    if (o->len >= o->size - 1)
+        return;
+    va_start(ap, fmt);
+    n = vsnprintf(o->buf + o->len, o->size - o->len, fmt, ap);
+    va_end(ap);
+    o->len = (n < 0 || o->len + n >= o->size) ? o->size - 1 : o->len + n;
+}
+
+static unsigned long long metrics_get(unsigned long long *v)
+{
+    return __atomic_load_n(v, __ATOMIC_RELAXED);
+}
+
+//one histogram of the op named name, buckets b, sum in microseconds
+static void metrics_histogram(struct metrics_out *o, char *metric, char *name, unsigned long long *b,
+                              unsigned long long sum)
+{
+    unsigned long long count = 0;
+    int k;
+
+    for (k = 0; k < METRICS_BUCKETS; k++)
+    {
+        count += metrics_get(&b[k]);
+        metrics_put(o, "%s_bucket{op=\"%s\",le=\"%.6f\"} %llu\n", metric, name, (double)(1LL << k) / 1e6, count);
+    }
+    count += metrics_get(&b[METRICS_BUCKETS]);
+    metrics_put(o, "%s_bucket{op=\"%s\",le=\"+Inf\"} %llu\n", metric, name, count);
+    metrics_put(o, "%s_sum{op=\"%s\"} %.6f\n", metric, name, sum / 1e6);
+    metrics_put(o, "%s_count{op=\"%s\"} %llu\n", metric, name, count);
+}
+
+//name of the op codes of slot i
+static char *metrics_opname(unsigned int i)
+{
+    return i < sizeof(metrics_codes) ? alog_opname(metrics_codes[i]) : "other";
+}
+
+//commands of the op codes of slot i
+static unsigned long long metrics_count(struct metrics_op *m)
+{
+    unsigned long long n = 0;
+    int r;
+
+    for (r = 0; r < METRICS_RESULTS; r++)
+        n += metrics_get(&m->results[r]);
+    return n;
+}
+
+int metrics_text(char *buf, int size)
+{
+    struct metrics_out o = {buf, size, 0};
+    struct metrics_op *m;
+    unsigned int i;
+    int r;
+
+    if (mt == NULL)
+        return 0;
+    metrics_put(&o, "# HELP myftpd_start_time_seconds When the server started, seconds since the epoch.\n"
+                    "# TYPE myftpd_start_time_seconds gauge\n"
+                    "myftpd_start_time_seconds %lld\n", (long long)mt->started);
+    metrics_put(&o, "# HELP myftpd_sessions_active Sessions being served.\n"
+                    "# TYPE myftpd_sessions_active gauge\n"
+                    "myftpd_sessions_active %lld\n", __atomic_load_n(&mt->active, __ATOMIC_RELAXED));
+    metrics_put(&o, "# HELP myftpd_sessions_total Sessions started.\n"
+                    "# TYPE myftpd_sessions_total counter\n"
+                    "myftpd_sessions_total %llu\n", metrics_get(&mt->sessions));
+    //series of op codes never served are left out
+    metrics_put(&o, "# HELP myftpd_commands_total Commands served, by outcome.\n"
+                    "# TYPE myftpd_commands_total counter\n");
+    for (i = 0; i < METRICS_OPS; i++)
+    {
+        for (r = 0; r < METRICS_RESULTS; r++)
+        {
+            if (metrics_get(&mt->op[i].results[r]) > 0)
+                metrics_put(&o, "myftpd_commands_total{op=\"%s\",result=\"%s\"} %llu\n", metrics_opname(i),
+                            alog_result(V2_OK + r), metrics_get(&mt->op[i].results[r]));
+        }
+    }
+    metrics_put(&o, "# HELP myftpd_bytes_total File data and listings moved.\n"
+                    "# TYPE myftpd_bytes_total counter\n");
+    for (i = 0; i < METRICS_OPS; i++)
+    {
+        if (metrics_count(&mt->op[i]) > 0)
+            metrics_put(&o, "myftpd_bytes_total{op=\"%s\"} %llu\n", metrics_opname(i), metrics_get(&mt->op[i].bytes));
+    }
+    metrics_put(&o, "# HELP myftpd_command_duration_seconds Time from the request to the end of a command.\n"
+                    "# TYPE myftpd_command_duration_seconds histogram\n");
+    for (i = 0; i < METRICS_OPS; i++)
+    {
+        m = &mt->op[i];
+        if (metrics_count(m) > 0)
+            metrics_histogram(&o, "myftpd_command_duration_seconds", metrics_opname(i), m->us, metrics_get(&m->us_sum));
+    }
+    metrics_put(&o, "# HELP myftpd_first_byte_seconds Time from the request to the first reply of a command.\n"
+                    "# TYPE myftpd_first_byte_seconds histogram\n");
+    for (i = 0; i < METRICS_OPS; i++)
+    {
+        m = &mt->op[i];
+        if (metrics_get(&m->ttfb_count) > 0)
+            metrics_histogram(&o, "myftpd_first_byte_seconds", metrics_opname(i), m->ttfb, metrics_get(&m->ttfb_sum));
+    }
+    return o.len;
+}
@@ -0,0 +1,601 @@
+/**
+ * file:        microbench.c
+ * Author:      Seow Wei Cheng (33753618) and Jin Min Seok (33884206)
+ * Date:        17/10/2026 (version 1)
+ * Purpose:     Microbenchmarks of the hot paths under every transfer
+ *              usage: microbench [-s megabytes] [-r runs] [-d dir]   (make bench)
+ *              -s megabytes moved by every case (default 256)
+ *              -r runs of every case, the fastest is reported (default 3)
+ *              -d directory of the files, tmpfs so no disk is measured
+ *                 (default /dev/shm)
+ *              Cases:
+ *              frame   writen()/readn() control frames and writebulk()/readbulk()
+ *                      bulk frames of several payload sizes, from a child to this
+ *                      process over a socketpair with stream buffers on both ends
+ *              token   tokenise() of command lines as users type them
+ *              send    file to socket, as GET sends: the block loop of the v1
+ *                      ser_get() (read() + writen() of MAX_BLOCK_SIZE), large
+ *                      buffers (read() + writebulk() of DEF_BULK_SIZE), sendfile
+ *                      (sendbulkfile(), the v2 path), splice (file -> pipe ->
+ *                      socket) and mmap (writebulk() straight from the mapping)
+ *              recv    socket to file, as PUT stores: the block loop of the v1
+ *                      ser_put() (readn() + write()), large buffers (readbulk()
+ *                      + write() of DEF_BULK_SIZE), splice (recvbulkfile(), the
+ *                      v2 path) and mmap (readbulk() into a mapping of the file).
+ *                      The kernel has no sendfile() from a socket.
+ *              One CSV line per case follows a header line, so the output of
+ *              two commits can be diffed or loaded as it is:
+ *              bench,case,size,bytes,seconds,mb_s,ops_s,writer_calls_mb,reader_calls_mb
+ *              size is the payload of a frame, the length of a line or the
+ *              most a copy moves at once, ops are frames, lines or copies.
+ *              The calls are the read, write, send, sendfile and splice system
+ *              calls made per MB by the side that writes and the side that
+ *              reads, stream.c included: the makefile links them through the
+ *              counting wrappers below (ld --wrap). Socketpairs are AF_UNIX, a TCP connection costs
+ *              more per byte but the same number of calls.
+ */
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include "../stream.h"
+#include "../token.h"
+
+#define BENCH_MB (1024 * 1024)
+#define BENCH_CHUNK DEF_BULK_SIZE //buffer of the large buffer, splice and mmap cases
+
+//system calls counted since the start of a case, [0] by the writer, [1] by
+//the reader. Shared by the two processes of a case, made before any fork
+static unsigned long long *calls;
+//which of them this process is
+static int side;
+
+static void bench_call()
+{
+    if (calls != NULL)
+        __atomic_add_fetch(&calls[side], 1, __ATOMIC_RELAXED);
+}
+
+//the linker sends every call of these, stream.o's too, here first
+ssize_t __real_read(int fd, void *buf, size_t n);
+ssize_t __real_write(int fd, const void *buf, size_t n);
+ssize_t __real_writev(int fd, const struct iovec *iov, int iovcnt);
+ssize_t __real_send(int sd, const void *buf, size_t n, int flags);
+ssize_t __real_pwrite64(int fd, const void *buf, size_t n, off_t offset);
+ssize_t __real_sendfile64(int sd, int fd, off_t *offset, size_t n);
+ssize_t __real_splice(int in, loff_t *inoff, int out, loff_t *outoff, size_t n, unsigned int flags);
+
+ssize_t __wrap_read(int fd, void *buf, size_t n)
+{
+    bench_call();
+    return __real_read(fd, buf, n);
+}
+
+ssize_t __wrap_write(int fd, const void *buf, size_t n)
+{
+    bench_call();
+    return __real_write(fd, buf, n);
+}
+
+ssize_t __wrap_writev(int fd, const struct iovec *iov, int iovcnt)
+{
+    bench_call();
+    return __real_writev(fd, iov, iovcnt);
+}
+
+ssize_t __wrap_send(int sd, const void *buf, size_t n, int flags)
+{
+    bench_call();
+    return __real_send(sd, buf, n, flags);
+}
+
+ssize_t __wrap_pwrite64(int fd, const void *buf, size_t n, off_t offset)
+{
+    bench_call();
+    return __real_pwrite64(fd, buf, n, offset);
+}
+
+ssize_t __wrap_sendfile64(int sd, int fd, off_t *offset, size_t n)
+{
+    bench_call();
+    return __real_sendfile64(sd, fd, offset, n);
+}
+
+ssize_t __wrap_splice(int in, loff_t *inoff, int out, loff_t *outoff, size_t n, unsigned int flags)
+{
+    bench_call();
+    return __real_splice(in, inoff, out, outoff, n, flags);
+}
+
+//outcome of a case
+struct bench_result
+{
+    double secs;
+    long long bytes;
+    long long ops;
+    unsigned long long calls[2];
+};
+
+static double bench_secs(struct timespec *t0)
+{
+    struct timespec t1;
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    return (t1.tv_sec - t0->tv_sec) + (t1.tv_nsec - t0->tv_nsec) / 1e9;
+}
+
+//print the line of a case
+static void bench_line(char *bench, char *name, int size, struct bench_result *r)
+{
+    double mb = (double)r->bytes / BENCH_MB;
+
+    printf("%s,%s,%d,%lld,%.6f,%.2f,%.0f,%.2f,%.2f\n", bench, name, size, r->bytes, r->secs, mb / r->secs,
+           r->ops / r->secs, mb > 0 ? r->calls[0] / mb : 0.0, mb > 0 ? r->calls[1] / mb : 0.0);
+    fflush(stdout);
+}
+
+//run a case runs times and keep the fastest run
+typedef int (*bench_fn)(void *arg, struct bench_result *r);
+static int bench_best(bench_fn fn, void *arg, int runs, struct bench_result *best)
+{
+    struct bench_result r;
+    int i;
+
+    for (i = 0; i < runs; i++)
+    {
+        memset(&r, 0, sizeof(r));
+        calls[0] = calls[1] = 0;
+        if (fn(arg, &r) < 0)
+            return -1;
+        r.calls[0] = calls[0];
+        r.calls[1] = calls[1];
+        if (i == 0 || r.secs < best->secs)
+            *best = r;
+    }
+    return 0;
+}
+
+//the two processes of a case, joined by a socketpair: the child runs
+//child(sd, arg) and exits, this process runs parent(sd, arg, r) between
+//the clock readings. Writers are side 0, readers side 1
+static int bench_pair(int (*child)(int, void *), int (*parent)(int, void *, struct bench_result *), int child_side,
+                      void *arg, struct bench_result *r)
+{
+    struct timespec t0;
+    int sv[2], status, ret;
+    pid_t pid;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+        return -1;
+    //the child must not print what is buffered here again
+    fflush(stdout);
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    if ((pid = fork()) == 0)
+    {
+        side = child_side;
+        close(sv[0]);
+        exit(child(sv[1], arg) < 0);
+    }
+    close(sv[1]);
+    side = !child_side;
+    ret = (pid < 0) ? -1 : parent(sv[0], arg, r);
+    close(sv[0]);
+    if (pid > 0 && (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0))
+        ret = -1;
+    r->secs = bench_secs(&t0);
+    side = 0;
+    return ret;
+}
+
+//a frame case
+struct bench_frames
+{
+    int bulk; //writebulk() / readbulk() rather than writen() / readn()
+    int len;
+    long long count;
+    char *buf;
+};
+
+static int frames_write(int sd, void *arg)
+{
+    struct bench_frames *f = arg;
+    long long i;
+
+    stream_open(sd);
+    for (i = 0; i < f->count; i++)
+    {
+        if ((f->bulk ? writebulk(sd, f->buf, f->len) : writen(sd, f->buf, f->len)) != f->len)
+            return -1;
+    }
+    return stream_close(sd);
+}
+
+static int frames_read(int sd, void *arg, struct bench_result *r)
+{
+    struct bench_frames *f = arg;
+    int size = f->bulk ? f->len : MAX_BLOCK_SIZE;
+
+    stream_open(sd);
+    for (r->ops = 0; r->ops < f->count; r->ops++)
+    {
+        if ((f->bulk ? readbulk(sd, f->buf, size) : readn(sd, f->buf, size)) != f->len)
+        {
+            stream_close(sd);
+            return -1;
+        }
+        r->bytes += f->len;
+    }
+    return stream_close(sd);
+}
+
+static int bench_frames(void *arg, struct bench_result *r)
+{
+    return bench_pair(frames_write, frames_read, 0, arg, r);
+}
+
+//command lines for tokenise(), from short ones to a long mput
+static char *token_lines[] = {"pwd", "get -j 4 release-2026.tar.gz", "put -c backups/monday.img",
+                              "mput *.o *.a *.so include/*.h docs/*.txt build/*.log tests/*.out tests/*.err "
+                              "scripts/*.sh data/*.csv data/*.json images/*.png images/*.jpg notes/*.md"};
+
+static int bench_tokens(void *arg, struct bench_result *r)
+{
+    char line[MAX_BLOCK_SIZE];
+    char *tokens[MAX_NUM_TOKENS];
+    char *text = arg;
+    struct timespec t0;
+    int len = strlen(text), n = 0;
+    long long i, count = 1000000;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (i = 0; i < count; i++)
+    {
+        //tokenise() cuts the line up, every call gets a fresh copy as
+        //the client's loop does
+        memcpy(line, text, len + 1);
+        n += tokenise(line, tokens);
+    }
+    r->secs = bench_secs(&t0);
+    r->ops = count;
+    r->bytes = count * len;
+    return (n > 0) ? 0 : -1;
+}
+
+//a file copy case
+struct bench_copy
+{
+    int fd;    //file the send cases read, the recv cases write
+    off_t size;
+    char *buf; //BENCH_CHUNK bytes
+    off_t (*send)(int sd, int fd, off_t size, char *buf, long long *ops);
+    off_t (*recv)(int sd, int fd, off_t size, char *buf, long long *ops);
+};
+
+//block loop of the v1 ser_get(), full MAX_BLOCK_SIZE frames
+static off_t send_block(int sd, int fd, off_t size, char *buf, long long *ops)
+{
+    off_t n;
+    int nr;
+
+    for (n = 0; n < size; n += nr, (*ops)++)
+    {
+        if ((nr = read(fd, buf, MAX_BLOCK_SIZE)) <= 0 || writen(sd, buf, nr) != nr)
+            return -1;
+    }
+    return n;
+}
+
+//user space copy in bulk frames of the default size
+static off_t send_large(int sd, int fd, off_t size, char *buf, long long *ops)
+{
+    off_t n;
+    int nr;
+
+    for (n = 0; n < size; n += nr, (*ops)++)
+    {
+        if ((nr = read(fd, buf, BENCH_CHUNK)) <= 0 || writebulk(sd, buf, nr) != nr)
+            return -1;
+    }
+    return n;
+}
+
+//the v2 path, no copy to user space
+static off_t send_sendfile(int sd, int fd, off_t size, char *buf, long long *ops)
+{
+    *ops = (size + DEF_BULK_SIZE - 1) / DEF_BULK_SIZE;
+    return sendbulkfile(sd, fd, 0, size, DEF_BULK_SIZE);
+}
+
+//file -> pipe -> socket, raw
+static off_t send_splice(int sd, int fd, off_t size, char *buf, long long *ops)
+{
+    int pfd[2];
+    loff_t off = 0;
+    off_t n, nr, nw, left;
+
+    if (pipe(pfd) < 0)
+        return -1;
+    fcntl(pfd[1], F_SETPIPE_SZ, BENCH_CHUNK); //best effort
+    for (n = 0; n < size; n += nr, (*ops)++)
+    {
+        left = (size - n < BENCH_CHUNK) ? size - n : BENCH_CHUNK;
+        if ((nr = splice(fd, &off, pfd[1], NULL, left, SPLICE_F_MOVE | SPLICE_F_MORE)) <= 0)
+            break;
+        for (left = nr; left > 0; left -= nw)
+        {
+            if ((nw = splice(pfd[0], NULL, sd, NULL, left, SPLICE_F_MOVE | SPLICE_F_MORE)) <= 0)
+                break;
+        }
+        if (left > 0)
+            break;
+    }
+    close(pfd[0]);
+    close(pfd[1]);
+    return (n == size) ? n : -1;
+}
+
+//bulk frames written straight from a mapping of the file
+static off_t send_mmap(int sd, int fd, off_t size, char *buf, long long *ops)
+{
+    char *map;
+    off_t n;
+    int len;
+
+    if ((map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED)
+        return -1;
+    for (n = 0; n < size; n += len, (*ops)++)
+    {
+        len = (size - n < BENCH_CHUNK) ? size - n : BENCH_CHUNK;
+        if (writebulk(sd, map + n, len) != len)
+            break;
+    }
+    munmap(map, size);
+    return (n == size) ? n : -1;
+}
+
+//the reader of a send case takes whatever comes until the end
+static int copy_drain(int sd, void *arg)
+{
+    struct bench_copy *c = arg;
+    ssize_t nr;
+
+    while ((nr = read(sd, c->buf, BENCH_CHUNK)) > 0)
+        ;
+    return (int)nr;
+}
+
+static int copy_send(int sd, void *arg, struct bench_result *r)
+{
+    struct bench_copy *c = arg;
+
+    lseek(c->fd, 0, SEEK_SET);
+    stream_open(sd);
+    r->bytes = c->send(sd, c->fd, c->size, c->buf, &r->ops);
+    if (stream_close(sd) < 0 || r->bytes != c->size)
+        return -1;
+    shutdown(sd, SHUT_WR);
+    return 0;
+}
+
+//the writer of a recv case, as the client sends: block frames for the
+//block loop, raw bytes for the rest
+static int copy_feed(int sd, void *arg)
+{
+    struct bench_copy *c = arg;
+    off_t n;
+    int len;
+
+    stream_open(sd);
+    for (n = 0; n < c->size; n += len)
+    {
+        len = (c->recv == NULL) ? MAX_BLOCK_SIZE : BENCH_CHUNK;
+        len = (c->size - n < len) ? c->size - n : len;
+        if (c->recv == NULL ? writen(sd, c->buf, len) != len : writebulk(sd, c->buf, len) != len)
+            return -1;
+    }
+    //bulk frames of a file end with the empty one
+    if (c->recv != NULL && writebulk(sd, c->buf, 0) != 0)
+        return -1;
+    return stream_close(sd);
+}
+
+//block loop of the v1 ser_put()
+static off_t recv_block(int sd, int fd, off_t size, char *buf, long long *ops)
+{
+    off_t n;
+    int nr;
+
+    for (n = 0; n < size; n += nr, (*ops)++)
+    {
+        if ((nr = readn(sd, buf, MAX_BLOCK_SIZE)) <= 0 || write(fd, buf, nr) != nr)
+            return -1;
+    }
+    return n;
+}
+
+//user space copy through a large buffer
+static off_t recv_large(int sd, int fd, off_t size, char *buf, long long *ops)
+{
+    off_t n;
+    int nr;
+
+    for (n = 0; n < size; n += nr, (*ops)++)
+    {
+        if ((nr = readbulk(sd, buf, BENCH_CHUNK)) <= 0 || write(fd, buf, nr) != nr)
+            return -1;
+    }
+    return n;
+}
+
+//the v2 path, socket -> pipe -> file
+static off_t recv_splice(int sd, int fd, off_t size, char *buf, long long *ops)
+{
+    *ops = (size + DEF_BULK_SIZE - 1) / DEF_BULK_SIZE;
+    return recvbulkfile(sd, fd, 0, DEF_BULK_SIZE);
+}
+
+//bulk frames read straight into a mapping of the file
+static off_t recv_mmap(int sd, int fd, off_t size, char *buf, long long *ops)
+{
+    char *map;
+    off_t n;
+    int len;
+
+    if (ftruncate(fd, size) < 0 || (map = mmap(NULL, size, PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED)
+        return -1;
+    for (n = 0; n < size; n += len, (*ops)++)
+    {
+        if ((len = readbulk(sd, map + n, size - n)) <= 0)
+            break;
+    }
+    munmap(map, size);
+    return (n == size) ? n : -1;
+}
+
+static int copy_recv(int sd, void *arg, struct bench_result *r)
+{
+    struct bench_copy *c = arg;
+    off_t (*recv)(int, int, off_t, char *, long long *) = (c->recv == NULL) ? recv_block : c->recv;
+
+    //every run stores a new file, as PUT does
+    if (ftruncate(c->fd, 0) < 0 || lseek(c->fd, 0, SEEK_SET) < 0)
+        return -1;
+    stream_open(sd);
+    r->bytes = recv(sd, c->fd, c->size, c->buf, &r->ops);
+    stream_close(sd);
+    return (r->bytes == c->size) ? 0 : -1;
+}
+
+static int bench_send(void *arg, struct bench_result *r)
+{
+    return bench_pair(copy_drain, copy_send, 1, arg, r);
+}
+
+static int bench_recv(void *arg, struct bench_result *r)
+{
+    return bench_pair(copy_feed, copy_recv, 0, arg, r);
+}
+
+int main(int argc, char *argv[])
+{
+    static int frame_sizes[] = {16, 64, 256, 1024, MAX_BLOCK_SIZE};
+    static int bulk_sizes[] = {1024 * 16, 1024 * 64, 1024 * 256, DEF_BULK_SIZE};
+    static char *send_names[] = {"block", "large", "sendfile", "splice", "mmap"};
+    static off_t (*sends[])(int, int, off_t, char *, long long *) = {send_block, send_large, send_sendfile,
+                                                                     send_splice, send_mmap};
+    //a NULL recv is the block loop, its writer sends block frames
+    static char *recv_names[] = {"block", "large", "splice", "mmap"};
+    static off_t (*recvs[])(int, int, off_t, char *, long long *) = {NULL, recv_large, recv_splice, recv_mmap};
+    char path[4096];
+    char *dir = "/dev/shm";
+    struct bench_frames f;
+    struct bench_copy c;
+    struct bench_result r;
+    long long volume = 256;
+    int opt, i, runs = 3, ret = 0;
+
+    while ((opt = getopt(argc, argv, "s:r:d:")) != -1)
+    {
+        if (opt == 's' && (volume = atoll(optarg)) > 0)
+            continue;
+        if (opt == 'r' && (runs = atoi(optarg)) > 0)
+            continue;
+        if (opt == 'd')
+        {
+            dir = optarg;
+            continue;
+        }
+        printf("Usage: %s [-s megabytes] [-r runs] [-d dir]\n", argv[0]);
+        exit(1);
+    }
+    volume *= BENCH_MB;
+    calls = mmap(NULL, 2 * sizeof(*calls), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    f.buf = malloc(MAX_BULK_SIZE);
+    c.buf = malloc(BENCH_CHUNK);
+    if (calls == MAP_FAILED || f.buf == NULL || c.buf == NULL)
+    {
+        perror("microbench");
+        exit(1);
+    }
+    memset(f.buf, 'f', MAX_BULK_SIZE);
+    memset(c.buf, 'c', BENCH_CHUNK);
+    printf("bench,case,size,bytes,seconds,mb_s,ops_s,writer_calls_mb,reader_calls_mb\n");
+
+    for (f.bulk = 0; f.bulk < 2; f.bulk++)
+    {
+        for (i = 0; i < (f.bulk ? 4 : 5); i++)
+        {
+            f.len = f.bulk ? bulk_sizes[i] : frame_sizes[i];
+            f.count = (volume + f.len - 1) / f.len;
+            if (bench_best(bench_frames, &f, runs, &r) < 0)
+            {
+                fprintf(stderr, "microbench: frame %d failed\n", f.len);
+                ret = 1;
+                continue;
+            }
+            bench_line("frame", f.bulk ? "bulk" : "control", f.len, &r);
+        }
+    }
+    for (i = 0; i < (int)(sizeof(token_lines) / sizeof(token_lines[0])); i++)
+    {
+        if (bench_best(bench_tokens, token_lines[i], runs, &r) == 0)
+            bench_line("token", "tokenise", strlen(token_lines[i]), &r);
+    }
+
+    //the file every send case reads, made once
+    snprintf(path, sizeof(path), "%s/microbench.%d", dir, (int)getpid());
+    if ((c.fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600)) < 0)
+    {
+        perror(path);
+        exit(1);
+    }
+    unlink(path);
+    c.size = volume;
+    while (lseek(c.fd, 0, SEEK_END) < c.size)
+    {
+        if (write(c.fd, c.buf, BENCH_CHUNK) != BENCH_CHUNK)
+        {
+            perror(path);
+            exit(1);
+        }
+    }
+    if (ftruncate(c.fd, c.size) < 0)
+    {
+        perror(path);
+        exit(1);
+    }
+    for (i = 0; i < 5; i++)
+    {
+        c.send = sends[i];
+        if (bench_best(bench_send, &c, runs, &r) < 0)
+        {
+            fprintf(stderr, "microbench: send %s failed\n", send_names[i]);
+            ret = 1;
+            continue;
+        }
+        bench_line("send", send_names[i], i == 0 ? MAX_BLOCK_SIZE : BENCH_CHUNK, &r);
+    }
+    for (i = 0; i < 4; i++)
+    {
+        c.recv = recvs[i];
+        if (bench_best(bench_recv, &c, runs, &r) < 0)
+        {
+            fprintf(stderr, "microbench: recv %s failed\n", recv_names[i]);
+            ret = 1;
+            continue;
+        }
+        bench_line("recv", recv_names[i], i == 0 ? MAX_BLOCK_SIZE : BENCH_CHUNK, &r);
+    }
+    close(c.fd);
+    exit(ret);
+}
@@ -3,9 +3,31 @@
  * Author:      Seow Wei Cheng (33753618) and Jin Min Seok (33884206)
  * Date:        13/11/2021 (version 2)
  * Purpose:     This is the main driver code for the ftp server
- *              usage: myftpd [initial_current_directory]
+ *              usage: myftpd [-m fork|epoll|prefork] [-n loops] [-w workers] [-s sessions] [-r seconds]
+ *                            [-l error|info|debug] [-S socket] [-g] [initial_current_directory]
  *              if no initial directory is provided current directory is assumed
  *              default port is 41314
+ *              -m selects the server engine:
+ *                 fork    - fork a child process per client (default)
+ *                 epoll   - serve every client from non-blocking epoll loops,
+ *                           -n sets the number of loop processes (0 = one per cpu).
+ *                           It serves the plain commands only: mux sessions, tree
+ *                           transfers, compressed and delta transfers are answered
+ *                           unsupported. Clients then move files one at a time, and
+ *                           rget walks the tree that way, but rput is refused
+ *                 prefork - a pool of -w worker processes is forked once, each worker
+ *                           accepts and serves clients one after the other.
+ *                           A worker is recycled (replaced by a fresh one) after -s sessions
+ *                           or once it is older than -r seconds, 0 means never
+ *              -l sets what goes to log.txt: failed commands, also sessions and the
+ *                 commands served (default), or also every step of a command
+ *              access.log gets a JSON line for every command served, see logger.c
+ *              -S sets the Unix socket the counters of the server are read from
+ *                 (.myftpd.sock in the initial directory by default, "" for none),
+ *                 they are served to clients by STAT_CODE too, see metrics.c
+ *              -g lets rput give files and directories group and other write
+ *                 permission, without it those bits are dropped. The setuid,
+ *                 setgid and sticky bits a client sends are always dropped.
  *              The program can perform the following commands
  *              - [pwd] Display the current directory of the server that is currently serving the client
  *              - [dir] Display the file names under the current directory that is serving the client
@@ -24,6 +46,8 @@
 #include <signal.h> /* SIGCHLD, sigaction() */
 #include <syslog.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <limits.h>
 #include <sys/types.h>  /* pid_t, u_long, u_short */
 #include <sys/socket.h> /* struct sockaddr, socket(), etc */
 #include <sys/wait.h>   /* waitpid(), WNOHAND */
@@ -31,9 +55,19 @@
                         /* and INADDR_ANY */
 #include "../stream.h"
 #include "../netprotocol.h"
+#include "../compress.h"
 #include <dirent.h>
+#include <fnmatch.h> /* fnmatch() */
 #include "../token.h"
+#include "myftpd.h"
 #define SERV_TCP_PORT 41314 //default port
+#define LISTEN_BACKLOG SOMAXCONN
+
+#define MODE_FORK 0  //fork a child per client
+#define MODE_EPOLL 1 //event driven engine in evserver.c
+#define MODE_PREFORK 2 //pool of workers forked in advance
+
+#define DEF_WORKERS 8 //default size of the prefork pool
 
 // Source: Chapter 8 Example 6 ser6.c
 // claim as many zombies as we can
@@ -41,6 +75,8 @@ void claim_children();
 // Source: Chapter 8 Example 6 ser6.c
 // Turn server process into a daemon background process
 void daemon_init(void);
+// Start the prefork worker pool and keep it at full size, never returns
+void prefork_pool(int sd, char *log_path, int nworkers, int maxsessions, int maxage);
 // Source: chapter 8 Example 6 ser6.c
 // Serve a client connecting to the server
 void serve_a_client(int, char *);
@@ -50,16 +86,24 @@ void ser_pwd(int, char *);
 void ser_dir(int, char *);
 //server put function handler
 void ser_put(int, char *);
-//server get function handler
-void ser_get(int, char *);
+//server get function handler, bulk selects the bulk data phase
+void ser_get(int, char *, int);
+//server bulk frame size function handler
+void ser_blk(int, char *);
+
+//bulk frame size agreed with the client of this process
+int bulk_size = DEF_BULK_SIZE;
+int comp_codec = COMP_RAW;
+int tree_modes = 0755;
 //server cd function handler
 void ser_cd(int, char *);
-//function to log interaction with client
-void log_file(char *, char *);
 
 int main(int argc, char *argv[])
 {
-    int sd, nsd;
+    int sd, nsd, opt;
+    int mode = MODE_FORK, nloops = 1;
+    int nworkers = DEF_WORKERS, maxsessions = 0, maxage = 0;
+    int level = LOG_LV_INFO;
     pid_t pid;
     unsigned short port; //server listen port
     socklen_t cli_addrlen;
@@ -68,21 +112,94 @@ int main(int argc, char *argv[])
     //set the listening port to default port
     port = SERV_TCP_PORT;
     char log_path[MAX_BLOCK_SIZE];
+    char alog_path[MAX_BLOCK_SIZE];
+    char sock_file[MAX_BLOCK_SIZE];
+    char *sock_path = NULL;
+    //read the server options
+    while ((opt = getopt(argc, argv, "m:n:w:s:r:l:S:g")) != -1)
+    {
+        if (opt == 'm' && strcmp(optarg, "fork") == 0)
+        {
+            mode = MODE_FORK;
+        }
+        else if (opt == 'm' && strcmp(optarg, "epoll") == 0)
+        {
+            mode = MODE_EPOLL;
+        }
+        else if (opt == 'm' && strcmp(optarg, "prefork") == 0)
+        {
+            mode = MODE_PREFORK;
+        }
+        else if (opt == 'n')
+        {
+            nloops = atoi(optarg);
+        }
+        else if (opt == 'w')
+        {
+            nworkers = atoi(optarg);
+        }
+        else if (opt == 's')
+        {
+            maxsessions = atoi(optarg);
+        }
+        else if (opt == 'r')
+        {
+            maxage = atoi(optarg);
+        }
+        else if (opt == 'l' && strcmp(optarg, "error") == 0)
+        {
+            level = LOG_LV_ERROR;
+        }
+        else if (opt == 'l' && strcmp(optarg, "info") == 0)
+        {
+            level = LOG_LV_INFO;
+        }
+        else if (opt == 'l' && strcmp(optarg, "debug") == 0)
+        {
+            level = LOG_LV_DEBUG;
+        }
+        else if (opt == 'S')
+        {
+            sock_path = optarg;
+        }
+        else if (opt == 'g')
+        {
+            tree_modes = 0777;
+        }
+        else
+        {
+            optind = argc + 1; //force the usage message
+            break;
+        }
+    }
     //set the initial directory of server.
     //if no directory provided use current directory
-    if (argc == 1)
+    if (argc == optind)
     {
         getcwd(dir, sizeof(dir));
     }
     //if directory provided use that directory
-    else if (argc == 2)
+    else if (argc == optind + 1)
     {
-        strncpy(dir, argv[1], sizeof(dir));
+        strncpy(dir, argv[optind], sizeof(dir));
     }
     //if more than 2 arg
     else
     {
-        printf("Usage: %s [ initial_current_directory ]\n", argv[0]);
+        printf("Usage: %s [-m fork|epoll|prefork] [-n loops] [-w workers] [-s sessions] [-r seconds]"
+               " [-l error|info|debug] [-S socket] [-g] [ initial_current_directory ]\n"
+               "       -m epoll serves no mux, tree, compressed or delta transfers\n", argv[0]);
+        exit(1);
+    }
+    if (nloops < 0 || maxsessions < 0 || maxage < 0)
+    {
+        printf("Number of loops, sessions and seconds must not be negative\n");
+        exit(1);
+    }
+    if (nworkers < 1)
+    {
+        printf("Number of workers must be at least 1\n");
+        exit(1);
     }
     //check if dir is valid
     if (chdir(dir) < 0)
@@ -96,6 +213,29 @@ int main(int argc, char *argv[])
     getcwd(dir, sizeof(dir));
     strcpy(log_path, dir);
     strcat(log_path, "/log.txt");
+    strcpy(alog_path, dir);
+    strcat(alog_path, "/access.log");
+    //every process forked from here on writes to the same descriptors
+    if (log_open(log_path, alog_path, level) < 0)
+    {
+        perror("server:log");
+    }
+    //DIR listings are shared by every process forked from here on
+    if (dircache_init(log_path, alog_path) < 0)
+    {
+        perror("server:dircache");
+    }
+    //counters too, their socket is served by a process of its own
+    if (sock_path == NULL)
+    {
+        strcpy(sock_file, dir);
+        strcat(sock_file, "/.myftpd.sock");
+        sock_path = sock_file;
+    }
+    if (metrics_init(sock_path) < 0)
+    {
+        perror("server:metrics");
+    }
     /* set up listening socket sd */
     if ((sd = socket(PF_INET, SOCK_STREAM, 0)) < 0)
     {
@@ -120,7 +260,18 @@ int main(int argc, char *argv[])
     }
 
     /* become a listening socket */
-    listen(sd, 5);
+    listen(sd, LISTEN_BACKLOG);
+    //event driven engine, sessions are served without forking
+    if (mode == MODE_EPOLL)
+    {
+        ev_serve(sd, log_path, nloops);
+        exit(0);
+    }
+    //worker pool, sessions are served by processes forked in advance
+    if (mode == MODE_PREFORK)
+    {
+        prefork_pool(sd, log_path, nworkers, maxsessions, maxage);
+    }
     while (1)
     {
         cli_addrlen = sizeof(cli_addr);
@@ -145,6 +296,7 @@ int main(int argc, char *argv[])
         }
 
         /* now in child, serve the current client */
+        log_child();
         close(sd);
         serve_a_client(nsd, log_path);
         log_file("Client terminated session.\n", log_path);
@@ -189,24 +341,160 @@ void daemon_init(void)
     sigaction(SIGCHLD, (struct sigaction *)&act, (struct sigaction *)0);
 }
 
+//body of a prefork worker, serves clients until it has to be recycled
+static void prefork_worker(int sd, char *log_path, int maxsessions, int maxage)
+{
+    int nsd, homefd, nsessions = 0;
+    time_t started = time(NULL), left = 0;
+    struct pollfd pfd;
+
+    //every session starts in the initial directory of the server
+    if ((homefd = open(".", O_RDONLY)) < 0)
+    {
+        perror("server:worker");
+        exit(1);
+    }
+    while (maxsessions == 0 || nsessions < maxsessions)
+    {
+        if (maxage > 0 && (left = maxage - (time(NULL) - started)) <= 0)
+        {
+            break;
+        }
+        //wait no longer than the worker may live, so a quiet server recycles it too
+        pfd.fd = sd;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, maxage > 0 ? left * 1000 : -1) <= 0)
+        {
+            continue;
+        }
+        //the socket does not block, a worker that loses the client goes back to poll()
+        if ((nsd = accept(sd, NULL, NULL)) < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED || errno == EAGAIN || errno == EWOULDBLOCK)
+                continue;
+            perror("server:accept");
+            exit(1);
+        }
+        serve_a_client(nsd, log_path);
+        log_file("Client terminated session.\n", log_path);
+        log_flush();
+        close(nsd);
+        fchdir(homefd);
+        nsessions++;
+    }
+    exit(0);
+}
+
+//fork one worker, returns its pid or -1
+static pid_t prefork_spawn(int sd, char *log_path, int maxsessions, int maxage)
+{
+    pid_t pid;
+
+    if ((pid = fork()) < 0)
+    {
+        perror("fork");
+        return -1;
+    }
+    if (pid == 0)
+    {
+        log_child();
+        prefork_worker(sd, log_path, maxsessions, maxage);
+    }
+    return pid;
+}
+
+void prefork_pool(int sd, char *log_path, int nworkers, int maxsessions, int maxage)
+{
+    struct sigaction act;
+    pid_t pid;
+    int i, nrunning = 0;
+
+    //the pool reaps its own workers, the zombie handler would steal them
+    act.sa_handler = SIG_DFL;
+    sigemptyset(&act.sa_mask);
+    act.sa_flags = 0;
+    sigaction(SIGCHLD, &act, NULL);
+    //workers wait in poll(), an accept() that another worker beat must not block
+    fcntl(sd, F_SETFL, fcntl(sd, F_GETFL) | O_NONBLOCK);
+
+    for (i = 0; i < nworkers; i++)
+    {
+        if (prefork_spawn(sd, log_path, maxsessions, maxage) > 0)
+            nrunning++;
+    }
+    log_file("Worker pool started.", log_path);
+    log_flush(); //the pool only waits for its workers from here on
+    //replace every worker that is recycled or dies
+    while (1)
+    {
+        if (nrunning < nworkers)
+        {
+            if (prefork_spawn(sd, log_path, maxsessions, maxage) > 0)
+                nrunning++;
+            else
+                sleep(1); //do not spin while fork keeps failing
+            continue;
+        }
+        if ((pid = wait(NULL)) > 0)
+        {
+            if (!metrics_proc(pid))
+                nrunning--;
+        }
+        else if (errno == ECHILD)
+            nrunning = 0;
+    }
+}
+
 void serve_a_client(int sd, char *log_path)
 {
     int nr;
     char buf[MAX_BLOCK_SIZE];
+    struct alog alog;
+    struct pollfd pfd;
+    int due;
     log_file("Client start session.", log_path);
+    //every command of the session goes to the access log
+    alog_session(&alog, sd);
+    alog_cur = &alog;
+    metrics_session(1);
+    //a prefork worker does not keep the block size of its last client
+    bulk_size = DEF_BULK_SIZE;
+    comp_codec = COMP_RAW;
+    //replies are buffered until the next request is read
+    stream_open(sd);
+    pfd.fd = sd;
+    pfd.events = POLLIN;
     while (1)
     {
         bzero(buf, sizeof(buf));
+        //a quiet client must not hold back the lines of the log: the replies
+        //go out, then the lines once they are due while the client waits
+        if (stream_pending(sd) == 0 && log_due() >= 0 && stream_flush(sd) == 0)
+        {
+            while ((due = log_due()) >= 0 && poll(&pfd, 1, due) == 0)
+                log_tick();
+        }
 
         /*
         Read from client
         */
         if ((nr = readn(sd, buf, sizeof(buf))) <= 0)
         {
+            stream_close(sd);
+            alog_cur = NULL;
+            metrics_session(-1);
             return; //if failed to read
         }
-        //process data
-        if (buf[0] == PWD_CODE)
+        if (buf[0] == V2_CODE)
+            alog_begin(nr > 1 ? buf[1] : 0, 2);
+        else
+            alog_begin(buf[0], 1);
+        //process data, a v2 request carries the whole command
+        if (buf[0] == V2_CODE)
+        {
+            serve_v2(sd, buf, nr, log_path);
+        }
+        else if (buf[0] == PWD_CODE)
         {
             ser_pwd(sd, log_path);
         }
@@ -220,12 +508,22 @@ void serve_a_client(int sd, char *log_path)
         }
         else if (buf[0] == GET_CODE1)
         {
-            ser_get(sd, log_path);
+            ser_get(sd, log_path, 0);
+        }
+        else if (buf[0] == GET_BULK_CODE)
+        {
+            ser_get(sd, log_path, 1);
+        }
+        else if (buf[0] == BLK_CODE)
+        {
+            ser_blk(sd, log_path);
         }
         else if (buf[0] == CD_CODE)
         {
             ser_cd(sd, log_path);
         }
+        alog_end();
+        log_tick();
     }
 }
 
@@ -240,12 +538,13 @@ void ser_pwd(int sd, char *log_path)
     nr = strlen(serverpath);
     len = htons(nr);
 
-    log_file("[pwd] pwd command received.", log_path);
+    log_debug("[pwd] pwd command received.", log_path);
 
     if (len > 0)
     {
         status = PWD_READY;
         bcopy(&len, &buf[2], 4);
+        alog_reply(V2_OK);
 
         nw = writen(sd, &buf[0], 1);
         nw = writen(sd, &status, 1);
@@ -253,15 +552,16 @@ void ser_pwd(int sd, char *log_path)
         nw = writen(sd, serverpath, nr);
         if (nw < 0)
         {
-            log_file("[pwd] failed to write server response.", log_path);
+            log_error("[pwd] failed to write server response.", log_path);
         }
-        log_file("[pwd] pwd function executed.", log_path);
+        log_debug("[pwd] pwd function executed.", log_path);
     }
     else
     {
         status = PWD_ERROR;
+        alog_reply(V2_ERROR);
         nw = writen(sd, &status, 1);
-        log_file("[pwd] pwd function error.", log_path);
+        log_error("[pwd] pwd function error.", log_path);
         return;
     }
     log_file("[pwd] pwd function ended.", log_path);
@@ -273,51 +573,22 @@ void ser_dir(int sd, char *log_path)
     int len, nw, nr;
     char status;
     buf[0] = DIR_CODE;
+    char files[MAX_BLOCK_SIZE];
 
-    DIR *dp;
-    struct dirent *direntp;
-    int filecount = 0;
-    char files[MAX_NUM_TOKENS];
-    char tmp[MAX_NUM_TOKENS];
-
-    log_file("[dir] dir command received.", log_path);
+    log_debug("[dir] dir command received.", log_path);
 
-    if ((dp = opendir(".")) == NULL)
+    if ((nr = list_dir(files, sizeof(files), log_path)) < 0)
     {
-        log_file("Failed to open directory.", log_path);
         status = DIR_ERROR;
+        alog_reply(V2_ERROR);
         nw = writen(sd, &status, 1);
         return;
     }
+    alog_reply(V2_OK);
+    alog_bytes(nr);
 
-    //get filenames
-    while ((direntp = readdir(dp)) != NULL)
-    {
-        strcpy(tmp, direntp->d_name);
-
-        if (tmp[0] != '.')
-        {
-            strcat(files, direntp->d_name);
-            if (filecount != 0)
-            {
-                strcat(files, "\n\t");
-            }
-            // else
-            // {
-            //     strcat(files, "\t");
-            // }
-        }
-        filecount++;
-        if (filecount > MAX_NUM_TOKENS)
-        {
-            log_file("Too many files to be displayed!", log_path);
-            break;
-        }
-    }
-
-    nr = strlen(files);
     len = htons(nr);
-    bcopy(&len, &buf[2], 2);
+    bcopy(&len, &buf[2], 4);
 
     if (nr == 0)
         status = DIR_ERROR;
@@ -330,17 +601,104 @@ void ser_dir(int sd, char *log_path)
     nw = writen(sd, files, nr);
     if (nw < 0)
     {
-        log_file("[pwd] failed to write server response.", log_path);
+        log_error("[pwd] failed to write server response.", log_path);
     }
     log_file("[dir] function successfully executed.", log_path);
     return;
 }
 
+int list_dir(char *files, int size, char *log_path)
+{
+    DIR *dp;
+    struct dirent *direntp;
+    struct dircache_fill fill;
+    int filecount = 0, nr = 0, namelen;
+
+    //an unchanged directory is not read again
+    if ((nr = dircache_get(files, size, &fill)) >= 0)
+    {
+        return nr;
+    }
+    nr = 0;
+    if ((dp = opendir(".")) == NULL)
+    {
+        dircache_put(&fill, NULL, -1);
+        log_error("Failed to open directory.", log_path);
+        return -1;
+    }
+
+    //get filenames, hidden files are skipped
+    files[0] = '\0';
+    while ((direntp = readdir(dp)) != NULL)
+    {
+        if (direntp->d_name[0] == '.')
+        {
+            continue;
+        }
+        //room for the separator, the name and the null
+        namelen = strlen(direntp->d_name);
+        if (nr + namelen + 3 > size)
+        {
+            log_error("Too many files to be displayed!", log_path);
+            break;
+        }
+        if (filecount != 0)
+        {
+            strcpy(&files[nr], "\n\t");
+            nr += 2;
+        }
+        strcpy(&files[nr], direntp->d_name);
+        nr += namelen;
+        filecount++;
+    }
+    closedir(dp);
+    dircache_put(&fill, files, nr);
+    return nr;
+}
+
+int match_dir(char *pattern, int skip, char *files, int size, int *count, char *log_path)
+{
+    struct dirent **list;
+    struct stat fst;
+    int i, n, namelen, nr = 0, full = 0;
+
+    //sorted, so that every page of a long match sees the same order
+    if ((n = scandir(".", &list, NULL, alphasort)) < 0)
+    {
+        log_error("Failed to open directory.", log_path);
+        return -1;
+    }
+    *count = 0;
+    for (i = 0; i < n; i++)
+    {
+        //a leading dot must be matched explicitly, so part files stay out
+        if (fnmatch(pattern, list[i]->d_name, FNM_PERIOD) == 0 && stat(list[i]->d_name, &fst) == 0 && S_ISREG(fst.st_mode))
+        {
+            namelen = strlen(list[i]->d_name);
+            if (*count >= skip && !full && nr + namelen + 1 <= size)
+            {
+                memcpy(&files[nr], list[i]->d_name, namelen);
+                files[nr + namelen] = '\n';
+                nr += namelen + 1;
+            }
+            else if (*count >= skip)
+            {
+                full = 1;
+            }
+            (*count)++;
+        }
+        free(list[i]);
+    }
+    free(list);
+    return nr;
+}
+
 void ser_put(int sd, char *log_path)
 {
     //variables used
     char opcode, ackcode;
     int file_len, fsize, nr, nw, fd, total = 0;
+    off_t start;
     char filename[MAX_BLOCK_SIZE]; //buffer to store filename
     char buf[MAX_BLOCK_SIZE];      //buffer to store client and server message
     //read file name length and convert to host byte order
@@ -348,26 +706,28 @@ void ser_put(int sd, char *log_path)
     memcpy(&file_len, &buf[0], 2);
     file_len = ntohs(file_len);
     //printf("file name length is: %d\n", file_len);
-    log_file("[put] file name length received.", log_path);
+    log_debug("[put] file name length received.", log_path);
     //read file name
     readn(sd, &buf[2], MAX_BLOCK_SIZE);
     memcpy(&filename, &buf[2], file_len);
     //set last index of filename to be NULL
     filename[file_len] = '\0';
     //printf("file name is: %s\n", filename);
-    log_file("[put] file name received.", log_path);
+    log_debug("[put] file name received.", log_path);
+    alog_name(filename, file_len);
     //check if file exist on server
     if (access(filename, R_OK) == 0)
     {
         ackcode = PUT_CLASH_ERROR;
-        log_file("[put] put clash error.", log_path);
+        log_error("[put] put clash error.", log_path);
     }
     else
     {
         ackcode = PUT_READY;
-        log_file("[put] put ready.", log_path);
+        log_debug("[put] put ready.", log_path);
     }
     //write opcode and ack code to client
+    alog_reply(ackcode == PUT_READY ? V2_OK : V2_CLASH);
     memset(buf, 0, MAX_BLOCK_SIZE);
     buf[0] = PUT_CODE1;
     buf[1] = ackcode;
@@ -381,26 +741,52 @@ void ser_put(int sd, char *log_path)
         //check if can read opcode from client
         if (readn(sd, &buf[0], MAX_BLOCK_SIZE) < 0)
         {
-            log_file("[put] failed to read opcode 2 from client", log_path);
+            log_error("[put] failed to read opcode 2 from client", log_path);
             return;
         }
         memcpy(&opcode, &buf[0], 1);
         //printf("opcode is %c\n", opcode);
-        log_file("[put] opcode 2 received.", log_path);
+        log_debug("[put] opcode 2 received.", log_path);
         //read file size
         //check if can read file size from client
         if (readn(sd, &buf[1], MAX_BLOCK_SIZE) < 0)
         {
-            log_file("[put] failed to read file size from client", log_path);
+            log_error("[put] failed to read file size from client", log_path);
             return;
         }
         memcpy(&fsize, &buf[1], 4);
         //convert file size to host byte order
         fsize = ntohl(fsize);
         //printf("file size is %d\n", fsize);
-        log_file("[put] file size received.", log_path);
-        //create file
-        if ((fd = open(filename, O_WRONLY | O_CREAT, 0666)) != -1)
+        log_debug("[put] file size received.", log_path);
+        //bulk data phase, the frames are spliced straight into the file
+        if (opcode == PUT_BULK_CODE2)
+        {
+            ackcode = PUT_DONE;
+            //a failed open still drains the frames to stay in step with the client
+            fd = journal_open(filename, fsize, 0, &start);
+            nr = recvbulkfile(sd, fd, 0, bulk_size);
+            if (nr == -1)
+            {
+                log_error("[put] failed to read file.", log_path);
+                if (fd != -1)
+                    close(fd);
+                return;
+            }
+            //a frame too large was passed over, the file is not whole
+            if (nr == -2 || nr == -3 || fd == -1)
+            {
+                log_error("[put] failed to write file.", log_path);
+                ackcode = PUT_FAIL;
+            }
+            else
+            {
+                log_debug("[put] file received from client.", log_path);
+                fsize = nr;
+            }
+        }
+        //create the part file, it gets the name once complete
+        else if ((fd = journal_open(filename, fsize, 0, &start)) != -1)
         {
             //set ackcode
             ackcode = PUT_DONE;
@@ -416,16 +802,15 @@ void ser_put(int sd, char *log_path)
                 //read first block
                 nr = readn(sd, block, MAX_BLOCK_SIZE);
                 //if failed to read set ackcode to '1'
-                if (nr < 0)
+                if (nr < fsize)
                 {
-                    log_file("[put] failed to read file.", log_path);
+                    log_error("[put] failed to read file.", log_path);
                     ackcode = PUT_FAIL;
                 }
                 //write block of data to file using leftover file size
-                nw = write(fd, block, fsize);
-                if (nw < 0)
+                else if (fsize > 0 && pwrite(fd, block, fsize, 0) != fsize)
                 {
-                    log_file("[put] failed to write file.", log_path);
+                    log_error("[put] failed to write file.", log_path);
                     ackcode = PUT_FAIL;
                 }
             }
@@ -434,49 +819,49 @@ void ser_put(int sd, char *log_path)
                 //if total transfer is less than file size
                 while (total < fsize)
                 {
-                    //reset block buffer
-                    memset(block, '\0', MAX_BLOCK_SIZE);
-                    //set file seek pointer to total transfer
-                    lseek(fd, total, SEEK_SET);
-                    //read next block of data
-                    nr = readn(sd, block, MAX_BLOCK_SIZE);
-                    if (nr < 0)
+                    //the last block only carries the leftover file size
+                    int leftover = fsize - total;
+                    if (leftover > MAX_BLOCK_SIZE)
                     {
-                        log_file("[put] failed to read file.", log_path);
-                        ackcode = PUT_FAIL;
+                        leftover = MAX_BLOCK_SIZE;
                     }
-                    //if leftover data is less than max block size
-                    int leftover = fsize - total;
-                    if (leftover < MAX_BLOCK_SIZE)
+                    //read next block of data, a short one means the stream is broken
+                    nr = readn(sd, block, MAX_BLOCK_SIZE);
+                    if (nr < leftover)
                     {
-                        //write to fd using the leftover file size
-                        nw = write(fd, block, leftover);
-                        if (nw < 0)
-                        {
-                            log_file("[put] failed to write file.", log_path);
-                            ackcode = PUT_FAIL;
-                        }
+                        log_error("[put] failed to read file.", log_path);
+                        ackcode = PUT_FAIL;
+                        break;
                     }
-                    else
+                    //a failed write still counts the block, the rest is drained
+                    if (ackcode == PUT_DONE)
                     {
-                        //write to fd using the max block size
-                        nw = write(fd, block, MAX_BLOCK_SIZE);
-                        if (nw < 0)
+                        for (nw = 0; nw < leftover; nw += nr)
                         {
-                            log_file("[put] failed to write file.", log_path);
-                            ackcode = PUT_FAIL;
+                            if ((nr = pwrite(fd, block + nw, leftover - nw, total + nw)) <= 0)
+                            {
+                                log_error("[put] failed to write file.", log_path);
+                                ackcode = PUT_FAIL;
+                                break;
+                            }
                         }
                     }
                     //add to total file count
-                    total += nw;
+                    total += leftover;
                 }
             }
-            log_file("[put] file received from client.", log_path);
+            log_debug("[put] file received from client.", log_path);
         }
         else
         {
             ackcode = PUT_FAIL;
-            log_file("[put] put failed.", log_path);
+            log_error("[put] put failed.", log_path);
+        }
+        //rename the complete part file to its name
+        if (ackcode == PUT_DONE && journal_finish(filename, fd, fsize) < 0)
+        {
+            log_error("[put] failed to rename part file.", log_path);
+            ackcode = PUT_FAIL;
         }
         //write to client status of file transfer
         memset(buf, 0, MAX_BLOCK_SIZE);
@@ -485,25 +870,26 @@ void ser_put(int sd, char *log_path)
         //write opcode to client
         if (writen(sd, &buf[0], 1) < 0)
         {
-            log_file("[put] Unable to send opcode to client.", log_path);
+            log_error("[put] Unable to send opcode to client.", log_path);
             return;
         }
         memcpy(&buf[1], &ackcode, 1);
         //write ack code to client
         if (writen(sd, &buf[1], 1) < 0)
         {
-            log_file("[put] Unable to send ackcode to client.", log_path);
+            log_error("[put] Unable to send ackcode to client.", log_path);
             return;
         }
         close(fd);
+        alog_bytes(fsize);
         log_file("[put] put command finished.", log_path);
         return;
     }
 }
 
-void ser_get(int sd, char *log_path)
+void ser_get(int sd, char *log_path, int bulk)
 {
-    log_file("[get] get command received.", log_path);
+    log_debug("[get] get command received.", log_path);
     char opcode;
     int file_len, fsize, nr, total = 0;
     char filename[MAX_BLOCK_SIZE]; //buffer to store filename
@@ -513,39 +899,49 @@ void ser_get(int sd, char *log_path)
     memcpy(&file_len, &buf[0], 2);
     file_len = ntohs(file_len);
     //printf("file name length is: %d\n", file_len);
-    log_file("[get] file name length received.", log_path);
+    log_debug("[get] file name length received.", log_path);
     //read file name
     readn(sd, &buf[2], MAX_BLOCK_SIZE);
     memcpy(&filename, &buf[2], file_len);
     //set last index of filename to be NULL
     filename[file_len] = '\0';
     //printf("file name is: %s\n", filename);
-    log_file("[get] file name received.", log_path);
+    log_debug("[get] file name received.", log_path);
+    alog_name(filename, file_len);
     FILE *file;                  //create file pointer
     file = fopen(filename, "r"); //open client selected file
+    //the size of a version 1 reply is 32-bit, larger files need a v2 GET
+    struct stat big;
+    if (file != NULL && fstat(fileno(file), &big) == 0 && big.st_size > INT_MAX)
+    {
+        log_error("[get] File is too large for a version 1 GET.", log_path);
+        fclose(file);
+        file = NULL;
+    }
     memset(buf, 0, MAX_BLOCK_SIZE);
     //check if file exist on server
     if (file != NULL)
     {
         buf[0] = GET_CODE1;
         buf[1] = GET_READY;
+        alog_reply(V2_OK);
         if (writen(sd, &buf[0], 1) < 0)
         {
-            log_file("[get] Error: failed to send opcode to client.", log_path);
+            log_error("[get] Error: failed to send opcode to client.", log_path);
             return;
         }
         if (writen(sd, &buf[1], 1) < 0)
         {
-            log_file("[get] Error: failed to send ackcode to client.", log_path);
+            log_error("[get] Error: failed to send ackcode to client.", log_path);
             return;
         }
-        log_file("[get] File exist on server.", log_path);
+        log_debug("[get] File exist on server.", log_path);
         //get file size and send to client
         struct stat fst;
         //check if file stat is ok
         if (stat(filename, &fst) == -1)
         {
-            log_file("[get] failed to get file stat.", log_path);
+            log_error("[get] failed to get file stat.", log_path);
             return;
         }
         //get file size and convert it to network btye order
@@ -554,18 +950,33 @@ void ser_get(int sd, char *log_path)
         memcpy(&buf[0], &opcode, 1);
         if (writen(sd, &buf[0], 1) < 0)
         {
-            log_file("[get] failed to write opcode to client 2.", log_path);
+            log_error("[get] failed to write opcode to client 2.", log_path);
         }
         fsize = (int)fst.st_size;
         int templen = htonl(fsize);
         memcpy(&buf[1], &templen, 4);
         if (writen(sd, &buf[1], 4) < 0)
         {
-            log_file("[get] failed to write file size to client.", log_path);
+            log_error("[get] failed to write file size to client.", log_path);
             return;
         }
         //getting file descriptor
         int fd = fileno(file);
+        //bulk data phase, the kernel sends the file without any copy
+        if (bulk)
+        {
+            if ((nr = sendbulkfile(sd, fd, 0, fsize, bulk_size)) < 0)
+            {
+                log_error("[get] failed to send file.", log_path);
+            }
+            else
+            {
+                alog_bytes(nr);
+                log_file("[get] File is sent to client.", log_path);
+            }
+            fclose(file);
+            return;
+        }
         //creating buffer for block of data
         char block[MAX_BLOCK_SIZE];
         memset(block, '\0', MAX_BLOCK_SIZE);
@@ -577,6 +988,7 @@ void ser_get(int sd, char *log_path)
             //read and write first block of data
             nr = read(fd, block, fsize);
             writen(sd, block, MAX_BLOCK_SIZE);
+            total = fsize;
         }
         else
         {
@@ -585,52 +997,100 @@ void ser_get(int sd, char *log_path)
             {
                 //reset block buffer
                 memset(block, '\0', MAX_BLOCK_SIZE);
-                //set file seek pointer to previous end
-                lseek(fd, total, SEEK_SET);
-
                 //read next block of data
                 int leftover = fsize - total;
                 //if file size - current total size is larger than max block
                 if (leftover > MAX_BLOCK_SIZE)
                 {
-                    //read next block of data to max block size
-                    nr = read(fd, block, MAX_BLOCK_SIZE);
+                    leftover = MAX_BLOCK_SIZE;
                 }
-                else
+                //a file that shrank or cannot be read goes on as zeros, the
+                //client still counts on every block
+                if ((nr = pread(fd, block, leftover, total)) < leftover)
                 {
-                    //read next block of data to leftover size
-                    nr = read(fd, block, leftover);
+                    log_error("[get] failed to read file, block padded.", log_path);
                 }
                 //read block data to server
-                writen(sd, block, MAX_BLOCK_SIZE);
-                //add write count to total size
-                total += nr;
+                if (writen(sd, block, MAX_BLOCK_SIZE) < 0)
+                {
+                    log_error("[get] failed to send file.", log_path);
+                    break;
+                }
+                //add the block to total size
+                total += leftover;
             }
         }
+        fclose(file);
+        alog_bytes(total);
         log_file("[get] File is sent to client.", log_path);
     }
     else
     {
         buf[0] = GET_CODE1;
         buf[1] = GET_NOT_FOUND;
+        alog_reply(V2_NOT_FOUND);
         if (writen(sd, &buf[0], 1) < 0)
         {
-            log_file("[get] Error: failed to send opcode to client.", log_path);
+            log_error("[get] Error: failed to send opcode to client.", log_path);
             return;
         }
         if (writen(sd, &buf[1], 1) < 0)
         {
-            log_file("[get] Error: failed to send ackcode to client.", log_path);
+            log_error("[get] Error: failed to send ackcode to client.", log_path);
             return;
         }
-        log_file("[get] File does not exist on server.", log_path);
+        log_error("[get] File does not exist on server.", log_path);
         return;
     }
 }
 
+int accept_bulk_size(int size)
+{
+    //keep the size between a control block and the largest bulk frame
+    if (size < MAX_BLOCK_SIZE)
+    {
+        return -1;
+    }
+    return (size > MAX_BULK_SIZE) ? MAX_BULK_SIZE : size;
+}
+
+void ser_blk(int sd, char *log_path)
+{
+    char buf[MAX_BLOCK_SIZE];
+    int size;
+
+    log_debug("[blk] block size command received.", log_path);
+    if (readn(sd, buf, MAX_BLOCK_SIZE) != 4)
+    {
+        log_error("[blk] failed to read block size.", log_path);
+        return;
+    }
+    memcpy(&size, buf, 4);
+    size = accept_bulk_size(ntohl(size));
+    buf[0] = BLK_CODE;
+    buf[1] = BLK_READY;
+    if (size < 0)
+    {
+        buf[1] = BLK_ERROR;
+    }
+    else
+    {
+        bulk_size = size;
+    }
+    size = htonl(bulk_size);
+    memcpy(&buf[2], &size, 4);
+    alog_reply(buf[1] == BLK_READY ? V2_OK : V2_ERROR);
+    if (writen(sd, &buf[0], 1) < 0 || writen(sd, &buf[1], 1) < 0 || writen(sd, &buf[2], 4) < 0)
+    {
+        log_error("[blk] failed to write server response.", log_path);
+        return;
+    }
+    log_file("[blk] block size command finished.", log_path);
+}
+
 void ser_cd(int sd, char *log_path)
 {
-    log_file("[CD] CD command received.", log_path);
+    log_debug("[CD] CD command received.", log_path);
     char buf[MAX_BLOCK_SIZE];
     char path[MAX_BLOCK_SIZE];
     char status;
@@ -639,12 +1099,12 @@ void ser_cd(int sd, char *log_path)
     //read length from client
     if ((readn(sd, &buf[0], MAX_BLOCK_SIZE)) < 0)
     {
-        log_file("[CD] failed to read file length.", log_path);
+        log_error("[CD] failed to read file length.", log_path);
         return;
     }
     else
     {
-        log_file("[CD] read file length.", log_path);
+        log_debug("[CD] read file length.", log_path);
     }
     memcpy(&len, &buf[0], 2);
     len = ntohs(len);
@@ -652,15 +1112,16 @@ void ser_cd(int sd, char *log_path)
     //read filepath from client
     if ((readn(sd, &buf[2], MAX_BLOCK_SIZE)) < 0)
     {
-        log_file("[CD] failed to read file path.", log_path);
+        log_error("[CD] failed to read file path.", log_path);
         return;
     }
     else
     {
-        log_file("[CD] read file path.", log_path);
+        log_debug("[CD] read file path.", log_path);
     }
     memcpy(path, &buf[2], len);
     path[len] = '\0';
+    alog_name(path, len);
 
     chdirready = chdir(path);
     if (chdirready == 0)
@@ -672,44 +1133,24 @@ void ser_cd(int sd, char *log_path)
     else if (chdirready == -1)
     {
         status = CD_ERROR;
-        log_file("[CD] status is error.", log_path);
+        log_error("[CD] status is error.", log_path);
         //printf("[CD] status is error.\n");
     }
     memset(buf, 0, MAX_BLOCK_SIZE);
     buf[0] = CD_CODE;
+    alog_reply(status == CD_READY ? V2_OK : V2_ERROR);
     if ((writen(sd, &buf[0], 1)) < 0)
     {
-        log_file("[CD] failed to write opcode to client.", log_path);
+        log_error("[CD] failed to write opcode to client.", log_path);
         return;
     }
     buf[1] = status;
     if ((writen(sd, &buf[1], 1)) < 0)
     {
-        log_file("[CD] failed to write status to client.", log_path);
+        log_error("[CD] failed to write status to client.", log_path);
         return;
     }
     //printf("[CD] CD function ended.\n");
-    log_file("[CD] CD function ended.", log_path);
+    log_debug("[CD] CD function ended.", log_path);
     return;
 }
-
-void log_file(char *message, char *log_path)
-{
-    FILE *file;
-    pid_t pid = getpid();
-    char timearr[100];
-    time_t raw_time;
-    struct tm *time_info;
-
-    time(&raw_time);
-    time_info = localtime(&raw_time);
-    strftime(timearr, sizeof(timearr), "%b %d %H:%M", time_info);
-    file = fopen(log_path, "a");
-    if (file == NULL)
-    {
-        perror("Server: log file.\n");
-    }
-    fprintf(file, "%d %s : ", pid, timearr);
-    fprintf(file, "%s\n", message);
-    fclose(file);
-}
@@ -0,0 +1,156 @@
+/**
+ * file:        myftpd.h
+ * Author:      Seow Wei Cheng (33753618) and Jin Min Seok (33884206)
+ * Date:        17/10/2026 (version 3)
+ * Purpose:     Declarations shared between the modules of the ftp server
+ *              - myftpd.c   main driver, fork per client and the blocking handlers
+ *              - evserver.c event driven (epoll) engine selected with -m epoll
+ *              - v2server.c blocking handlers of the version 2 protocol
+ *              - journal.c  part files and journals of uploads
+ *              - dircache.c DIR listings shared by every process of the server
+ *              - logger.c   buffered log and access log of every process of the server
+ *              - metrics.c  counters and latency histograms shared by every process of the server
+ */
+
+//log levels, a line is written when its level is at most the one set with -l
+#define LOG_LV_ERROR 0 //failed commands
+#define LOG_LV_INFO 1  //sessions and commands served (default)
+#define LOG_LV_DEBUG 2 //every step of a command
+//lines above this level are left out at compile time, see the makefile
+#ifndef LOG_MAX_LEVEL
+#define LOG_MAX_LEVEL LOG_LV_DEBUG
+#endif
+//level set with -l
+extern int log_level;
+//open the log and the access log of the server before any process is
+//forked, lines above level are dropped. Returns 0, or -1 if nothing is logged
+int log_open(char *log_path, char *alog_path, int level);
+//add message as a line of the log, see log_at()
+void log_write(int level, char *message);
+//write the lines held back by this process
+void log_flush(void);
+//milliseconds until the lines held back are due, -1 if there are none
+int log_due(void);
+//write the lines held back if they are due
+void log_tick(void);
+//drop the lines inherited from the parent, right after a fork
+void log_child(void);
+#define log_at(level, message)                                  \
+    do                                                          \
+    {                                                           \
+        if ((level) <= LOG_MAX_LEVEL && (level) <= log_level)   \
+            log_write((level), (message));                      \
+    } while (0)
+//function to log interaction with client, log_path is kept for the callers,
+//the file is the one of log_open()
+#define log_file(message, log_path) log_at(LOG_LV_INFO, message)
+//an error line also marks the command being served as failed
+#define log_error(message, log_path) \
+    do                               \
+    {                                \
+        alog_fail();                 \
+        log_at(LOG_LV_ERROR, message); \
+    } while (0)
+#define log_debug(message, log_path) log_at(LOG_LV_DEBUG, message)
+//record of the command a session is serving, written to the access log as
+//one line once the command is over, see logger.c
+#define ALOG_NAME_MAX 256
+struct alog
+{
+    char client[48];          //address:port of the client of the session
+    char op;                  //op code of the command, 0 between commands
+    char proto;               //1 or 2
+    char status;              //V2_ code of the outcome
+    char name[ALOG_NAME_MAX]; //file or directory of the command, cut if longer
+    long long bytes;          //file data or listing moved
+    long long start;          //microseconds since the epoch
+    long long first;          //when the first reply went out, 0 until then
+};
+//record the alog_ calls below go to, NULL if none
+extern struct alog *alog_cur;
+//start the records of the session of client socket sd
+void alog_session(struct alog *a, int sd);
+//start the record of a command of op code op and protocol version proto
+void alog_begin(char op, int proto);
+//name of the file or directory of the command
+void alog_name(char *name, int len);
+//the first reply of the command goes out now
+void alog_first(void);
+//a reply of the V2_ status goes out now, any status but V2_OK is the outcome
+void alog_reply(char status);
+//the command failed, unless an outcome is already recorded
+void alog_fail(void);
+//bytes more were moved by the command
+void alog_bytes(long long bytes);
+//add the record of the command to the access log
+void alog_end(void);
+//name of the command of op code op, "unknown" if there is none
+char *alog_opname(char op);
+//name of the outcome of V2_ status
+char *alog_result(char status);
+//largest text of metrics_text()
+#define METRICS_TEXT_MAX (1024 * 128)
+//make the counters of the server, before any process is forked, and serve
+//their text on the Unix socket sock_path (none if NULL or empty) from a
+//process of their own. Returns 0, or -1 if nothing is counted or served
+int metrics_init(char *sock_path);
+//1 if pid is the process of the metrics socket
+int metrics_proc(pid_t pid);
+//a session starts (1) or ends (-1)
+void metrics_session(int delta);
+//count a command of op code op that ended with the V2_ status after us
+//microseconds, bytes moved and its first reply after ttfb (-1 if none)
+void metrics_command(char op, char status, long long bytes, long long us, long long ttfb);
+//write the counters as Prometheus text into buf, returns its length
+int metrics_text(char *buf, int size);
+//build the DIR listing of the current directory into files
+//returns the length of the listing
+int list_dir(char *files, int size, char *log_path);
+//list the regular files matching the glob pattern, skipping the first skip
+//matches, as names ended by '\n' into files; *count gets the number of
+//matches in all. Returns the length of the list or -1
+int match_dir(char *pattern, int skip, char *files, int size, int *count, char *log_path);
+//run the event driven engine on the listening socket sd, never returns
+void ev_serve(int sd, char *log_path, int nloops);
+//bulk frame size agreed with the client of this process
+extern int bulk_size;
+//codec agreed with the client of this process, COMP_RAW when off
+extern int comp_codec;
+//mode bits a tree put may give its files and directories, group and
+//other write only with -g
+extern int tree_modes;
+//bulk frame size to use when a client asks for size, -1 if it is refused
+int accept_bulk_size(int size);
+//serve the v2 request of len bytes read into buf
+void serve_v2(int sd, char *buf, int len, char *log_path);
+//uploads go to a hidden part file whose committed offset is journaled
+//every JOURNAL_STEP bytes, see journal.c
+#define JOURNAL_STEP (1024 * 1024 * 32)
+//open the part file of an upload of size bytes named name, truncated
+//unless resume is set and the journal of the same size has an offset
+//returns the part file, *offset is where the upload goes on, or -1
+int journal_open(char *name, off_t size, int resume, off_t *offset);
+//record that the part file fd is on disk up to offset, returns 0 or -1
+int journal_commit(char *name, int fd, off_t size, off_t offset);
+//cut the complete part file fd to size and rename it to name, returns 0 or -1
+int journal_finish(char *name, int fd, off_t size);
+//largest listing the cache keeps, the packed entries of LIST are kept
+//for this size
+#define DIRCACHE_MAX (1024 * 1024 * 4)
+//slot a listing missed by dircache_get() goes to, see dircache.c
+struct dircache_fill
+{
+    int slot; //-1 if the listing is not to be kept
+    unsigned int changes;
+    unsigned int epoch;
+};
+//make the listing cache, before any process is forked, log_path and
+//alog_path are the logs of the server, both in one directory. Returns 0,
+//or -1 if listings are always read from the directory
+int dircache_init(char *log_path, char *alog_path);
+//copy the cached listing of the current directory built for size into files
+//returns its length, or -1 on a miss. After a miss the listing read from
+//the directory must be handed to dircache_put() with the same fill
+int dircache_get(char *files, int size, struct dircache_fill *fill);
+//keep the listing of len bytes, or give the slot up if len is -1
+void dircache_put(struct dircache_fill *fill, char *files, int len);
@@ -0,0 +1,957 @@
+/**
+ * file:        v2server.c
+ * Author:      Seow Wei Cheng (33753618) and Jin Min Seok (33884206)
+ * Date:        17/10/2026 (version 1)
+ * Purpose:     Handlers of the version 2 protocol for the blocking engines
+ *              (fork and prefork). serve_a_client() hands over every request
+ *              that starts with V2_CODE. Each command is answered with a single
+ *              reply frame, see netprotocol.h. MUX_CODE turns the
+ *              connection into a mux session served by v2_mux().
+ */
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "../stream.h"
+#include "../netprotocol.h"
+#include "../mux.h"
+#include "../crc32c.h"
+#include "../tree.h"
+#include "../compress.h"
+#include "../delta.h"
+#include "../listing.h"
+#include "myftpd.h"
+
+//copy the payload of m as a null terminated name
+static void v2_name(struct v2_msg *m, char *name)
+{
+    memcpy(name, m->data, m->len);
+    name[m->len] = '\0';
+}
+
+//send a reply without payload
+static void v2_reply(int sd, char op, char status, long long size, char *log_path)
+{
+    struct v2_msg rep;
+
+    rep.op = op;
+    rep.status = status;
+    rep.flags = 0;
+    rep.size = size;
+    rep.offset = 0;
+    rep.id = 0;
+    rep.data = NULL;
+    rep.len = 0;
+    alog_reply(status);
+    if (v2_send(sd, &rep) < 0)
+    {
+        log_error("[v2] failed to write server response.", log_path);
+    }
+}
+
+static void v2_pwd(int sd, char *log_path)
+{
+    char serverpath[MAX_BLOCK_SIZE];
+    struct v2_msg rep;
+
+    log_debug("[pwd] pwd command received.", log_path);
+    if (getcwd(serverpath, MAX_BLOCK_SIZE - V2_HDR_SIZE) == NULL)
+    {
+        v2_reply(sd, PWD_CODE, V2_ERROR, 0, log_path);
+        log_error("[pwd] pwd function error.", log_path);
+        return;
+    }
+    rep.op = PWD_CODE;
+    rep.status = V2_OK;
+    rep.flags = 0;
+    rep.size = 0;
+    rep.offset = 0;
+    rep.id = 0;
+    rep.data = serverpath;
+    rep.len = strlen(serverpath);
+    alog_reply(V2_OK);
+    if (v2_send(sd, &rep) < 0)
+    {
+        log_error("[pwd] failed to write server response.", log_path);
+    }
+    log_file("[pwd] pwd function ended.", log_path);
+}
+
+static void v2_dir(int sd, char *log_path)
+{
+    char files[MAX_BLOCK_SIZE];
+    struct v2_msg rep;
+    int nr;
+
+    log_debug("[dir] dir command received.", log_path);
+    if ((nr = list_dir(files, MAX_BLOCK_SIZE - V2_HDR_SIZE, log_path)) < 0)
+    {
+        v2_reply(sd, DIR_CODE, V2_ERROR, 0, log_path);
+        return;
+    }
+    rep.op = DIR_CODE;
+    rep.status = V2_OK;
+    rep.flags = 0;
+    rep.size = 0;
+    rep.offset = 0;
+    rep.id = 0;
+    rep.data = files;
+    rep.len = nr;
+    alog_reply(V2_OK);
+    alog_bytes(nr);
+    if (v2_send(sd, &rep) < 0)
+    {
+        log_error("[dir] failed to write server response.", log_path);
+    }
+    log_file("[dir] function successfully executed.", log_path);
+}
+
+//listing kept in, or served from, the DIR cache of the server
+static char *v2_listbuf = NULL;
+
+static void v2_list(int sd, struct v2_msg *req, char *log_path)
+{
+    char buf[MAX_BLOCK_SIZE];
+    struct dircache_fill fill;
+    struct listing ls;
+    struct v2_msg m;
+    int n, kept = -1, len = 0;
+
+    log_debug("[dir] list command received.", log_path);
+    fill.slot = -1;
+    if (v2_listbuf == NULL)
+        v2_listbuf = malloc(DIRCACHE_MAX);
+    if (v2_listbuf != NULL)
+        kept = dircache_get(v2_listbuf, DIRCACHE_MAX, &fill);
+    if (kept < 0 || list_packed(&ls, v2_listbuf, kept, req->offset, req->size) < 0)
+    {
+        if (list_open(&ls, req->offset, req->size) < 0)
+        {
+            dircache_put(&fill, NULL, -1);
+            v2_reply(sd, LIST_CODE, V2_ERROR, 0, log_path);
+            log_error("Failed to open directory.", log_path);
+            return;
+        }
+        //only a whole listing from the start is worth keeping
+        if (req->offset != 0 || req->size != 0)
+            dircache_put(&fill, NULL, -1);
+    }
+    v2_reply(sd, LIST_CODE, V2_OK, 0, log_path);
+    m.op = LIST_CODE;
+    m.status = V2_OK;
+    m.flags = V2_F_DATA;
+    m.size = 0;
+    m.offset = 0;
+    m.id = 0;
+    m.data = buf;
+    while ((n = list_fill(&ls, buf, MAX_BLOCK_SIZE - V2_HDR_SIZE)) > 0)
+    {
+        if (fill.slot >= 0 && len + n <= DIRCACHE_MAX)
+            memcpy(v2_listbuf + len, buf, n);
+        len += n;
+        m.len = n;
+        if (v2_send(sd, &m) < 0)
+        {
+            break;
+        }
+    }
+    dircache_put(&fill, v2_listbuf, (n == 0 && ls.done) ? len : -1);
+    alog_bytes(len);
+    m.flags = V2_F_END;
+    m.size = ls.count;
+    m.offset = ls.done ? 0 : ls.cursor;
+    m.len = 0;
+    list_close(&ls);
+    if (n > 0 || v2_send(sd, &m) < 0)
+    {
+        log_error("[dir] failed to write server response.", log_path);
+        return;
+    }
+    log_file("[dir] function successfully executed.", log_path);
+}
+
+static void v2_match(int sd, struct v2_msg *req, char *log_path)
+{
+    char pattern[MAX_BLOCK_SIZE];
+    char files[MAX_BLOCK_SIZE];
+    struct v2_msg rep;
+    int nr, count;
+
+    log_debug("[match] match command received.", log_path);
+    v2_name(req, pattern);
+    if ((nr = match_dir(pattern, req->offset, files, MAX_BLOCK_SIZE - V2_HDR_SIZE, &count, log_path)) < 0)
+    {
+        v2_reply(sd, MATCH_CODE, V2_ERROR, 0, log_path);
+        return;
+    }
+    rep.op = MATCH_CODE;
+    rep.status = V2_OK;
+    rep.flags = 0;
+    rep.size = count;
+    rep.offset = req->offset;
+    rep.id = 0;
+    rep.data = files;
+    rep.len = nr;
+    alog_reply(V2_OK);
+    if (v2_send(sd, &rep) < 0)
+    {
+        log_error("[match] failed to write server response.", log_path);
+    }
+}
+
+//stream the tree of the directory named in the request
+static void v2_tree_get(int sd, struct v2_msg *req, char *log_path)
+{
+    char path[MAX_BLOCK_SIZE], root[PATH_MAX];
+    struct tree_stats ts;
+
+    log_debug("[tree] tree get command received.", log_path);
+    v2_name(req, path);
+    if (tree_root(path, root) < 0)
+    {
+        v2_reply(sd, TREE_GET_CODE, V2_NOT_FOUND, 0, log_path);
+        log_error("[tree] Directory does not exist on server.", log_path);
+        return;
+    }
+    v2_reply(sd, TREE_GET_CODE, V2_OK, 0, log_path);
+    if (tree_send(sd, TREE_GET_CODE, path, bulk_size, &ts) < 0)
+    {
+        log_error("[tree] failed to send tree.", log_path);
+        return;
+    }
+    alog_bytes(ts.bytes);
+    log_file("[tree] tree is sent to client.", log_path);
+}
+
+//recreate the tree the client streams, named in the request
+static void v2_tree_put(int sd, struct v2_msg *req, char *log_path)
+{
+    char root[MAX_BLOCK_SIZE];
+    struct tree_stats ts;
+    char status = V2_OK;
+
+    log_debug("[tree] tree put command received.", log_path);
+    v2_name(req, root);
+    //the tree goes into a new directory of the current one
+    if (root[0] == '\0' || strchr(root, '/') != NULL || strcmp(root, ".") == 0 || strcmp(root, "..") == 0)
+    {
+        status = V2_ERROR;
+    }
+    else if (access(root, F_OK) == 0)
+    {
+        status = V2_CLASH;
+        log_error("[tree] tree clash error.", log_path);
+    }
+    v2_reply(sd, TREE_PUT_CODE, status, 0, log_path);
+    if (status != V2_OK)
+    {
+        return;
+    }
+    if (tree_recv(sd, TREE_PUT_CODE, root, 0, tree_modes, bulk_size, &ts) < 0)
+    {
+        log_error("[tree] failed to read tree.", log_path);
+        return;
+    }
+    //V2_ERROR if any entry could not be stored, the size is the bytes stored
+    alog_bytes(ts.bytes);
+    v2_reply(sd, TREE_PUT_CODE, ts.failed == 0 ? V2_OK : V2_ERROR, ts.bytes, log_path);
+    log_file("[tree] tree put command finished.", log_path);
+}
+
+//agree on the codec of packed transfers
+static void v2_comp(int sd, struct v2_msg *req, char *log_path)
+{
+    log_debug("[comp] compression command received.", log_path);
+    comp_codec = comp_choose(req->size);
+    v2_reply(sd, COMP_CODE, V2_OK, comp_codec, log_path);
+}
+
+//counters of the server, as text in as many frames as it takes
+static void v2_stat(int sd, char *log_path)
+{
+    static char *text = NULL;
+    struct v2_msg m;
+    int n, len;
+
+    log_debug("[stat] stat command received.", log_path);
+    if (text == NULL && (text = malloc(METRICS_TEXT_MAX)) == NULL)
+    {
+        v2_reply(sd, STAT_CODE, V2_ERROR, 0, log_path);
+        return;
+    }
+    len = metrics_text(text, METRICS_TEXT_MAX);
+    v2_reply(sd, STAT_CODE, V2_OK, len, log_path);
+    m.op = STAT_CODE;
+    m.status = V2_OK;
+    m.flags = V2_F_DATA;
+    m.size = 0;
+    m.offset = 0;
+    m.id = 0;
+    for (n = 0; n < len; n += m.len)
+    {
+        m.data = text + n;
+        m.len = (len - n < MAX_BLOCK_SIZE - V2_HDR_SIZE) ? len - n : MAX_BLOCK_SIZE - V2_HDR_SIZE;
+        if (v2_send(sd, &m) < 0)
+        {
+            log_error("[stat] failed to write server response.", log_path);
+            return;
+        }
+    }
+    alog_bytes(len);
+    m.flags = V2_F_END;
+    m.size = len;
+    m.data = NULL;
+    m.len = 0;
+    if (v2_send(sd, &m) < 0)
+    {
+        log_error("[stat] failed to write server response.", log_path);
+        return;
+    }
+    log_file("[stat] function successfully executed.", log_path);
+}
+
+//checksum a file here without sending it
+static void v2_sum(int sd, struct v2_msg *req, char *log_path)
+{
+    char filename[MAX_BLOCK_SIZE];
+    struct v2_msg rep;
+    struct stat fst;
+    uint32_t crc;
+    int fd;
+
+    log_debug("[sum] sum command received.", log_path);
+    v2_name(req, filename);
+    if ((fd = open(filename, O_RDONLY)) < 0 || fstat(fd, &fst) < 0 || !S_ISREG(fst.st_mode))
+    {
+        if (fd >= 0)
+            close(fd);
+        v2_reply(sd, SUM_CODE, V2_NOT_FOUND, 0, log_path);
+        log_error("[sum] File does not exist on server.", log_path);
+        return;
+    }
+    rep.op = SUM_CODE;
+    rep.status = (crc32c_file(fd, 0, fst.st_size, &crc) < 0) ? V2_ERROR : V2_OK;
+    rep.flags = 0;
+    rep.size = fst.st_size;
+    rep.offset = (rep.status == V2_OK) ? crc : 0;
+    rep.id = 0;
+    rep.data = NULL;
+    rep.len = 0;
+    close(fd);
+    alog_reply(rep.status);
+    if (v2_send(sd, &rep) < 0)
+    {
+        log_error("[sum] failed to write server response.", log_path);
+        return;
+    }
+    log_file("[sum] checksum is sent to client.", log_path);
+}
+
+static void v2_cd(int sd, struct v2_msg *req, char *log_path)
+{
+    char path[MAX_BLOCK_SIZE];
+
+    log_debug("[CD] CD command received.", log_path);
+    v2_name(req, path);
+    if (chdir(path) == 0)
+    {
+        v2_reply(sd, CD_CODE, V2_OK, 0, log_path);
+        log_file("[CD] status is ready.", log_path);
+    }
+    else
+    {
+        v2_reply(sd, CD_CODE, V2_ERROR, 0, log_path);
+        log_error("[CD] status is error.", log_path);
+    }
+}
+
+static void v2_blk(int sd, struct v2_msg *req, char *log_path)
+{
+    int size;
+
+    log_debug("[blk] block size command received.", log_path);
+    if ((size = accept_bulk_size(req->size)) < 0)
+    {
+        v2_reply(sd, BLK_CODE, V2_ERROR, bulk_size, log_path);
+        return;
+    }
+    bulk_size = size;
+    v2_reply(sd, BLK_CODE, V2_OK, bulk_size, log_path);
+}
+
+static void v2_get(int sd, struct v2_msg *req, char *log_path)
+{
+    char filename[MAX_BLOCK_SIZE];
+    struct v2_msg rep;
+    struct stat fst;
+    uint32_t crc;
+    off_t nr;
+    int fd;
+
+    log_debug("[get] get command received.", log_path);
+    v2_name(req, filename);
+    if ((fd = open(filename, O_RDONLY)) < 0 || fstat(fd, &fst) < 0 || !S_ISREG(fst.st_mode))
+    {
+        if (fd >= 0)
+            close(fd);
+        v2_reply(sd, GET_CODE1, V2_NOT_FOUND, 0, log_path);
+        log_error("[get] File does not exist on server.", log_path);
+        return;
+    }
+    //a resumed GET goes on only if the client has a prefix of the file
+    if (req->offset < 0 || req->offset > fst.st_size ||
+        ((req->flags & V2_F_CHECK) && (crc32c_file(fd, 0, req->offset, &crc) < 0 || crc != (uint32_t)req->size)))
+    {
+        close(fd);
+        v2_reply(sd, GET_CODE1, V2_MISMATCH, fst.st_size, log_path);
+        log_error("[get] partial file of client does not match.", log_path);
+        return;
+    }
+    //the data follows the reply straight away, then the trailer
+    rep.op = GET_CODE1;
+    rep.status = V2_OK;
+    rep.flags = (req->flags & V2_F_PACKED) && comp_codec != COMP_RAW ? V2_F_PACKED : 0;
+    rep.size = fst.st_size;
+    rep.offset = 0;
+    rep.id = 0;
+    rep.data = NULL;
+    rep.len = 0;
+    alog_reply(V2_OK);
+    if (v2_send(sd, &rep) < 0)
+        nr = -1;
+    else if (rep.flags & V2_F_PACKED)
+        nr = sendpackedfile(sd, fd, req->offset, fst.st_size - req->offset, bulk_size, comp_codec);
+    else
+        nr = sendbulkfile(sd, fd, req->offset, fst.st_size - req->offset, bulk_size);
+    alog_bytes(nr);
+    if (nr < 0 || v2_trailer(sd, GET_CODE1, nr) < 0)
+    {
+        log_error("[get] failed to send file.", log_path);
+    }
+    else if (nr < fst.st_size - req->offset)
+    {
+        log_error("[get] File shrank while it was sent.", log_path);
+    }
+    else
+    {
+        log_file("[get] File is sent to client.", log_path);
+    }
+    close(fd);
+}
+
+//send the slice of a file asked for by a ranged GET
+static void v2_range(int sd, struct v2_msg *req, char *log_path)
+{
+    char filename[MAX_BLOCK_SIZE];
+    struct stat fst;
+    off_t count, nr;
+    int fd;
+
+    log_debug("[range] ranged get command received.", log_path);
+    v2_name(req, filename);
+    if ((fd = open(filename, O_RDONLY)) < 0 || fstat(fd, &fst) < 0 || !S_ISREG(fst.st_mode))
+    {
+        if (fd >= 0)
+            close(fd);
+        v2_reply(sd, RANGE_CODE, V2_NOT_FOUND, 0, log_path);
+        log_error("[range] File does not exist on server.", log_path);
+        return;
+    }
+    if (req->offset < 0 || req->offset > fst.st_size || req->size < 0)
+    {
+        close(fd);
+        v2_reply(sd, RANGE_CODE, V2_ERROR, fst.st_size, log_path);
+        log_error("[range] range is outside the file.", log_path);
+        return;
+    }
+    count = fst.st_size - req->offset;
+    if (req->size < count)
+        count = req->size;
+    //the slice is read in place, the file offset is never moved
+    v2_reply(sd, RANGE_CODE, V2_OK, fst.st_size, log_path);
+    nr = sendbulkfile(sd, fd, req->offset, count, bulk_size);
+    alog_bytes(nr);
+    if (nr < 0 || v2_trailer(sd, RANGE_CODE, nr) < 0)
+    {
+        log_error("[range] failed to send file.", log_path);
+    }
+    else
+    {
+        log_file("[range] slice is sent to client.", log_path);
+    }
+    close(fd);
+}
+
+static void v2_put(int sd, struct v2_msg *req, char *log_path)
+{
+    char filename[MAX_BLOCK_SIZE];
+    char buf[MAX_BLOCK_SIZE];
+    struct v2_msg trailer, rep;
+    char status = V2_OK;
+    off_t start = 0, total, committed, nr;
+    uint32_t crc = 0;
+    int checked = 0, fd = -1, resume = (req->flags & V2_F_RESUME) != 0, packed = (req->flags & V2_F_PACKED) != 0;
+
+    log_debug("[put] put command received.", log_path);
+    v2_name(req, filename);
+    //only finished uploads clash, a dropped one waits in its part file
+    if (access(filename, R_OK) == 0)
+    {
+        status = V2_CLASH;
+        log_error("[put] put clash error.", log_path);
+    }
+    else if ((fd = journal_open(filename, req->size, resume, &start)) < 0)
+    {
+        status = V2_ERROR;
+        log_error("[put] put failed.", log_path);
+    }
+    //a resumed upload is told where its data goes on, a refused one ends here
+    if (resume)
+    {
+        rep.op = PUT_CODE1;
+        rep.status = status;
+        rep.flags = 0;
+        rep.size = 0;
+        rep.offset = start;
+        rep.id = 0;
+        rep.data = NULL;
+        rep.len = 0;
+        alog_reply(status);
+        if (v2_send(sd, &rep) < 0 || status != V2_OK)
+        {
+            if (fd >= 0)
+                close(fd);
+            return;
+        }
+        if (start > 0)
+            log_file("[put] upload resumed from journal.", log_path);
+    }
+    //otherwise the data is already on its way, a refused file is drained
+    total = committed = start;
+    while ((nr = (packed ? recvpackedframe : recvbulkframe)(sd, status == V2_OK ? fd : -1, total, bulk_size)) != 0)
+    {
+        //a write error or a frame too large fails the file, the rest is drained
+        if (nr == -2 || nr == -3)
+        {
+            if (status == V2_OK)
+                log_error(nr == -2 ? "[put] failed to write file." : "[put] frame larger than the block size.", log_path);
+            status = (status == V2_OK) ? V2_ERROR : status;
+            continue;
+        }
+        if (nr < 0)
+            break;
+        total += nr;
+        alog_bytes(nr);
+        //record the progress now and then so a dropped upload can go on
+        if (status == V2_OK && total - committed >= JOURNAL_STEP && journal_commit(filename, fd, req->size, total) == 0)
+            committed = total;
+    }
+    if (nr != 0 || v2_recv(sd, &trailer, buf) < 0 || trailer.op != PUT_CODE1)
+    {
+        log_error("[put] failed to read file.", log_path);
+        if (status == V2_OK)
+            journal_commit(filename, fd, req->size, total);
+        if (fd >= 0)
+            close(fd);
+        return;
+    }
+    //data that did not land as it left never gets the name
+    if ((checked = v2_check(sd, &trailer, total - start, &crc)) < 0 && status == V2_OK)
+    {
+        status = V2_MISMATCH;
+        log_error("[put] file data damaged, checksum does not match.", log_path);
+    }
+    //the trailer counts from start, a file that shrank on the client loses its padding
+    if (status == V2_OK && (start + trailer.size > total || journal_finish(filename, fd, start + trailer.size) < 0))
+    {
+        status = V2_ERROR;
+        log_error("[put] file size does not match trailer.", log_path);
+    }
+    if (fd >= 0)
+        close(fd);
+    rep.op = PUT_CODE1;
+    rep.status = status;
+    rep.flags = checked ? V2_F_CHECK : 0;
+    rep.size = start + trailer.size;
+    rep.offset = checked ? crc : 0;
+    rep.id = 0;
+    rep.data = NULL;
+    rep.len = 0;
+    alog_reply(status);
+    if (v2_send(sd, &rep) < 0)
+    {
+        log_error("[put] failed to write server response.", log_path);
+        return;
+    }
+    log_file("[put] put command finished.", log_path);
+}
+
+//rebuild a file from the copy here and the delta the client sends
+static void v2_delta(int sd, struct v2_msg *req, char *log_path)
+{
+    char filename[MAX_BLOCK_SIZE];
+    struct delta_stats ds;
+    struct v2_msg rep;
+    struct stat fst;
+    char status = V2_OK;
+    uint32_t crc;
+    off_t start;
+    int old, fd = -1, block, nr;
+
+    log_debug("[delta] delta put command received.", log_path);
+    v2_name(req, filename);
+    //without a copy to start from the client falls back to PUT
+    if ((old = open(filename, O_RDONLY)) < 0 || fstat(old, &fst) < 0 || !S_ISREG(fst.st_mode))
+    {
+        if (old >= 0)
+            close(old);
+        v2_reply(sd, DELTA_CODE, V2_NOT_FOUND, 0, log_path);
+        log_error("[delta] File does not exist on server.", log_path);
+        return;
+    }
+    if (req->size < 0 || (fd = journal_open(filename, req->size, 0, &start)) < 0)
+    {
+        close(old);
+        v2_reply(sd, DELTA_CODE, V2_ERROR, 0, log_path);
+        log_error("[delta] delta put failed.", log_path);
+        return;
+    }
+    block = delta_block(fst.st_size);
+    rep.op = DELTA_CODE;
+    rep.status = V2_OK;
+    rep.flags = 0;
+    rep.size = fst.st_size;
+    rep.offset = block;
+    rep.id = 0;
+    rep.data = NULL;
+    rep.len = 0;
+    alog_reply(V2_OK);
+    if (v2_send(sd, &rep) < 0 || delta_sigs(sd, old, fst.st_size, block, bulk_size) < 0 ||
+        (nr = delta_recv(sd, DELTA_CODE, old, fst.st_size, fd, bulk_size, &ds)) == -1)
+    {
+        log_error("[delta] failed to read delta.", log_path);
+        close(old);
+        close(fd);
+        return;
+    }
+    close(old);
+    //the old copy is replaced only by a file that matches the client's
+    if (nr < 0)
+    {
+        status = V2_ERROR;
+        log_error("[delta] failed to build file.", log_path);
+    }
+    else if (crc32c_file(fd, 0, ds.size, &crc) < 0 || crc != ds.crc)
+    {
+        status = V2_MISMATCH;
+        log_error("[delta] rebuilt file does not match.", log_path);
+    }
+    else if (fchmod(fd, fst.st_mode & 07777) < 0 || journal_finish(filename, fd, ds.size) < 0)
+    {
+        status = V2_ERROR;
+        log_error("[delta] failed to rename file.", log_path);
+    }
+    close(fd);
+    rep.status = status;
+    rep.size = ds.size;
+    rep.offset = ds.literal;
+    alog_bytes(ds.literal);
+    alog_reply(status);
+    if (v2_send(sd, &rep) < 0)
+    {
+        log_error("[delta] failed to write server response.", log_path);
+        return;
+    }
+    log_file("[delta] delta put command finished.", log_path);
+}
+
+//access log records of the transfers of a mux session, one per stream slot
+static struct alog mux_alog[MUX_MAX_STREAMS];
+
+//queue the reply of mux request id
+static void v2_mux_reply(struct mux *mx, unsigned int id, char op, char status, long long size, char *data, int len)
+{
+    struct v2_msg rep;
+
+    alog_reply(status);
+    rep.op = op;
+    rep.status = status;
+    rep.flags = 0;
+    rep.size = size;
+    rep.offset = 0;
+    rep.id = id;
+    rep.data = data;
+    rep.len = len;
+    mux_queue(mx, &rep);
+}
+
+//a GET of a mux session is sent, its record goes to the access log
+static void v2_mux_sent(struct mux *mx, struct mux_stream *st)
+{
+    alog_cur = &mux_alog[st - mx->st];
+    alog_bytes(st->done);
+    alog_reply(st->status);
+    alog_end();
+    alog_cur = NULL;
+}
+
+//serve one request of a mux session, returns 1 once the session ends.
+//The request has a record of its own in the access log, the client of
+//the session record "session", kept open while its data moves
+static int v2_mux_request(struct mux *mx, struct v2_msg *req, struct alog *session, char *log_path)
+{
+    char name[MAX_BLOCK_SIZE];
+    char files[MAX_BLOCK_SIZE];
+    struct mux_stream *st = NULL;
+    struct alog rec;
+    struct stat fst;
+    off_t start;
+    int fd, nr;
+
+    if (req->op == MUX_CODE)
+    {
+        v2_mux_reply(mx, req->id, MUX_CODE, V2_OK, 0, NULL, 0);
+        return 1;
+    }
+    memcpy(&rec, session, sizeof(struct alog));
+    alog_cur = &rec;
+    alog_begin(req->op, 2);
+    alog_name(req->data, req->len);
+    if (req->len >= MAX_BLOCK_SIZE)
+    {
+        v2_mux_reply(mx, req->id, req->op, V2_ERROR, 0, NULL, 0);
+        alog_end();
+        alog_cur = NULL;
+        return 0;
+    }
+    v2_name(req, name);
+    switch (req->op)
+    {
+    case PWD_CODE:
+        if (getcwd(files, MAX_BLOCK_SIZE - V2_HDR_SIZE) == NULL)
+            v2_mux_reply(mx, req->id, PWD_CODE, V2_ERROR, 0, NULL, 0);
+        else
+            v2_mux_reply(mx, req->id, PWD_CODE, V2_OK, 0, files, strlen(files));
+        break;
+    case DIR_CODE:
+        if ((nr = list_dir(files, MAX_BLOCK_SIZE - V2_HDR_SIZE, log_path)) < 0)
+            v2_mux_reply(mx, req->id, DIR_CODE, V2_ERROR, 0, NULL, 0);
+        else
+            v2_mux_reply(mx, req->id, DIR_CODE, V2_OK, 0, files, nr);
+        break;
+    case CD_CODE:
+        v2_mux_reply(mx, req->id, CD_CODE, chdir(name) == 0 ? V2_OK : V2_ERROR, 0, NULL, 0);
+        break;
+    case GET_CODE1:
+        log_debug("[get] get command received.", log_path);
+        if ((fd = open(name, O_RDONLY)) < 0 || fstat(fd, &fst) < 0 || !S_ISREG(fst.st_mode))
+        {
+            if (fd >= 0)
+                close(fd);
+            v2_mux_reply(mx, req->id, GET_CODE1, V2_NOT_FOUND, 0, NULL, 0);
+            log_error("[get] File does not exist on server.", log_path);
+            break;
+        }
+        //the data frames follow the reply
+        if ((st = mux_add(mx, req->id, GET_CODE1, fd, fst.st_size, 1)) == NULL)
+        {
+            close(fd);
+            v2_mux_reply(mx, req->id, GET_CODE1, V2_ERROR, 0, NULL, 0);
+            log_error("[get] too many transfers in flight.", log_path);
+            break;
+        }
+        v2_mux_reply(mx, req->id, GET_CODE1, V2_OK, fst.st_size, NULL, 0);
+        break;
+    case PUT_CODE1:
+        log_debug("[put] put command received.", log_path);
+        //a refused file is answered at once, its data frames are dropped
+        if (access(name, R_OK) == 0)
+        {
+            v2_mux_reply(mx, req->id, PUT_CODE1, V2_CLASH, 0, NULL, 0);
+            log_error("[put] put clash error.", log_path);
+            break;
+        }
+        if (strlen(name) >= MUX_NAME_MAX || (fd = journal_open(name, req->size, 0, &start)) < 0)
+        {
+            v2_mux_reply(mx, req->id, PUT_CODE1, V2_ERROR, 0, NULL, 0);
+            log_error("[put] put failed.", log_path);
+            break;
+        }
+        if ((st = mux_add(mx, req->id, PUT_CODE1, fd, req->size, 0)) == NULL)
+        {
+            close(fd);
+            v2_mux_reply(mx, req->id, PUT_CODE1, V2_ERROR, 0, NULL, 0);
+            log_error("[put] too many transfers in flight.", log_path);
+            break;
+        }
+        //the part file is renamed once the data ends
+        strcpy(st->name, name);
+        break;
+    default:
+        v2_mux_reply(mx, req->id, req->op, V2_UNSUPPORTED, 0, NULL, 0);
+        break;
+    }
+    //a transfer is logged once its data has moved
+    if (st != NULL)
+        memcpy(&mux_alog[st - mx->st], &rec, sizeof(struct alog));
+    else
+        alog_end();
+    alog_cur = NULL;
+    return 0;
+}
+
+//serve a mux session until the client ends it or the connection breaks
+//the session is one command of the access log and each of its requests
+//another, whose bytes are the file data of that request
+static void v2_mux(int sd, char *log_path)
+{
+    struct mux mx;
+    struct mux_stream *st;
+    struct v2_msg m;
+    struct alog *alog = alog_cur;
+    int i, nr, done = 0;
+
+    log_file("[mux] mux session started.", log_path);
+    v2_reply(sd, MUX_CODE, V2_OK, 0, log_path);
+    if (mux_open(&mx, sd) < 0)
+    {
+        log_error("[mux] failed to start mux session.", log_path);
+        return;
+    }
+    mx.sent = v2_mux_sent;
+    memset(mux_alog, 0, sizeof(mux_alog));
+    //a request that fails does not fail the session
+    alog_cur = NULL;
+    while (!done)
+    {
+        while (!done && (nr = mux_next(&mx, &m)) > 0)
+        {
+            if ((m.flags & (V2_F_DATA | V2_F_CREDIT)) == 0)
+            {
+                done = v2_mux_request(&mx, &m, alog, log_path);
+            }
+            else if ((st = mux_data(&mx, &m)) != NULL)
+            {
+                //the upload is complete, give it its name and answer it
+                alog_cur = &mux_alog[st - mx.st];
+                alog_bytes(st->done);
+                if (st->status == V2_OK && journal_finish(st->name, st->fd, st->done) < 0)
+                    st->status = V2_ERROR;
+                v2_mux_reply(&mx, st->id, PUT_CODE1, st->status, st->done, NULL, 0);
+                if (st->status == V2_OK)
+                    log_file("[put] put command finished.", log_path);
+                else if (st->status == V2_MISMATCH)
+                    log_error("[put] file data damaged, checksum does not match.", log_path);
+                else
+                    log_error("[put] failed to write file.", log_path);
+                alog_end();
+                alog_cur = NULL;
+                mux_end(&mx, st);
+            }
+        }
+        if (!done && (nr < 0 || mux_io(&mx) < 0))
+        {
+            alog_cur = alog;
+            log_error("[mux] mux session broken.", log_path);
+            break;
+        }
+    }
+    //transfers still in flight did not finish
+    for (i = 0; i < MUX_MAX_STREAMS; i++)
+    {
+        if (mux_alog[i].op == 0)
+            continue;
+        alog_cur = &mux_alog[i];
+        alog_bytes(mx.st[i].done);
+        alog_fail();
+        alog_end();
+    }
+    alog_cur = alog;
+    mux_close(&mx);
+    log_file("[mux] mux session ended.", log_path);
+}
+
+void serve_v2(int sd, char *buf, int len, char *log_path)
+{
+    struct v2_msg req;
+
+    if (v2_parse(buf, len, &req) < 0)
+    {
+        return;
+    }
+    alog_name(req.data, req.len);
+    //file data moved without a copy is summed only if the client asks
+    stream_readback(sd, (req.flags & V2_F_SUM) != 0);
+    if (req.op == PWD_CODE)
+    {
+        v2_pwd(sd, log_path);
+    }
+    else if (req.op == DIR_CODE)
+    {
+        v2_dir(sd, log_path);
+    }
+    else if (req.op == LIST_CODE)
+    {
+        v2_list(sd, &req, log_path);
+    }
+    else if (req.op == CD_CODE)
+    {
+        v2_cd(sd, &req, log_path);
+    }
+    else if (req.op == MATCH_CODE)
+    {
+        v2_match(sd, &req, log_path);
+    }
+    else if (req.op == COMP_CODE)
+    {
+        v2_comp(sd, &req, log_path);
+    }
+    else if (req.op == TREE_GET_CODE)
+    {
+        v2_tree_get(sd, &req, log_path);
+    }
+    else if (req.op == TREE_PUT_CODE)
+    {
+        v2_tree_put(sd, &req, log_path);
+    }
+    else if (req.op == BLK_CODE)
+    {
+        v2_blk(sd, &req, log_path);
+    }
+    else if (req.op == GET_CODE1)
+    {
+        v2_get(sd, &req, log_path);
+    }
+    else if (req.op == PUT_CODE1)
+    {
+        v2_put(sd, &req, log_path);
+    }
+    else if (req.op == SUM_CODE)
+    {
+        v2_sum(sd, &req, log_path);
+    }
+    else if (req.op == STAT_CODE)
+    {
+        v2_stat(sd, log_path);
+    }
+    else if (req.op == DELTA_CODE)
+    {
+        v2_delta(sd, &req, log_path);
+    }
+    else if (req.op == RANGE_CODE)
+    {
+        v2_range(sd, &req, log_path);
+    }
+    else if (req.op == MUX_CODE)
+    {
+        v2_mux(sd, log_path);
+    }
+    else
+    {
+        v2_reply(sd, req.op, V2_UNSUPPORTED, 0, log_path);
+    }
+}
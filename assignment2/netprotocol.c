@@ -0,0 +1,122 @@
+/**
+ * file:        netprotocol.c
+ * Author:      Seow Wei Cheng (33753618) and Jin Min Seok (33884206)
+ * Date:        17/10/2026 (version 1)
+ * Purpose:     Encoding of the version 2 messages described in netprotocol.h
+ *              shared by the client and the server
+ */
+#include <string.h>
+#include <stdint.h>
+#include <netinet/in.h> /* htonl(), ntohl() */
+#include "stream.h"
+#include "netprotocol.h"
+
+//64-bit values go high word first, each word in network byte order
+static void put64(char *buf, long long v)
+{
+    uint32_t w;
+
+    w = htonl((uint32_t)((unsigned long long)v >> 32));
+    memcpy(buf, &w, 4);
+    w = htonl((uint32_t)v);
+    memcpy(buf + 4, &w, 4);
+}
+
+static long long get64(char *buf)
+{
+    uint32_t hi, lo;
+
+    memcpy(&hi, buf, 4);
+    memcpy(&lo, buf + 4, 4);
+    return (long long)(((unsigned long long)ntohl(hi) << 32) | ntohl(lo));
+}
+
+int v2_pack(char *buf, struct v2_msg *m)
+{
+    uint32_t id;
+
+    buf[0] = V2_CODE;
+    buf[1] = m->op;
+    buf[2] = m->status;
+    buf[3] = m->flags;
+    put64(&buf[4], m->size);
+    put64(&buf[12], m->offset);
+    id = htonl(m->id);
+    memcpy(&buf[20], &id, 4);
+    if (m->len > 0)
+    {
+        memcpy(&buf[V2_HDR_SIZE], m->data, m->len);
+    }
+    return V2_HDR_SIZE + m->len;
+}
+
+int v2_send(int sd, struct v2_msg *m)
+{
+    char buf[MAX_BLOCK_SIZE];
+
+    if (m->len < 0 || m->len > MAX_BLOCK_SIZE - V2_HDR_SIZE)
+    {
+        return -3; //payload too large for one frame
+    }
+    return writen(sd, buf, v2_pack(buf, m));
+}
+
+int v2_parse(char *buf, int len, struct v2_msg *m)
+{
+    uint32_t id;
+
+    if (len < V2_HDR_SIZE || buf[0] != V2_CODE)
+    {
+        return -2;
+    }
+    m->op = buf[1];
+    m->status = buf[2];
+    m->flags = buf[3];
+    m->size = get64(&buf[4]);
+    m->offset = get64(&buf[12]);
+    memcpy(&id, &buf[20], 4);
+    m->id = ntohl(id);
+    m->data = &buf[V2_HDR_SIZE];
+    m->len = len - V2_HDR_SIZE;
+    return 0;
+}
+
+int v2_recv(int sd, struct v2_msg *m, char *buf)
+{
+    int nr;
+
+    if ((nr = readn(sd, buf, MAX_BLOCK_SIZE)) <= 0)
+    {
+        return (nr == 0) ? -1 : nr;
+    }
+    return v2_parse(buf, nr, m);
+}
+
+int v2_trailer(int sd, char op, long long size)
+{
+    struct v2_msg m;
+    uint32_t crc;
+
+    m.op = op;
+    m.status = V2_OK;
+    m.flags = 0;
+    m.size = size;
+    m.offset = 0;
+    if (stream_sum(sd, &crc) == 0)
+    {
+        m.flags = V2_F_CHECK;
+        m.offset = crc;
+    }
+    m.id = 0;
+    m.data = NULL;
+    m.len = 0;
+    return v2_send(sd, &m);
+}
+
+int v2_check(int sd, struct v2_msg *trailer, long long received, uint32_t *crc)
+{
+    //the sum is taken even when it cannot be compared, it is for this file only
+    if (stream_sum(sd, crc) < 0 || !(trailer->flags & V2_F_CHECK) || trailer->size != received)
+        return 0;
+    return (*crc == (uint32_t)trailer->offset) ? 1 : -1;
+}
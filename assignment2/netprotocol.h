@@ -1,12 +1,15 @@
 /**
  * file:        netprotocol.h
  * Author:      Seow Wei Cheng (33753618) and Jin Min Seok (33884206)
- * Date:        13/11/2021 (version 2)
+ * Date:        17/10/2026 (version 3)
  * Purpose:     This is the network protocol description file
  *              This file defines the op code that is to be used
  *              for both client and server
- *  
+ *              Version 1 sends every field of a command as a frame of its own.
+ *              Version 2, at the end of this file, sends one request and one
+ *              reply per command. The server accepts both.
  */
+#include <stdint.h> /* uint32_t */
 
 #define PUT_CODE1 'P'
 #define PUT_CODE2 'R'
@@ -14,11 +17,17 @@
 #define PUT_CLASH_ERROR '1'
 #define PUT_DONE '0'
 #define PUT_FAIL '1'
+//sent instead of PUT_CODE2 when the file data follows the size
+//as bulk frames (see stream.h) instead of MAX_BLOCK_SIZE frames
+#define PUT_BULK_CODE2 'r'
 
 #define GET_CODE1 'G'
 #define GET_CODE2 'R'
 #define GET_READY '0'
 #define GET_NOT_FOUND '1'
+//GET whose file data follows the size as bulk frames (see stream.h)
+//instead of MAX_BLOCK_SIZE frames, the replies are those of GET_CODE1
+#define GET_BULK_CODE 'g'
 
 #define PWD_CODE 'W'
 #define PWD_READY '0'
@@ -31,3 +40,196 @@
 #define CD_CODE 'C'
 #define CD_READY '0'
 #define CD_ERROR '1'
+
+//agree on the bulk frame size of the connection, the request is followed
+//by the wanted size, the reply by the size the server accepted
+#define BLK_CODE 'B'
+#define BLK_READY '0'
+#define BLK_ERROR '1'
+
+/*
+ * Version 2 messages
+ * Every command is one request and one reply, each a single frame of
+ * readn()/writen() made of a V2_HDR_SIZE header and a payload:
+ *   byte 0       V2_CODE, tells a v2 request from a v1 op code
+ *   byte 1       op code of the command, the v1 first op codes are reused
+ *   byte 2       status of a reply, one of the V2_ codes below, '0' in requests
+ *   byte 3       flags, the V2_F_ bits below
+ *   bytes 4-11   size, 64-bit in network byte order: the file size of GET
+ *                replies, PUT requests and trailers, the wanted / agreed
+ *                bulk frame size of BLK
+ *   bytes 12-19  offset, 64-bit in network byte order, 0 when unused
+ *   bytes 20-23  request id, 32-bit in network byte order, 0 outside a
+ *                mux session
+ *   payload      file or directory name of a request,
+ *                current directory of a PWD reply, listing of a DIR reply
+ * GET: the reply is followed by the bulk frames of the file when its
+ *      status is V2_OK, then by a trailer. A GET with an offset resumes
+ *      a download: only the bytes from offset on are sent. With
+ *      V2_F_CHECK its size is the CRC-32C of the first offset bytes the
+ *      client already has (see crc32c.h), a file that does not start
+ *      with them is answered V2_MISMATCH.
+ * PUT: the request is followed right away by the bulk frames of the file
+ *      and a trailer, the reply comes once they are all received. The
+ *      server writes into a part file and gives it the name at the end.
+ *      A PUT with V2_F_RESUME gets a first reply before any data: V2_OK
+ *      with the offset the server already holds of an earlier upload of
+ *      the same size, the bulk frames from that offset and the trailer
+ *      (counting from the offset) follow, then the final reply. Any
+ *      other status of the first reply ends the command.
+ * The trailer is a message with the op code of the command whose size is
+ * the number of bytes really taken from the file. A file that shrinks
+ * while it is sent has its last frame padded; the receiver cuts the
+ * padding off at the trailer size. A file that grows is sent up to the
+ * size announced before the data. A trailer with V2_F_CHECK carries the
+ * CRC-32C of those bytes as its offset, the receiver compares it with
+ * the sum of what it stored: a GET client drops a damaged file, a PUT
+ * is answered V2_MISMATCH and the file keeps its old state. The final
+ * reply of a PUT carries the sum of the server the same way.
+ * Compressed data is always summed as it passes through a buffer. Data
+ * sent and stored without a copy (sendfile(), splice()) has to be read
+ * back from the file, so it is summed only when the GET, RANGE, PUT or
+ * tree request has V2_F_SUM, otherwise its trailer has no V2_F_CHECK.
+ *
+ * Mux sessions
+ * A MUX_CODE request, once answered V2_OK, turns the connection into a
+ * mux session until the client sends MUX_CODE again and gets its reply.
+ * The client sends nothing more until the reply of either MUX_CODE came.
+ * Inside the session every message is one bulk frame (see stream.h) of
+ * at most V2_HDR_SIZE + MUX_CHUNK bytes, and the client numbers its
+ * requests so several GET, PUT, DIR, PWD and CD can be in flight at once.
+ * Replies carry the id of their request and come in any order. The file
+ * data moves in data frames of its request id instead of bulk frames:
+ *   V2_F_DATA               offset is where the payload goes in the file
+ *   V2_F_DATA | V2_F_END    ends the data, size is the trailer size,
+ *                           with V2_F_CHECK offset is the CRC-32C of
+ *                           the data, a PUT that does not match it is
+ *                           answered V2_MISMATCH
+ *   V2_F_CREDIT             the receiver takes size more bytes of the id
+ * A sender has MUX_WINDOW bytes of credit per transfer and the data
+ * frames of all transfers go out in turn, so a large file neither fills
+ * the connection nor holds back the small ones. GET data follows its
+ * reply, PUT data follows its request, a refused PUT is answered at once
+ * and its data frames are dropped. Frames of unknown ids are ignored.
+ */
+#define V2_CODE 'V'
+#define V2_HDR_SIZE 24
+
+#define MUX_CODE 'M'
+
+//ranged GET: the request carries the offset and the number of bytes
+//wanted, the reply the size of the whole file. The bulk frames of the
+//slice, up to the end of the file, and the trailer follow as for GET.
+//A request for 0 bytes only asks for the size.
+#define RANGE_CODE 'S'
+
+//glob match: the regular files of the current directory whose names match
+//the pattern of the request, in sorted order. The request offset skips that
+//many matches, the reply carries as many of the next names as fit, each
+//ended by '\n', and its size is the number of matches in all.
+#define MATCH_CODE 'F'
+
+//directory trees, see tree.h: TREE_GET_CODE asks for the tree named in the
+//request, TREE_PUT_CODE sends one. The sending side streams every entry,
+//parents before their children, as a message of the op code whose payload
+//is the path of the entry (its first component is the name of the tree),
+//size the file size, offset the mtime in seconds and id the mode bits;
+//V2_F_DIR marks a directory. The data of a file follows its entry: nothing
+//for an empty file, one readn()/writen() frame for an entry with V2_F_DATA,
+//otherwise bulk frames and a trailer as for GET. A message with V2_F_END,
+//whose size is the number of entries, ends the tree.
+//TREE_GET: the reply, then the tree when it is V2_OK.
+//TREE_PUT: the reply tells whether to go ahead (a tree that exists on the
+//server is answered V2_CLASH), then the tree, then the final reply.
+#define TREE_GET_CODE 'T'
+#define TREE_PUT_CODE 'U'
+
+//compression: the request size is the bit mask of the codecs the client
+//has (see compress.h), 0 to turn it off, the reply size the codec chosen
+//for the connection, COMP_RAW if there is none in common. A GET or PUT
+//with V2_F_PACKED then moves its data as packed frames (see stream.h):
+//the client asks for it in a GET request and the server marks its reply
+//V2_F_PACKED when it packs, a PUT request with the flag is followed by
+//packed frames.
+#define COMP_CODE 'Z'
+
+//delta upload of a file the server already has a copy of, see delta.h. The
+//request carries the name and the size of the new file. A server without
+//a regular file of that name answers V2_NOT_FOUND and the client sends the
+//whole file with PUT instead. Otherwise the reply is V2_OK with the size of
+//the old copy and, as its offset, the block length, followed by bulk frames
+//of DELTA_SIG_SIZE byte signatures of every whole block. The client then
+//sends messages of the op code: a reference (no flags) copies size bytes at
+//offset of the old copy, V2_F_DATA is followed by one bulk frame of size
+//literal bytes, V2_F_END carries the size of the new file and, as its
+//offset, the CRC-32C of it. The server builds the new file in a part file
+//and renames it over the old copy only if the checksum matches, otherwise
+//the final reply is V2_MISMATCH. The final reply size is the size of the
+//new file, its offset the literal bytes received.
+#define DELTA_CODE 'Y'
+
+//checksum of a file of the server: the reply to the name of the request
+//has the file size as its size and the CRC-32C of the whole file as its
+//offset, no data is sent
+#define SUM_CODE 'K'
+
+//listing of the current directory with the type, size and mtime of every
+//entry, in as many frames as it takes (see listing.h). The request size is
+//the most entries wanted, 0 for all, its offset the cursor to go on from,
+//0 for the first entry. The V2_OK reply is followed by messages of the op
+//code with V2_F_DATA whose payload is packed entries, then one with
+//V2_F_END whose size is the number of entries sent and whose offset is the
+//cursor of the next page, 0 when the directory has no more entries.
+#define LIST_CODE 'L'
+
+//counters of the server in Prometheus text, see myftpd/metrics.c. The
+//V2_OK reply has the length of the text as its size and is followed by
+//messages of the op code with V2_F_DATA carrying the text, then one with
+//V2_F_END and no payload
+#define STAT_CODE 'Q'
+
+#define V2_F_DATA 0x01
+#define V2_F_END 0x02
+#define V2_F_CREDIT 0x04
+#define V2_F_CHECK 0x08
+#define V2_F_RESUME 0x10
+#define V2_F_DIR 0x20
+#define V2_F_PACKED 0x40
+#define V2_F_SUM 0x80
+
+#define V2_OK '0'
+#define V2_ERROR '1'       //command failed
+#define V2_NOT_FOUND '2'   //GET of a missing file
+#define V2_CLASH '3'       //PUT of a file that already exists
+#define V2_UNSUPPORTED '4' //op code not served
+#define V2_MISMATCH '5'    //resumed GET whose partial file is not a prefix
+
+struct v2_msg
+{
+    char op;
+    char status;
+    char flags;
+    long long size;
+    long long offset;
+    unsigned int id;
+    char *data; //payload, not null terminated
+    int len;
+};
+
+//write m as one frame, returns the writen() result
+int v2_send(int sd, struct v2_msg *m);
+//encode m into buf (at least V2_HDR_SIZE + m->len bytes), returns the frame length
+int v2_pack(char *buf, struct v2_msg *m);
+//decode the frame of len bytes in buf, m->data points into buf
+//returns 0, or -2 if it is not a v2 frame
+int v2_parse(char *buf, int len, struct v2_msg *m);
+//read one frame into buf (MAX_BLOCK_SIZE bytes) and decode it
+//returns 0, the readn() error, or -2 if it is not a v2 frame
+int v2_recv(int sd, struct v2_msg *m, char *buf);
+//send the trailer of a transfer that took size bytes from the file, with
+//the checksum of the data when the stream has one (see stream_sum())
+int v2_trailer(int sd, char op, long long size);
+//compare the checksum of the received bytes with that of the trailer, *crc
+//gets the former. Returns 1 if they match, 0 if there is nothing to
+//compare, -1 if the data was damaged on the way to the file
+int v2_check(int sd, struct v2_msg *trailer, long long received, uint32_t *crc);
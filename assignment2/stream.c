@@ -5,50 +5,747 @@
  *	 	routines for stream read and write. 
  */
 
+#define   _GNU_SOURCE
 #include  <unistd.h>
+#include  <stdlib.h>
+#include  <string.h>
+#include  <errno.h>
+#include  <stdint.h>
 #include  <sys/types.h>
+#include  <fcntl.h>  /* splice(), pipe2() */
+#include  <sys/sendfile.h> /* sendfile() */
+#include  <sys/socket.h> /* send(), MSG_MORE */
+#include  <sys/uio.h>  /* writev() */
 #include  <netinet/in.h> /* struct sockaddr_in, htons(), htonl(), */
+#include  <netinet/tcp.h> /* TCP_NODELAY */
 #include  "stream.h"
+#include  "compress.h"
+#include  "crc32c.h"
+
+/* buffered reader/writer of a connection, see stream_open() */
+struct stream {
+    char rbuf[STREAM_BUF_SIZE];   /* bytes read ahead */
+    int rpos, rlen;
+    char wbuf[STREAM_BUF_SIZE];   /* frames not written yet */
+    int wlen;
+    uint32_t crc;                 /* file data of the transfer going on */
+    int crcok;
+    uint32_t sum;                 /* file data of the last one, see */
+    int sumok;                    /* stream_sum() */
+    int readback;                 /* data moved without a copy is read */
+                                  /* back to be summed, stream_readback() */
+};
+
+static struct stream **streams;   /* indexed by descriptor */
+static int nstreams;
+
+static struct stream *lookup(int fd)
+{
+    return (fd >= 0 && fd < nstreams) ? streams[fd] : NULL;
+}
+
+/* write the whole iovec, returns 0 or -1 */
+static int writevfull(int fd, struct iovec *iov, int iovcnt)
+{
+    ssize_t nw;
+
+    while (iovcnt > 0) {
+        if ((nw = writev(fd, iov, iovcnt)) <= 0) {
+            if (nw < 0 && errno == EINTR)
+                continue;
+            return (-1);
+        }
+        /* skip what went out, resume in the middle of a part */
+        while (iovcnt > 0 && (size_t) nw >= iov->iov_len) {
+            nw -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char *) iov->iov_base + nw;
+            iov->iov_len -= nw;
+        }
+    }
+    return (0);
+}
+
+/* write out the frames buffered for fd, flags are those of send() */
+static int flush(int fd, int flags)
+{
+    struct stream *st = lookup(fd);
+    int n, nw;
+
+    if (st == NULL)
+        return (0);
+    for (n = 0; n < st->wlen; n += nw) {
+        nw = send(fd, st->wbuf + n, st->wlen - n, flags);
+        if (nw < 0 && errno == ENOTSOCK)
+            nw = write(fd, st->wbuf + n, st->wlen - n);
+        if (nw <= 0) {
+            if (nw < 0 && errno == EINTR) {
+                nw = 0;
+                continue;
+            }
+            return (-1);
+        }
+    }
+    st->wlen = 0;
+    return (0);
+}
+
+/* send a frame header and its payload, buffered if fd has a stream */
+static int sendframe(int fd, char *hdr, int hlen, char *buf, int nbytes)
+{
+    struct stream *st = lookup(fd);
+    struct iovec iov[2];
+
+    if (st != NULL && st->wlen + hlen + nbytes <= STREAM_BUF_SIZE) {
+        memcpy(st->wbuf + st->wlen, hdr, hlen);
+        if (nbytes > 0)
+            memcpy(st->wbuf + st->wlen + hlen, buf, nbytes);
+        st->wlen += hlen + nbytes;
+        return (nbytes);
+    }
+    if (flush(fd, 0) < 0)
+        return (-1);
+    if (st != NULL && hlen + nbytes <= STREAM_BUF_SIZE)
+        return (sendframe(fd, hdr, hlen, buf, nbytes));
+
+    /* header and payload in a single system call */
+    iov[0].iov_base = hdr;
+    iov[0].iov_len = hlen;
+    iov[1].iov_base = buf;
+    iov[1].iov_len = nbytes;
+    if (writevfull(fd, iov, nbytes > 0 ? 2 : 1) < 0)
+        return (-1);
+    return (nbytes);
+}
+
+/* take up to n bytes already read ahead for fd */
+static int takebuffered(int fd, char *buf, int n)
+{
+    struct stream *st = lookup(fd);
+
+    if (st == NULL || st->rlen == st->rpos)
+        return (0);
+    if (n > st->rlen - st->rpos)
+        n = st->rlen - st->rpos;
+    memcpy(buf, st->rbuf + st->rpos, n);
+    st->rpos += n;
+    return (n);
+}
+
+/* read exactly n bytes, returns n, 0 on end of stream or -1 */
+static int readfull(int fd, char *buf, int n)
+{
+    struct stream *st = lookup(fd);
+    int m, nr;
+
+    m = takebuffered(fd, buf, n);
+    /* a reply can only come once our request is out */
+    if (m < n && flush(fd, 0) < 0)
+        return (-1);
+    for (; m < n; m += nr) {
+        if (st != NULL && n - m < STREAM_BUF_SIZE) {
+            /* read ahead as much as the kernel has */
+            nr = read(fd, st->rbuf, STREAM_BUF_SIZE);
+            if (nr > 0) {
+                st->rpos = 0;
+                st->rlen = nr;
+                nr = takebuffered(fd, buf + m, n - m);
+            }
+        } else {
+            nr = read(fd, buf + m, n - m);
+        }
+        if (nr <= 0) {
+            if (nr < 0 && errno == EINTR) {
+                nr = 0;
+                continue;
+            }
+            return (nr);
+        }
+    }
+    return (n);
+}
+
+/* read and throw away the n bytes left of a frame that cannot be taken, */
+/* so the next read starts at the next frame. Returns 0 or -1 */
+static int skip(int fd, off_t n)
+{
+    char scrap[MAX_BLOCK_SIZE];
+    int len;
+
+    for (; n > 0; n -= len) {
+        len = (n < MAX_BLOCK_SIZE) ? n : MAX_BLOCK_SIZE;
+        if (readfull(fd, scrap, len) != len)
+            return (-1);
+    }
+    return (0);
+}
+
+/* add "len" bytes of file data moved over sd to its checksum, from buf, */
+/* or read back from fd at offset if buf is NULL and the transfer asked */
+/* for it. Data that is not summed leaves the transfer without a sum */
+static void sumdata(int sd, int fd, off_t offset, char *buf, off_t len)
+{
+    struct stream *st = lookup(sd);
+
+    if (st == NULL || len <= 0)
+        return;
+    if (buf != NULL)
+        st->crc = crc32c(st->crc, buf, len);
+    else if (fd < 0 || !st->readback || crc32c_range(fd, offset, len, &st->crc) < 0)
+        st->crcok = 0;
+}
+
+/* the empty frame ends the file, its checksum is ready */
+static void sumend(int sd)
+{
+    struct stream *st = lookup(sd);
+
+    if (st == NULL)
+        return;
+    st->sum = st->crc;
+    st->sumok = st->crcok;
+    st->crc = 0;
+    st->crcok = 1;
+}
+
+int stream_open(int fd)
+{
+    struct stream **p;
+    int n;
+
+    if (fd < 0)
+        return (-1);
+    if (fd >= nstreams) {
+        n = fd + 16;
+        if ((p = realloc(streams, n * sizeof(*p))) == NULL)
+            return (-1);
+        memset(p + nstreams, 0, (n - nstreams) * sizeof(*p));
+        streams = p;
+        nstreams = n;
+    }
+    if (streams[fd] == NULL && (streams[fd] = malloc(sizeof(struct stream))) == NULL)
+        return (-1);
+    streams[fd]->rpos = streams[fd]->rlen = streams[fd]->wlen = 0;
+    streams[fd]->crc = streams[fd]->sumok = 0;
+    streams[fd]->crcok = 1;
+    streams[fd]->readback = 0;
+    /* frames are already coalesced here, a short flush behind file data */
+    /* must not wait for the delayed ack of the peer (best effort) */
+    n = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &n, sizeof(n));
+    return (0);
+}
+
+int stream_flush(int fd)
+{
+    return (flush(fd, 0));
+}
+
+void stream_readback(int fd, int on)
+{
+    struct stream *st = lookup(fd);
+
+    if (st != NULL)
+        st->readback = on;
+}
+
+int stream_pending(int fd)
+{
+    struct stream *st = lookup(fd);
+
+    return (st == NULL ? 0 : st->rlen - st->rpos);
+}
+
+int stream_sum(int fd, uint32_t *crc)
+{
+    struct stream *st = lookup(fd);
+
+    if (st == NULL || !st->sumok)
+        return (-1);
+    *crc = st->sum;
+    st->sumok = 0;
+    return (0);
+}
+
+int stream_close(int fd)
+{
+    struct stream *st = lookup(fd);
+    int ret;
+
+    if (st == NULL)
+        return (0);
+    ret = flush(fd, 0);
+    free(st);
+    streams[fd] = NULL;
+    return (ret);
+}
 
 int readn(int fd, char *buf, int bufsize)
 {
-    short data_size;    /* sizeof (short) must be 2 */ 
-    int n, nr, len;
+    unsigned short data_size;    /* sizeof (short) must be 2 */
+    int nr, len;
 
     /* check buffer size len */
     if (bufsize < MAX_BLOCK_SIZE)
          return (-3);     /* buffer too small */
 
     /* get the size of data sent to me */
-    if (read(fd, (char *) &data_size, 1) != 1) return (-1);
-    if (read(fd, (char *) (&data_size)+1, 1) != 1) return (-1);
-    len = (int) ntohs(data_size);  /* convert to host byte order */ 
+    if (readfull(fd, (char *) &data_size, 2) != 2) return (-1);
+    len = (int) ntohs(data_size);  /* convert to host byte order */
+    if (len > MAX_BLOCK_SIZE)
+         return (-2);     /* not a frame of ours */
 
     /* read len number of bytes to buf */
-    for (n=0; n < len; n += nr) {
-        if ((nr = read(fd, buf+n, len-n)) <= 0) 
-            return (nr);       /* error in reading */
-    }
-    return (len); 
+    if (len > 0 && (nr = readfull(fd, buf, len)) != len)
+        return (nr);       /* error in reading */
+    return (len);
 }
 
 int writen(int fd, char *buf, int nbytes)
 {
     short data_size = nbytes;     /* short must be two bytes long */
-    int n, nw;
 
-    if (nbytes > MAX_BLOCK_SIZE) 
-         return (-3);    /* too many bytes to send in one go */ 
+    if (nbytes > MAX_BLOCK_SIZE)
+         return (-3);    /* too many bytes to send in one go */
 
-    /* send the data size */
-    data_size = htons(data_size);  
-    if (write(fd, (char *) &data_size, 1) != 1) return (-1);      
-    if (write(fd, (char *) (&data_size)+1, 1) != 1) return (-1);       
+    /* send the data size and nbytes together */
+    data_size = htons(data_size);
+    return (sendframe(fd, (char *) &data_size, 2, buf, nbytes));
+}
 
-    /* send nbytes */
-    for (n=0; n<nbytes; n += nw) {
-         if ((nw = write(fd, buf+n, nbytes-n)) <= 0)  
-             return (nw);    /* write error */
-    } 
+int readbulk(int fd, char *buf, int bufsize)
+{
+    uint32_t data_size;
+    off_t len;
+
+    if (readfull(fd, (char *) &data_size, 4) != 4) return (-1);
+    len = ntohl(data_size);
+    if (len > MAX_BULK_SIZE)
+        return (-2);     /* not a bulk frame */
+    if (len > bufsize)   /* buffer too small, the frame is passed over */
+        return (skip(fd, len) < 0 ? -1 : -3);
+    if (len > 0 && readfull(fd, buf, len) != len)
+        return (-1);
+    return (len);
+}
+
+int writebulk(int fd, char *buf, int nbytes)
+{
+    uint32_t data_size = htonl(nbytes);
+
+    if (nbytes > MAX_BULK_SIZE)
+        return (-3);    /* too many bytes to send in one go */
+    return (sendframe(fd, (char *) &data_size, 4, buf, nbytes));
+}
+
+off_t sendfilen(int sd, int fd, off_t offset, off_t count)
+{
+    off_t off = offset;
+    off_t n = 0, nw, len;
+    char zeros[MAX_BLOCK_SIZE];
+
+    /* buffered frames go first, in the same segment as the data */
+    if (flush(sd, MSG_MORE) < 0)
+        return (-1);
+
+    /* let the kernel move the file pages straight to the socket */
+    while (n < count) {
+        len = count - n;
+        if (len > (1L << 30))
+            len = 1L << 30;
+        if ((nw = sendfile(sd, fd, &off, len)) < 0) {
+            if (errno == EINTR)
+                continue;
+            return (-1);
+        }
+        if (nw == 0)
+            break;       /* file is shorter than announced */
+        n += nw;
+    }
+
+    /* pad a shrunk file so the stream length stays as announced */
+    memset(zeros, 0, sizeof(zeros));
+    for (len = n; len < count; len += nw) {
+        nw = count - len;
+        if (nw > (off_t)sizeof(zeros))
+            nw = sizeof(zeros);
+        if ((nw = write(sd, zeros, nw)) <= 0)
+            return (-1);
+    }
     return (n);
 }
+
+#define SPLICE_PIPE_SIZE (1024*1024)  /* bytes moved by one splice() */
+#define SPLICE_UNSUPPORTED (-4)
+
+/* copy loop of recvfilen(), for sockets or files splice() cannot handle */
+static off_t recvfile_copy(int sd, int fd, off_t offset, off_t count, off_t ret)
+{
+    char *buf;
+    off_t n, nr, nw, len;
+
+    if ((buf = malloc(RAW_BUF_SIZE)) == NULL)
+        return (-1);
+
+    /* large reads, one write per read */
+    for (n = 0; n < count; n += nr) {
+        len = count - n;
+        if (len > RAW_BUF_SIZE)
+            len = RAW_BUF_SIZE;
+        if ((nr = read(sd, buf, len)) <= 0) {
+            if (nr < 0 && errno == EINTR) {
+                nr = 0;
+                continue;
+            }
+            free(buf);
+            return (nr);     /* connection closed or read error */
+        }
+        if (ret < 0)
+            continue;        /* keep draining after a write error */
+        for (len = 0; len < nr; len += nw) {
+            if ((nw = pwrite(fd, buf + len, nr - len, offset + n + len)) <= 0) {
+                ret = -2;
+                break;
+            }
+        }
+    }
+    free(buf);
+    return (ret);
+}
+
+/* move the stream socket -> pipe -> file without copying it to user space */
+static off_t recvfile_splice(int sd, int fd, off_t offset, off_t count)
+{
+    int pfd[2];
+    off_t n, nr, nw, left;
+    loff_t off = offset;
+    char scrap[MAX_BLOCK_SIZE];
+
+    if (pipe2(pfd, O_CLOEXEC) < 0)
+        return (SPLICE_UNSUPPORTED);
+    fcntl(pfd[1], F_SETPIPE_SZ, SPLICE_PIPE_SIZE);   /* best effort */
+
+    for (n = 0; n < count; n += nr) {
+        left = count - n;
+        if (left > SPLICE_PIPE_SIZE)
+            left = SPLICE_PIPE_SIZE;
+        nr = splice(sd, NULL, pfd[1], NULL, left, SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (nr < 0 && errno == EINTR) {
+            nr = 0;
+            continue;
+        }
+        if (nr < 0 && n == 0 && (errno == EINVAL || errno == ENOSYS)) {
+            close(pfd[0]);
+            close(pfd[1]);
+            return (SPLICE_UNSUPPORTED);
+        }
+        if (nr <= 0) {
+            close(pfd[0]);
+            close(pfd[1]);
+            return (nr);     /* connection closed or read error */
+        }
+        /* empty the pipe into the file */
+        for (left = nr; left > 0; left -= nw) {
+            nw = splice(pfd[0], NULL, fd, &off, left, SPLICE_F_MOVE);
+            if (nw < 0 && errno == EINTR) {
+                nw = 0;
+                continue;
+            }
+            if (nw <= 0)
+                break;
+        }
+        if (left == nr && n == 0 && nw < 0 && (errno == EINVAL || errno == ENOSYS)) {
+            /* the file takes no splice: write out the pipe, copy the rest */
+            for (; left > 0; left -= nw, off += nw) {
+                if ((nw = read(pfd[0], scrap,
+                        left < MAX_BLOCK_SIZE ? left : MAX_BLOCK_SIZE)) <= 0)
+                    break;
+                if (pwrite(fd, scrap, nw, off) != nw) {
+                    left -= nw;
+                    nw = -1;
+                    break;
+                }
+            }
+            if (left == 0 && nw > 0) {
+                close(pfd[0]);
+                close(pfd[1]);
+                return (recvfile_copy(sd, fd, off, count - nr, count));
+            }
+        }
+        if (left > 0 || nw < 0) {
+            /* write error: throw away the pipe, drain the rest of the stream */
+            while (left > 0 && (nw = read(pfd[0], scrap,
+                    left < MAX_BLOCK_SIZE ? left : MAX_BLOCK_SIZE)) > 0)
+                left -= nw;
+            close(pfd[0]);
+            close(pfd[1]);
+            return (recvfile_copy(sd, -1, 0, count - n - nr, -2));
+        }
+    }
+    close(pfd[0]);
+    close(pfd[1]);
+    return (count);
+}
+
+off_t recvfilen(int sd, int fd, off_t offset, off_t count)
+{
+    char buf[STREAM_BUF_SIZE];
+    off_t done = 0, left, ret;
+    int n, failed = (fd < 0);
+
+    /* bytes read ahead by the stream come first */
+    while (done < count) {
+        left = count - done;
+        if ((n = takebuffered(sd, buf, left < STREAM_BUF_SIZE ? left : STREAM_BUF_SIZE)) == 0)
+            break;
+        if (!failed && pwrite(fd, buf, n, offset + done) != n)
+            failed = 1;
+        done += n;
+    }
+    if (done == count)
+        return (failed ? -2 : count);
+    if (flush(sd, 0) < 0)
+        return (-1);
+    /* no file to write to: drain the rest */
+    if (failed)
+        return (recvfile_copy(sd, -1, 0, count - done, -2));
+
+    left = count - done;
+    ret = recvfile_splice(sd, fd, offset + done, left);
+    if (ret == SPLICE_UNSUPPORTED)
+        ret = recvfile_copy(sd, fd, offset + done, left, left);
+    return (ret == left ? count : ret);
+}
+
+off_t sendbulkfile(int sd, int fd, off_t offset, off_t count, int blksize)
+{
+    uint32_t data_size;
+    off_t n, nr, len;
+
+    for (n = 0; n < count; n += nr) {
+        len = count - n;
+        if (len > blksize)
+            len = blksize;
+        data_size = htonl(len);
+        if (sendframe(sd, (char *) &data_size, 4, NULL, 0) < 0)
+            return (-1);
+        /* sum the pages first, sendfile() then finds them in the cpu cache */
+        /* (only when asked, this is a second pass over the data) */
+        sumdata(sd, fd, offset + n, NULL, len);
+        if ((nr = sendfilen(sd, fd, offset + n, len)) < 0)
+            return (-1);
+        if (nr < len) {
+            sumdata(sd, -1, 0, NULL, len);
+            n += nr;
+            break;          /* file shrank, the frame is padded */
+        }
+    }
+    /* the empty frame ends the file */
+    sumend(sd);
+    data_size = 0;
+    if (sendframe(sd, (char *) &data_size, 4, NULL, 0) < 0)
+        return (-1);
+    return (n);
+}
+
+off_t recvbulkframe(int sd, int fd, off_t offset, int blksize)
+{
+    uint32_t data_size;
+    off_t len, nr;
+
+    if (readfull(sd, (char *) &data_size, 4) != 4)
+        return (-1);
+    if ((len = ntohl(data_size)) == 0) {
+        sumend(sd);
+        return (0);
+    }
+    if (len > MAX_BULK_SIZE)
+        return (-1);     /* not a bulk frame, the stream is lost */
+    if (len > blksize) {
+        sumdata(sd, -1, 0, NULL, len);
+        return (skip(sd, len) < 0 ? -1 : -3);
+    }
+    if ((nr = recvfilen(sd, fd, offset, len)) == -2) {
+        sumdata(sd, -1, 0, NULL, len);
+        return (-2);
+    }
+    /* what landed in the file, not what went by on the socket */
+    if (nr == len)
+        sumdata(sd, fd, offset, NULL, len);
+    return (nr < len ? -1 : len);
+}
+
+off_t recvbulkfile(int sd, int fd, off_t offset, int blksize)
+{
+    off_t n = 0, nr;
+    int ret = 0;
+
+    /* a write error or a bad frame leaves fd alone and keeps draining */
+    while ((nr = recvbulkframe(sd, ret < 0 ? -1 : fd, offset + n, blksize)) != 0) {
+        if (nr == -2 || nr == -3) {
+            ret = (ret < 0) ? ret : nr;
+            continue;
+        }
+        if (nr < 0)
+            return (nr);
+        n += nr;
+    }
+    return (ret < 0 ? ret : n);
+}
+
+#define PACK_HDR 5   /* codec and unpacked length after the frame length */
+
+static char *rawbuf, *packbuf;   /* COMP_CHUNK work buffers of packed frames */
+
+static int packbuffers(void)
+{
+    if (rawbuf == NULL)
+        rawbuf = malloc(COMP_CHUNK);
+    if (packbuf == NULL)
+        packbuf = malloc(COMP_CHUNK);
+    return ((rawbuf == NULL || packbuf == NULL) ? -1 : 0);
+}
+
+/* send a packed frame of "len" bytes of buf, "raw" bytes once unpacked */
+static int sendpacked(int sd, int codec, char *buf, int len, int raw)
+{
+    char hdr[4 + PACK_HDR];
+    uint32_t n;
+
+    n = htonl(PACK_HDR + len);
+    memcpy(hdr, &n, 4);
+    hdr[4] = codec;
+    n = htonl(raw);
+    memcpy(hdr + 5, &n, 4);
+    return (sendframe(sd, hdr, sizeof(hdr), buf, buf != NULL ? len : 0));
+}
+
+off_t sendpackedfile(int sd, int fd, off_t offset, off_t count, int blksize, int codec)
+{
+    uint32_t data_size;
+    off_t n, nr, len;
+    int packed, probe = 1;
+
+    if (codec != COMP_RAW && packbuffers() < 0)
+        codec = COMP_RAW;
+    for (n = 0; n < count; n += nr) {
+        len = count - n;
+        if (len > blksize - PACK_HDR)
+            len = blksize - PACK_HDR;
+        if (codec == COMP_RAW) {
+            /* raw blocks still move with sendfile() */
+            if (sendpacked(sd, COMP_RAW, NULL, len, len) < 0)
+                return (-1);
+            sumdata(sd, fd, offset + n, NULL, len);
+            if ((nr = sendfilen(sd, fd, offset + n, len)) < 0)
+                return (-1);
+            if (nr < len)
+                sumdata(sd, -1, 0, NULL, len);
+        } else {
+            if (len > COMP_CHUNK)
+                len = COMP_CHUNK;
+            if ((nr = pread(fd, rawbuf, len, offset + n)) < 0)
+                return (-1);
+            if (nr == 0)
+                break;
+            sumdata(sd, fd, 0, rawbuf, nr);
+            if ((packed = comp_pack(codec, rawbuf, nr, packbuf, COMP_CHUNK)) > 0) {
+                if (sendpacked(sd, codec, packbuf, packed, nr) < 0)
+                    return (-1);
+            } else if (sendpacked(sd, COMP_RAW, rawbuf, nr, nr) < 0) {
+                return (-1);
+            }
+            /* data that the first block shows to be packed already, */
+            /* or random, is not worth the CPU for the rest of the file */
+            if (probe && (packed < 0 || packed > nr - nr / 8))
+                codec = COMP_RAW;
+            probe = 0;
+        }
+        if (nr < len) {
+            n += nr;
+            break;          /* file shrank */
+        }
+    }
+    /* the empty frame ends the file */
+    sumend(sd);
+    data_size = 0;
+    if (sendframe(sd, (char *) &data_size, 4, NULL, 0) < 0)
+        return (-1);
+    return (n);
+}
+
+off_t recvpackedframe(int sd, int fd, off_t offset, int blksize)
+{
+    char hdr[PACK_HDR];
+    uint32_t data_size, raw;
+    off_t len, nr;
+    int n;
+
+    if (readfull(sd, (char *) &data_size, 4) != 4)
+        return (-1);
+    if ((len = ntohl(data_size)) == 0) {
+        sumend(sd);
+        return (0);
+    }
+    if (len > MAX_BULK_SIZE)
+        return (-1);     /* not a packed frame, the stream is lost */
+    if (len > blksize || len <= PACK_HDR) {
+        sumdata(sd, -1, 0, NULL, len);
+        return (skip(sd, len) < 0 ? -1 : -3);
+    }
+    if (readfull(sd, hdr, PACK_HDR) != PACK_HDR)
+        return (-1);
+    memcpy(&raw, hdr + 1, 4);
+    raw = ntohl(raw);
+    len -= PACK_HDR;
+    if (hdr[0] == COMP_RAW) {
+        if (raw != len) {
+            sumdata(sd, -1, 0, NULL, len);
+            return (skip(sd, len) < 0 ? -1 : -3);
+        }
+        if ((nr = recvfilen(sd, fd, offset, len)) == -2) {
+            sumdata(sd, -1, 0, NULL, len);
+            return (-2);
+        }
+        if (nr == len)
+            sumdata(sd, fd, offset, NULL, len);
+        return (nr < len ? -1 : len);
+    }
+    if (len > COMP_CHUNK || raw > COMP_CHUNK) {
+        sumdata(sd, -1, 0, NULL, len);
+        return (skip(sd, len) < 0 ? -1 : -3);
+    }
+    if (packbuffers() < 0 || readfull(sd, packbuf, len) != len)
+        return (-1);
+    if ((n = comp_unpack(hdr[0], packbuf, len, rawbuf, COMP_CHUNK)) != (int) raw) {
+        sumdata(sd, -1, 0, NULL, len);
+        return (-3);
+    }
+    if (fd < 0 || pwrite(fd, rawbuf, n, offset) != n) {
+        sumdata(sd, -1, 0, NULL, n);
+        return (-2);
+    }
+    sumdata(sd, fd, 0, rawbuf, n);
+    return (n);
+}
+
+off_t recvpackedfile(int sd, int fd, off_t offset, int blksize)
+{
+    off_t n = 0, nr;
+    int ret = 0;
+
+    /* a write error or a bad frame leaves fd alone and keeps draining */
+    while ((nr = recvpackedframe(sd, ret < 0 ? -1 : fd, offset + n, blksize)) != 0) {
+        if (nr == -2 || nr == -3) {
+            ret = (ret < 0) ? ret : nr;
+            continue;
+        }
+        if (nr < 0)
+            return (nr);
+        n += nr;
+    }
+    return (ret < 0 ? ret : n);
+}
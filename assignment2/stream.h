@@ -6,9 +6,77 @@
  */
 
 
+#include <sys/types.h>             /* off_t */
+#include <stdint.h>                /* uint32_t */
+
 #define MAX_BLOCK_SIZE (1024*5)    /* maximum size of any piece of */
                                    /* data that can be sent by client */
 
+#define MAX_BULK_SIZE (1024*1024*8) /* maximum size of a bulk frame */
+#define DEF_BULK_SIZE (1024*1024)   /* bulk frame size of a connection */
+                                    /* until another one is agreed */
+
+#define STREAM_BUF_SIZE (1024*16)  /* read ahead and write behind */
+                                   /* buffers of a connection */
+
+/*
+ * purpose:  attach a buffered reader/writer to the connection "fd".
+ *           From then on readn(), writen() and the functions below read
+ *           ahead into a user space buffer and collect written frames in
+ *           another one, so a whole exchange of small frames costs a few
+ *           system calls. Buffered frames go out on stream_flush(), when
+ *           the buffer fills up, or before a read has to wait for the
+ *           peer, so a request is never stuck behind its own reply.
+ * post:     1) return value = 0  : buffers attached
+ *                           = -1 : out of memory
+ */
+int stream_open(int fd);
+
+/*
+ * purpose:  write out every frame buffered for "fd".
+ * post:     1) return value = 0  : nothing is left buffered
+ *                           = -1 : write error
+ */
+int stream_flush(int fd);
+
+/*
+ * purpose:  turn on or off the sum of the file data the bulk and raw
+ *           packed frame functions below move without a copy (sendfile(),
+ *           splice()). Such data has to be read back from the file to be
+ *           summed, a second pass over it, so it is off unless a transfer
+ *           asks for it; data that passes through a buffer (compressed
+ *           frames) is always summed. A transfer with data left unsummed
+ *           has no sum, see stream_sum().
+ */
+void stream_readback(int fd, int on);
+
+/*
+ * purpose:  tell how many bytes of "fd" are read ahead, so a caller
+ *           knows whether the next read can wait for the peer.
+ * post:     1) return value = bytes buffered, 0 if fd has no stream
+ */
+int stream_pending(int fd);
+
+/*
+ * purpose:  take the CRC-32C of the file data of the last file sent or
+ *           received over "fd" with the bulk or packed frame functions
+ *           below. The sender sums the file bytes as it sends them, the
+ *           receiver the bytes it stored, read back from its file, so
+ *           the two sums agree only if the data landed as it left.
+ * post:     1) return value = 0  : *crc holds the checksum, which is
+ *                                  given out only once
+ *                           = -1 : no checksum, fd has no stream or
+ *                                  the file could not be read back
+ */
+int stream_sum(int fd, uint32_t *crc);
+
+/*
+ * purpose:  flush and detach the buffers of "fd", must be called before
+ *           fd is closed or handed to another client.
+ * post:     1) return value as for stream_flush()
+ */
+int stream_close(int fd);
+
 /*
  * purpose:  read a stream of bytes from "fd" to "buf".
  * pre:      1) size of buf bufsize >= MAX_BLOCK_SIZE,
@@ -25,6 +93,8 @@ int readn(int fd, char *buf, int bufsize);
 
 /*
  * purpose:  write "nbytes" bytes from "buf" to "fd".
+ *           The length and the bytes go out in one writev(), or into the
+ *           write buffer if fd has one.
  * pre:      1) nbytes <= MAX_BLOCK_SIZE,
  * post:     1) nbytes bytes from buf written to fd;
  *           2) return value = nbytes : number ofbytes written
@@ -33,3 +103,126 @@ int readn(int fd, char *buf, int bufsize);
  */           
 int writen(int fd, char *buf, int nbytes);
 
+#define RAW_BUF_SIZE (1024*256)    /* buffer of the copy loop of a */
+                                   /* raw data phase */
+
+/*
+ * purpose:  send "count" bytes of file "fd", starting at "offset", to the
+ *           socket "sd" as a raw byte stream (no framing), using sendfile()
+ *           so the data is never copied to user space.
+ * pre:      1) sd is a blocking stream socket.
+ * post:     1) exactly count bytes are sent; if the file ends early the
+ *              rest is padded with zeros so the receiver stays in step;
+ *           2) return value >= 0 : number of bytes taken from the file
+ *                           = -1 : read or write error
+ */
+off_t sendfilen(int sd, int fd, off_t offset, off_t count);
+
+/*
+ * purpose:  receive a raw byte stream of "count" bytes from the socket "sd"
+ *           and store it in file "fd" starting at "offset".
+ *           The bytes move socket -> pipe -> file with splice(), falling back
+ *           to a RAW_BUF_SIZE copy loop where splice() is not supported.
+ * post:     1) return value = count : all bytes received and stored
+ *                           = 0     : connection closed
+ *                           = -1    : read error
+ *                           = -2    : write error, the stream is still
+ *                                     drained so the connection stays usable
+ */
+off_t recvfilen(int sd, int fd, off_t offset, off_t count);
+
+
+/*
+ * Bulk frames carry file payloads. Unlike the frames of readn()/writen(),
+ * which have a 16-bit length and are kept for control messages, a bulk
+ * frame has a 32-bit length in network byte order followed by up to
+ * the block size agreed for the connection (at most MAX_BULK_SIZE) bytes.
+ * A file is sent as a run of bulk frames ended by an empty frame.
+ */
+
+/*
+ * purpose:  read one bulk frame from "fd" to "buf".
+ * pre:      1) bufsize is the block size of the connection
+ * post:     1) return value >= 0 : number of bytes read, 0 ends a file
+ *                           = -1  : read error or connection closed
+ *                           = -2  : protocol error
+ *                           = -3  : buffer too small, the frame is
+ *                                   passed over so the next read starts
+ *                                   at the next frame
+ */
+int readbulk(int fd, char *buf, int bufsize);
+
+/*
+ * purpose:  write "nbytes" bytes from "buf" to "fd" as one bulk frame.
+ * post:     1) return value = nbytes : number of bytes written
+ *                           = -3     : too many bytes to send
+ *                           otherwise: write error
+ */
+int writebulk(int fd, char *buf, int nbytes);
+
+/*
+ * purpose:  send "count" bytes of file "fd", starting at "offset", to the
+ *           socket "sd" as bulk frames of at most "blksize" bytes followed
+ *           by the empty frame. The payload goes out with sendfilen().
+ * post:     1) return value >= 0 : number of bytes taken from the file,
+ *                                  less than count if the file shrank
+ *                           = -1 : read or write error
+ */
+off_t sendbulkfile(int sd, int fd, off_t offset, off_t count, int blksize);
+
+/*
+ * purpose:  receive the bulk frames of a file from the socket "sd" up to
+ *           the empty frame and store them in file "fd" starting at
+ *           "offset". The payload goes in with recvfilen().
+ * post:     1) return value >= 0 : number of bytes received
+ *                           = -1 : read error or connection closed
+ *                           = -2 : write error, the frames are still
+ *                                  drained so the connection stays usable
+ *                           = -3 : a frame larger than blksize, the
+ *                                  frames are still drained
+ */
+off_t recvbulkfile(int sd, int fd, off_t offset, int blksize);
+
+/*
+ * purpose:  receive one bulk frame from the socket "sd" into file "fd" at
+ *           "offset", for receivers that act between frames.
+ * post:     1) return value > 0  : number of bytes received
+ *                           = 0  : the empty frame, the file is complete
+ *                           = -1 : read error or connection closed
+ *                           = -2 : write error, the frame is still drained
+ *                           = -3 : frame larger than blksize, it is still
+ *                                  drained
+ */
+off_t recvbulkframe(int sd, int fd, off_t offset, int blksize);
+/*
+ * Packed bulk frames carry the file data of a transfer that agreed on a
+ * codec (see compress.h). After its 32-bit length a packed frame has the
+ * codec of its block in one byte and the unpacked length in 32 bits, then
+ * the block. COMP_RAW blocks are the file bytes as they are.
+ */
+/*
+ * purpose:  send "count" bytes of file "fd", starting at "offset", to the
+ *           socket "sd" as packed frames of at most "blksize" bytes,
+ *           followed by the empty frame. Blocks are packed with "codec"
+ *           while it pays: if the first block does not shrink by an
+ *           eighth, the rest of the file goes raw with sendfilen().
+ * post:     1) return value >= 0 : number of bytes taken from the file,
+ *                                  less than count if the file shrank
+ *                           = -1 : read or write error
+ */
+off_t sendpackedfile(int sd, int fd, off_t offset, off_t count, int blksize, int codec);
+/*
+ * purpose:  receive one packed frame from the socket "sd" and store the
+ *           unpacked block in file "fd" at "offset".
+ * post:     1) return value > 0  : number of bytes stored
+ *                           = 0  : the empty frame, the file is complete
+ *                           = -1 : read error or connection closed
+ *                           = -2 : write error, the frame is still drained
+ *                           = -3 : frame larger than blksize or corrupt,
+ *                                  it is still drained
+ */
+off_t recvpackedframe(int sd, int fd, off_t offset, int blksize);
+/*
+ * purpose:  as recvbulkfile() for the packed frames of a file.
+ */
+off_t recvpackedfile(int sd, int fd, off_t offset, int blksize);
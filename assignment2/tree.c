@@ -0,0 +1,306 @@
+/*
+ *  tree.c    - directory tree transfers of the version 2 protocol
+ *              entries streamed back to back, see tree.h
+ */
+
+#include  <unistd.h>
+#include  <stdio.h>
+#include  <stdlib.h>
+#include  <string.h>
+#include  <errno.h>
+#include  <fcntl.h>
+#include  <limits.h>
+#include  <dirent.h>
+#include  <sys/types.h>
+#include  <sys/stat.h>
+#include  "stream.h"
+#include  "netprotocol.h"
+#include  "tree.h"
+
+/* a directory whose mode and mtime are set once its entries are in */
+struct tree_dir
+{
+    char *path;
+    mode_t mode;
+    time_t mtime;
+};
+
+int tree_root(char *path, char *root)
+{
+    char real[PATH_MAX];
+    struct stat st;
+    char *base;
+
+    if (realpath(path, real) == NULL || stat(real, &st) < 0 || !S_ISDIR(st.st_mode))
+        return -1;
+    if ((base = strrchr(real, '/')) == NULL || base[1] == '\0')
+        return -1;
+    strcpy(root, base + 1);
+    return 0;
+}
+
+/* send the entry "wire" of "st", a directory or a regular file */
+static int tree_entry(int sd, char op, char *wire, struct stat *st, char flags)
+{
+    struct v2_msg m;
+
+    m.op = op;
+    m.status = V2_OK;
+    m.flags = flags;
+    m.size = S_ISDIR(st->st_mode) ? 0 : st->st_size;
+    m.offset = st->st_mtime;
+    m.id = st->st_mode & 07777;
+    m.data = wire;
+    m.len = strlen(wire);
+    return (v2_send(sd, &m) < 0) ? -1 : 0;
+}
+
+/* send the regular file "disk" as "wire" with its data */
+static int tree_file(int sd, char op, char *disk, char *wire, int blksize, struct tree_stats *ts)
+{
+    char data[TREE_INLINE];
+    struct stat st;
+    off_t nr;
+    int fd;
+
+    if ((fd = open(disk, O_RDONLY)) < 0 || fstat(fd, &st) < 0)
+    {
+        if (fd >= 0)
+            close(fd);
+        ts->failed++;
+        return 0;
+    }
+    /* a small file rides in the write buffer right behind its entry */
+    if (st.st_size <= TREE_INLINE)
+    {
+        if ((nr = pread(fd, data, st.st_size, 0)) < 0)
+        {
+            close(fd);
+            ts->failed++;
+            return 0;
+        }
+        close(fd);
+        st.st_size = nr;
+        if (tree_entry(sd, op, wire, &st, nr > 0 ? V2_F_DATA : 0) < 0 || (nr > 0 && writen(sd, data, nr) != nr))
+            return -1;
+        ts->files++;
+        ts->bytes += nr;
+        return 0;
+    }
+    if (tree_entry(sd, op, wire, &st, 0) < 0 || (nr = sendbulkfile(sd, fd, 0, st.st_size, blksize)) < 0 ||
+        v2_trailer(sd, op, nr) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    close(fd);
+    ts->files++;
+    ts->bytes += nr;
+    return 0;
+}
+
+/* send the directory "disk" as "wire", then everything below it */
+static int tree_walk(int sd, char op, char *disk, char *wire, int blksize, struct tree_stats *ts)
+{
+    struct dirent *de;
+    struct stat st;
+    DIR *dp;
+    int dlen = strlen(disk), wlen = strlen(wire), ret = 0;
+
+    if (lstat(disk, &st) < 0 || tree_entry(sd, op, wire, &st, V2_F_DIR) < 0)
+        return -1;
+    ts->dirs++;
+    if ((dp = opendir(disk)) == NULL)
+    {
+        ts->failed++;
+        return 0;
+    }
+    while (ret == 0 && (de = readdir(dp)) != NULL)
+    {
+        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+            continue;
+        /* the names are built in place and cut back after each entry */
+        if (dlen + strlen(de->d_name) + 2 > PATH_MAX || wlen + strlen(de->d_name) + 2 > MAX_BLOCK_SIZE - V2_HDR_SIZE)
+        {
+            ts->failed++;
+            continue;
+        }
+        sprintf(disk + dlen, "/%s", de->d_name);
+        sprintf(wire + wlen, "/%s", de->d_name);
+        if (lstat(disk, &st) < 0)
+            ts->failed++;
+        else if (S_ISDIR(st.st_mode))
+            ret = tree_walk(sd, op, disk, wire, blksize, ts);
+        else if (S_ISREG(st.st_mode))
+            ret = tree_file(sd, op, disk, wire, blksize, ts);
+        disk[dlen] = '\0';
+        wire[wlen] = '\0';
+    }
+    closedir(dp);
+    return ret;
+}
+
+int tree_send(int sd, char op, char *path, int blksize, struct tree_stats *ts)
+{
+    char disk[PATH_MAX], wire[PATH_MAX];
+    struct v2_msg m;
+
+    memset(ts, 0, sizeof(struct tree_stats));
+    if (tree_root(path, wire) < 0 || strlen(path) >= PATH_MAX)
+        return -1;
+    strcpy(disk, path);
+    if (tree_walk(sd, op, disk, wire, blksize, ts) < 0)
+        return -1;
+    m.op = op;
+    m.status = V2_OK;
+    m.flags = V2_F_END;
+    m.size = ts->dirs + ts->files;
+    m.offset = 0;
+    m.id = 0;
+    m.data = NULL;
+    m.len = 0;
+    if (v2_send(sd, &m) < 0 || stream_flush(sd) < 0)
+        return -1;
+    return 0;
+}
+
+/* a path below "root" made only of plain names, never .. or absolute */
+static int tree_valid(char *path, char *root)
+{
+    char *p, *end;
+    int len;
+
+    for (p = path; ; p = end + 1)
+    {
+        end = strchr(p, '/');
+        len = (end == NULL) ? (int)strlen(p) : (int)(end - p);
+        if (len == 0 || (len == 1 && p[0] == '.') || (len == 2 && p[0] == '.' && p[1] == '.'))
+            return 0;
+        if (p == path && ((int)strlen(root) != len || strncmp(p, root, len) != 0))
+            return 0;
+        if (end == NULL)
+            return 1;
+    }
+}
+
+/* store the data of file entry "m" in "fd", -1 to drain, returns -1 on a */
+/* broken stream, or the number of bytes stored */
+static off_t tree_data(int sd, struct v2_msg *m, int fd, int blksize, char *buf)
+{
+    struct v2_msg trailer;
+    uint32_t crc;
+    off_t nr;
+
+    if (m->size == 0)
+        return 0;
+    if (m->flags & V2_F_DATA)
+    {
+        if (m->size > TREE_INLINE || readn(sd, buf, MAX_BLOCK_SIZE) != m->size)
+            return -1;
+        if (fd >= 0 && write(fd, buf, m->size) != m->size)
+            return -2;
+        return m->size;
+    }
+    nr = recvbulkfile(sd, fd, 0, blksize);
+    if (nr == -1 || v2_recv(sd, &trailer, buf) < 0 || trailer.op != m->op)
+        return -1;
+    if (nr == -2 || nr == -3 || trailer.size > nr || v2_check(sd, &trailer, nr, &crc) < 0)
+        return -2;
+    /* the file shrank while it was sent */
+    if (trailer.size < nr && fd >= 0 && ftruncate(fd, trailer.size) < 0)
+        return -2;
+    return trailer.size;
+}
+
+int tree_recv(int sd, char op, char *root, int drain, int modes, int blksize, struct tree_stats *ts)
+{
+    char buf[MAX_BLOCK_SIZE], path[MAX_BLOCK_SIZE], top[MAX_BLOCK_SIZE];
+    struct tree_dir *dirs = NULL, *p;
+    struct timespec times[2];
+    struct v2_msg m;
+    struct stat st;
+    int ndirs = 0, fd, ok, ret = 0;
+    off_t nr;
+
+    memset(ts, 0, sizeof(struct tree_stats));
+    modes &= 0777;
+    top[0] = '\0';
+    if (root != NULL)
+        strcpy(top, root);
+    while (1)
+    {
+        if (v2_recv(sd, &m, buf) < 0 || m.op != op)
+        {
+            ret = -1;
+            break;
+        }
+        if (m.flags & V2_F_END)
+            break;
+        memcpy(path, m.data, m.len);
+        path[m.len] = '\0';
+        /* the first entry names the tree, the rest must be below it */
+        if (top[0] == '\0' && (m.flags & V2_F_DIR) && strchr(path, '/') == NULL)
+            strcpy(top, path);
+        ok = !drain && top[0] != '\0' && tree_valid(path, top);
+        times[0].tv_sec = times[1].tv_sec = m.offset;
+        times[0].tv_nsec = times[1].tv_nsec = 0;
+        if (m.flags & V2_F_DIR)
+        {
+            if (ok && mkdir(path, 0700) < 0 && (errno != EEXIST || lstat(path, &st) < 0 || !S_ISDIR(st.st_mode)))
+                ok = 0;
+            if (ok && (ndirs & (ndirs - 1)) == 0)
+            {
+                /* grow by doubling whenever ndirs is a power of two */
+                if ((p = realloc(dirs, (ndirs == 0 ? 1 : ndirs * 2) * sizeof(struct tree_dir))) == NULL)
+                    ok = 0;
+                else
+                    dirs = p;
+            }
+            if (ok && (dirs[ndirs].path = strdup(path)) != NULL)
+            {
+                dirs[ndirs].mode = m.id & modes;
+                dirs[ndirs].mtime = m.offset;
+                ndirs++;
+                ts->dirs++;
+            }
+            else if (!drain)
+            {
+                ts->failed++;
+            }
+            continue;
+        }
+        /* a file never replaces a link, whatever its name */
+        fd = ok ? open(path, O_RDWR | O_CREAT | O_TRUNC | O_NOFOLLOW, 0600) : -1;
+        if ((nr = tree_data(sd, &m, fd, blksize, buf)) == -1)
+        {
+            if (fd >= 0)
+                close(fd);
+            ret = -1;
+            break;
+        }
+        if (fd >= 0 && nr >= 0 && fchmod(fd, m.id & modes) == 0 && futimens(fd, times) == 0)
+        {
+            ts->files++;
+            ts->bytes += nr;
+        }
+        else if (!drain)
+        {
+            ts->failed++;
+        }
+        if (fd >= 0)
+            close(fd);
+    }
+    /* children first, so a directory keeps its mtime and a read only */
+    /* one its entries */
+    while (ndirs > 0)
+    {
+        p = &dirs[--ndirs];
+        times[0].tv_sec = times[1].tv_sec = p->mtime;
+        times[0].tv_nsec = times[1].tv_nsec = 0;
+        utimensat(AT_FDCWD, p->path, times, AT_SYMLINK_NOFOLLOW);
+        chmod(p->path, p->mode);
+        free(p->path);
+    }
+    free(dirs);
+    return ret;
+}
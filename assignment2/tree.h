@@ -0,0 +1,52 @@
+/*
+ *  tree.h    - directory tree transfers of the version 2 protocol
+ *              (see TREE_GET_CODE in netprotocol.h)
+ *              Shared by the client and the server: the sending side walks
+ *              the tree and streams every entry back to back with no reply
+ *              in between, the receiving side recreates the tree with the
+ *              modes and mtimes of the sender.
+ */
+
+#define TREE_INLINE (1024*4)       /* largest file whose data goes in the */
+                                   /* frame after its entry */
+
+struct tree_stats
+{
+    int dirs;                      /* directories sent / created */
+    int files;                     /* regular files sent / stored */
+    int failed;                    /* entries not sent / not stored */
+    long long bytes;               /* file data sent / stored */
+};
+
+/*
+ * purpose:  find the name the directory "path" has as a tree, the last
+ *           component of its real path, into "root" (PATH_MAX bytes).
+ * post:     1) return value = 0  : path is a directory other than /
+ *                           = -1 : it is not
+ */
+int tree_root(char *path, char *root);
+
+/*
+ * purpose:  send the tree of the directory "path" to "sd" as entries of
+ *           "op" followed by the end message. Symbolic links and special
+ *           files are left out, files that cannot be read are counted as
+ *           failed.
+ * pre:      1) tree_root(path) succeeds
+ * post:     1) return value = 0  : the tree is sent
+ *                           = -1 : write error
+ */
+int tree_send(int sd, char op, char *path, int blksize, struct tree_stats *ts);
+
+/*
+ * purpose:  receive a tree of "op" entries from "sd" up to its end
+ *           message and recreate it under the current directory. The
+ *           first entry must be the top directory, named "root" unless
+ *           root is NULL, and every other entry must lie below it. With
+ *           "drain" set nothing is stored. An entry keeps the mode bits of
+ *           the sender that are in "modes" as well, never the setuid,
+ *           setgid or sticky bit.
+ * post:     1) return value = 0  : the whole tree was read, ts tells what
+ *                                  could be stored
+ *                           = -1 : read or protocol error
+ */
+int tree_recv(int sd, char op, char *root, int drain, int modes, int blksize, struct tree_stats *ts);